@@ -0,0 +1,424 @@
+#!/usr/bin/env python3
+"""Benchmarks the interpreter on the programs in progs/.
+
+Each program is run with a fixed input through the interpreter, through the
+interpreter with optimizations turned off (--no-opt), and as an executable
+built from the compiled C (--build). Every run's wall time and peak resident
+set size are measured, and one extra run of each interpreted program counts
+the commands it executes (--count-ops) and its garbage collections and
+allocations (--gc-stats), which don't change from run to run.
+
+With --stress, the programs in progs/bench/ are run instead, each at several
+sizes given as its input, to show how the costs of calls, collection and
+strings grow with the size of the work.
+
+Results can be saved as JSON with --save, and compared with a saved baseline
+with --compare, which flags regressions and exits with status 1 if there are
+any.
+"""
+
+import argparse
+import hashlib
+import json
+import math
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# The programs run, with the file given as their input and how many times it's
+# repeated. Programs that don't read input are given nothing
+PROGRAMS = [
+    ("hello", "progs/hello.glass", None, 1),
+    ("fib", "progs/fib.glass", None, 1),
+    ("fizzbuzz", "progs/fizzbuzz.glass", None, 1),
+    ("beer", "progs/beer.glass", None, 1),
+    ("quine", "progs/quine.glass", None, 1),
+    ("rot13", "progs/rot13.glass", "LICENSE.txt", 100),
+    ("bf", "progs/bf.glass", "bench/inputs/loops.bf", 1),
+    ("bf-small", "progs/bf-small.glass", "bench/inputs/loops.bf", 1),
+    ("self", "progs/self-interpreter/main.glass",
+     "bench/inputs/fib14.glass", 1),
+    ("self-min", "progs/self-interpreter/self.glass",
+     "bench/inputs/fib14.glass", 1),
+]
+
+# The stress programs, with the files given as their input ahead of their size,
+# separated by semicolons, how the size is written, and the sizes they're run
+# at by default. The self-interpreter reads a program up to a semicolon and
+# gives it the rest of the input, so it can run itself running a program, and
+# bf.glass does the same for a brainfuck program. cubes.b reads its size as a
+# single character, 32 past the size's code
+STRESS = [
+    ("fib", "progs/bench/fib.glass", [], str, [18, 21, 24, 27]),
+    ("self-self-fib", "progs/self-interpreter/self.glass",
+     ["progs/self-interpreter/self.glass", "progs/bench/fib.glass"], str,
+     [5, 7, 9]),
+    ("bf-cubes", "progs/bf.glass", ["progs/bench/cubes.b"],
+     lambda size: chr(32 + size), [4, 8, 12, 16]),
+    ("binary-trees", "progs/bench/binary-trees.glass", [], str,
+     [6, 8, 10, 12]),
+    ("strings", "progs/bench/strings.glass", [], str,
+     [5000, 10000, 20000, 40000]),
+    # The interpreter's own stack overflows past about 7000 calls deep
+    ("recursion", "progs/bench/recursion.glass", [], str,
+     [1000, 2000, 4000, 6000]),
+]
+
+# The ways each program is run, with the flags given to the interpreter
+MODES = [
+    ("interp", []),
+    ("no-opt", ["--no-opt"]),
+    ("compiled", None),
+]
+
+# How much slower, as a fraction, a program's median time has to be than the
+# baseline's to be flagged, as long as the difference is also larger than the
+# noise between runs. Peak memory has its own threshold, and has to grow by at
+# least a megabyte, as small programs vary by a few pages from run to run
+TIME_THRESHOLD = 0.05
+RSS_THRESHOLD = 0.10
+RSS_NOISE_KB = 1024
+
+# The metrics that are the same on every run, which regress if they go up at
+# all
+EXACT_METRICS = ["commands", "gc_count", "allocations"]
+
+
+class BenchError(Exception):
+    pass
+
+
+def get_input(name, repeat):
+    """Returns the bytes a program is given as input."""
+    if name is None:
+        return b""
+    with open(os.path.join(REPO, name), "rb") as file:
+        return file.read() * repeat
+
+
+def get_stress_input(files, write_size, size):
+    """Returns the bytes a stress program is given as input at a size."""
+    parts = []
+    for name in files:
+        with open(os.path.join(REPO, name), "rb") as file:
+            parts.append(file.read())
+    parts.append(write_size(size).encode("latin-1"))
+    return b";".join(parts)
+
+
+def get_benchmarks(args):
+    """Returns the name, program and input of each benchmark to run."""
+    benchmarks = []
+    if args.stress:
+        for name, path, files, write_size, sizes in STRESS:
+            if args.programs and name not in args.programs:
+                continue
+            for size in args.sizes or sizes:
+                benchmarks.append(("{}@{}".format(name, size), path,
+                                   get_stress_input(files, write_size, size)))
+    else:
+        for name, path, input_name, repeat in PROGRAMS:
+            if not args.programs or name in args.programs:
+                benchmarks.append((name, path, get_input(input_name, repeat)))
+    return benchmarks
+
+
+def build_rusage(directory):
+    """Builds the program that measures each run, returning its path."""
+    rusage = os.path.join(directory, "rusage")
+    compiler = os.environ.get("CC", "cc")
+    result = subprocess.run(
+        [compiler, "-O2", os.path.join(REPO, "bench", "rusage.c"), "-o",
+         rusage], capture_output=True, text=True)
+    if result.returncode != 0:
+        raise BenchError("couldn't build bench/rusage.c:\n" + result.stderr)
+    return rusage
+
+
+def run_once(args, command, stdin):
+    """Runs a command, returning its wall time in seconds, its peak resident
+    set size in kilobytes, its output and its errors."""
+    measured = os.path.join(args.directory, "measured")
+    result = subprocess.run([args.rusage, measured, *command], input=stdin,
+                            capture_output=True)
+    if result.returncode != 0:
+        raise BenchError("{} exited with status {}:\n{}".format(
+            " ".join(command), result.returncode,
+            result.stderr.decode(errors="replace")))
+    with open(measured) as file:
+        wall, peak = file.read().split()
+    return float(wall), int(peak), result.stdout, result.stderr
+
+
+def summarize(samples):
+    """Returns the statistics of a list of measurements."""
+    mean = statistics.mean(samples)
+    stdev = statistics.stdev(samples) if len(samples) > 1 else 0.0
+    return {
+        "samples": samples,
+        "min": min(samples),
+        "median": statistics.median(samples),
+        "mean": mean,
+        "stdev": stdev,
+        # Half the width of a 95% confidence interval for the mean
+        "ci95": 1.96 * stdev / math.sqrt(len(samples)),
+    }
+
+
+def get_counts(args, program, stdin, flags):
+    """Runs a program once with its commands counted and its garbage
+    collections reported, returning its output and the counts."""
+    counts_file = os.path.join(args.directory, "counts.json")
+    _, _, output, errors = run_once(
+        args, [args.glass, program, *flags, "--count-ops", counts_file,
+               "--gc-stats"], stdin)
+    with open(counts_file) as file:
+        commands = json.load(file)["total"]
+    errors = errors.decode(errors="replace")
+    gc_count = re.search(r"^Garbage collections: (\d+)", errors, re.M)
+    allocations = re.search(r"^Instances: (\d+) allocated", errors, re.M)
+    if not gc_count or not allocations:
+        raise BenchError("couldn't read the --gc-stats summary of " + program)
+    return output, {
+        "commands": commands,
+        "gc_count": int(gc_count.group(1)),
+        "allocations": int(allocations.group(1)),
+    }
+
+
+def bench_program(args, name, path, stdin, flags):
+    """Benchmarks a program in one mode, returning its results."""
+    program = os.path.join(REPO, path)
+    result = {}
+    outputs = set()
+    if flags is None:
+        # A program run at several sizes is only built once
+        if path not in args.executables:
+            executable = os.path.join(args.directory,
+                                      "program{}".format(len(args.executables)))
+            run_once(args, [args.glass, program, "--build", executable], b"")
+            args.executables[path] = executable
+        command = [args.executables[path]]
+    else:
+        command = [args.glass, program, *flags]
+        output, counts = get_counts(args, program, stdin, flags)
+        outputs.add(hashlib.sha256(output).hexdigest())
+        result.update(counts)
+
+    times, peaks = [], []
+    for i in range(args.warmup + args.runs):
+        wall, peak, output, _ = run_once(args, command, stdin)
+        outputs.add(hashlib.sha256(output).hexdigest())
+        if i >= args.warmup:
+            times.append(wall)
+            peaks.append(peak)
+    if len(outputs) != 1:
+        raise BenchError("{} gave different output on different runs".format(
+            name))
+    result["output"] = outputs.pop()
+    result["time"] = summarize(times)
+    result["rss_kb"] = summarize(peaks)
+    return result
+
+
+def format_count(value):
+    return "-" if value is None else str(value)
+
+
+def print_results(results):
+    print("{:<18} {:<9} {:>10} {:>10} {:>10} {:>9} {:>12} {:>6} {:>10}".format(
+        "program", "mode", "median s", "mean s", "stdev s", "rss KB",
+        "commands", "gcs", "allocs"))
+    for key, result in results.items():
+        name, mode = key.split("/")
+        time_stats = result["time"]
+        print("{:<18} {:<9} {:>10.4f} {:>10.4f} {:>10.4f} {:>9.0f} {:>12} "
+              "{:>6} {:>10}".format(
+                  name, mode, time_stats["median"], time_stats["mean"],
+                  time_stats["stdev"], result["rss_kb"]["median"],
+                  format_count(result.get("commands")),
+                  format_count(result.get("gc_count")),
+                  format_count(result.get("allocations"))))
+
+
+def format_ratio(now, before):
+    if now is None or not before:
+        return "-"
+    return "x{:.2f}".format(now / before)
+
+
+def print_scaling(results):
+    """Prints how much each stress program's time and counts grow from each
+    size it was run at to the next."""
+    print("\n{:<18} {:<9} {:>9} {:>9} {:>9} {:>9} {:>9}".format(
+        "scaling", "mode", "size", "time", "commands", "gcs", "allocs"))
+    previous = {}
+    for key, result in results.items():
+        name_size, mode = key.split("/")
+        name, size = name_size.split("@")
+        before = previous.get((name, mode))
+        previous[(name, mode)] = (size, result)
+        if before is None:
+            continue
+        before_size, before_result = before
+        print("{:<18} {:<9} {:>9} {:>9} {:>9} {:>9} {:>9}".format(
+            name, mode, "{}->{}".format(before_size, size),
+            format_ratio(result["time"]["median"],
+                         before_result["time"]["median"]),
+            *(format_ratio(result.get(metric), before_result.get(metric))
+              for metric in EXACT_METRICS)))
+
+
+def compare(results, baseline):
+    """Prints how the results differ from a baseline, returning the
+    regressions found."""
+    regressions = []
+    print("\n{:<28} {:>10} {:>10} {:>9}".format(
+        "compared", "base s", "now s", "change"))
+    for key, result in results.items():
+        base = baseline.get(key)
+        if base is None:
+            print("{:<28} not in the baseline".format(key))
+            continue
+
+        now_time, base_time = result["time"], base["time"]
+        change = now_time["median"] / base_time["median"] - 1
+        noise = 2 * max(now_time["stdev"], base_time["stdev"])
+        flag = ""
+        if (change > TIME_THRESHOLD
+                and now_time["median"] - base_time["median"] > noise):
+            flag = "  REGRESSION"
+            regressions.append("{} time {:+.1%}".format(key, change))
+        elif (change < -TIME_THRESHOLD
+                and base_time["median"] - now_time["median"] > noise):
+            flag = "  improved"
+        print("{:<28} {:>10.4f} {:>10.4f} {:>+8.1%}{}".format(
+            key, base_time["median"], now_time["median"], change, flag))
+
+        now_rss, base_rss = result["rss_kb"]["median"], base["rss_kb"]["median"]
+        if (now_rss > base_rss * (1 + RSS_THRESHOLD)
+                and now_rss - base_rss > RSS_NOISE_KB):
+            regressions.append("{} peak RSS {} KB -> {} KB".format(
+                key, base_rss, now_rss))
+        for metric in EXACT_METRICS:
+            if metric in result and metric in base \
+                    and result[metric] > base[metric]:
+                regressions.append("{} {} {} -> {}".format(
+                    key, metric, base[metric], result[metric]))
+        if result["output"] != base["output"]:
+            regressions.append(key + " output changed")
+
+    if regressions:
+        print("\nRegressions:")
+        for regression in regressions:
+            print("  " + regression)
+    else:
+        print("\nNo regressions")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--glass", default=os.path.join(REPO, "glass"),
+                        help="the interpreter to benchmark")
+    parser.add_argument("--runs", type=int, default=5,
+                        help="timed runs of each program in each mode")
+    parser.add_argument("--warmup", type=int, default=1,
+                        help="untimed runs before the timed ones")
+    parser.add_argument("--stress", action="store_true",
+                        help="run the stress programs at several sizes")
+    parser.add_argument("--sizes", nargs="+", type=int, metavar="SIZE",
+                        help="the sizes to run the stress programs at")
+    parser.add_argument("--programs", nargs="+", metavar="NAME",
+                        help="only run these programs")
+    parser.add_argument("--modes", nargs="+", metavar="MODE",
+                        choices=[mode[0] for mode in MODES],
+                        help="only run in these modes")
+    parser.add_argument("--save", metavar="FILE",
+                        help="write the results to a JSON file")
+    parser.add_argument("--compare", metavar="FILE",
+                        help="flag regressions against saved results")
+    args = parser.parse_args()
+    if args.runs < 1 or args.warmup < 0:
+        parser.error("there must be at least one run")
+    if args.sizes and not args.stress:
+        parser.error("--sizes can only be used with --stress")
+    names = [program[0] for program in (STRESS if args.stress else PROGRAMS)]
+    for name in args.programs or []:
+        if name not in names:
+            parser.error("there is no {}program named {}".format(
+                "stress " if args.stress else "", name))
+
+    results = {}
+    benchmarks = get_benchmarks(args)
+    with tempfile.TemporaryDirectory() as directory:
+        args.directory = directory
+        args.executables = {}
+        try:
+            args.rusage = build_rusage(directory)
+        except BenchError as error:
+            print("Error! " + str(error), file=sys.stderr)
+            return 1
+        # Results are kept in order of program and then mode, so that a
+        # stress program's sizes follow each other
+        for mode, flags in MODES:
+            if args.modes and mode not in args.modes:
+                continue
+            for name, path, stdin in benchmarks:
+                print("running {} ({})".format(name, mode), file=sys.stderr)
+                try:
+                    results[name + "/" + mode] = bench_program(
+                        args, name, path, stdin, flags)
+                except BenchError as error:
+                    print("Error! " + str(error), file=sys.stderr)
+                    return 1
+    order = {name: i for i, (name, _, _) in enumerate(benchmarks)}
+    results = dict(sorted(results.items(),
+                          key=lambda item: order[item[0].split("/")[0]]))
+
+    # Every mode runs the same program, so they should all give the same
+    # output
+    for name, *_ in benchmarks:
+        outputs = {result["output"] for key, result in results.items()
+                   if key.split("/")[0] == name}
+        if len(outputs) > 1:
+            print("Error! {} gives different output in different modes"
+                  .format(name), file=sys.stderr)
+            return 1
+
+    print_results(results)
+    if args.stress:
+        print_scaling(results)
+
+    status = 0
+    if args.compare:
+        if os.path.exists(args.compare):
+            with open(args.compare) as file:
+                baseline = json.load(file)["results"]
+            if compare(results, baseline):
+                status = 1
+        else:
+            print("\nNo baseline at {}, so nothing was compared".format(
+                args.compare))
+
+    if args.save:
+        with open(args.save, "w") as file:
+            json.dump({
+                "machine": platform.node(),
+                "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+                "runs": args.runs,
+                "results": results,
+            }, file, indent=2)
+            file.write("\n")
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
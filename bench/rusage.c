@@ -0,0 +1,65 @@
+/*
+ * Runs a command and writes its wall time in seconds and peak resident set
+ * size in kilobytes to a file, then exits with the command's status.
+ *
+ * usage: rusage OUTPUT_FILE COMMAND [ARGS...]
+ *
+ * The benchmarks can't measure this from Python: the peak size the system
+ * reports for a process includes the memory of the process it was forked
+ * from, up until it started the command, and the Python interpreter is much
+ * larger than the programs being measured. This is small enough not to matter.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+    FILE *output;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s OUTPUT_FILE COMMAND [ARGS...]\n", argv[0]);
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 2;
+    } else if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        perror(argv[2]);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    output = fopen(argv[1], "w");
+    if (output == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    fprintf(output, "%.9f %ld\n",
+            (double)(end.tv_sec - start.tv_sec)
+                + (end.tv_nsec - start.tv_nsec) / 1e9,
+            usage.ru_maxrss);
+    fclose(output);
+
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,78 @@
+#ifndef ANALYSIS_HPP
+#define ANALYSIS_HPP
+
+#include "builtins.hpp"
+#include "class.hpp"
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+// Maps names to the class of the instances they hold
+using NameClassMap = std::unordered_map<std::string, std::string>;
+
+// The number of values popped from the stack, and the number pushed to it
+using StackEffect = std::pair<int, int>;
+
+// Maps the names of methods to their effect on the stack
+using StackEffectMap = std::unordered_map<std::string, StackEffect>;
+
+// Returns the effect a call has on the stack, if it is known statically
+using CallEffectFunc = std::function<std::optional<StackEffect>(const Command &)>;
+
+// Called for each assignment found in a method with the name being assigned
+// to and the class of the instance being assigned, with either being
+// std::nullopt if it can't be determined statically
+using AssignmentCallback = std::function<void(const std::optional<std::string> &,
+                                              const std::optional<std::string> &)>;
+
+void for_each_assignment(const CommandList &commands,
+                         const std::string &class_name,
+                         const CallEffectFunc &call_effect,
+                         const AssignmentCallback &callback);
+
+// Infers which names can only ever hold instances of a single class, by
+// looking at every assignment made in the program
+class ClassInference {
+    private:
+        // The effects on the stack of the builtin methods of each class
+        std::unordered_map<std::string, StackEffectMap> builtin_effects;
+
+        // The methods which have the same effect on the stack no matter
+        // which instance they're called on
+        StackEffectMap call_effects;
+
+        // The classes held by global variables and by the fields of each
+        // class. A value of std::nullopt means the name can hold anything
+        std::unordered_map<std::string, std::optional<std::string>> globals;
+        std::unordered_map<std::string,
+            std::unordered_map<std::string, std::optional<std::string>>> fields;
+
+        // Classes with methods that assign to names that can't be determined
+        // statically, meaning nothing is known about their fields
+        std::unordered_set<std::string> dynamic_classes;
+
+        // Whether some method assigns to a name that can't be determined
+        // statically, meaning nothing is known about global variables
+        bool dynamic_globals = false;
+
+        CallEffectFunc get_call_effect(const NameClassMap &receivers) const;
+
+        void add_assignments(const ClassMap &classes,
+                             const ClassInference *previous);
+
+    public:
+        ClassInference(const ClassMap &classes);
+
+        NameClassMap get_scope(const std::string &class_name,
+                               const CommandList &method) const;
+};
+
+std::optional<std::pair<std::string, Builtin>>
+get_called_builtin(const Command &command, const ClassMap &classes,
+                   const NameClassMap &receivers);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef BUILD_HPP
+#define BUILD_HPP
+
+#include "class.hpp"
+
+#include <string>
+
+// Options controlling how a compiled program is turned into an executable
+struct BuildOptions {
+    // Whether to tune the generated code for the machine doing the build
+    bool native = false;
+
+    // Whether to use link-time optimization
+    bool lto = true;
+
+    // Whether to split the generated C into a file per class, which are
+    // compiled in parallel
+    bool split = false;
+
+    // If non-empty, the file used as input for a training run of the program
+    // when doing a profile-guided build
+    std::string train_input;
+};
+
+// The name of the main function of a compiled program built as a shared
+// object
+const std::string GLASS_MAIN = "glass_main";
+
+std::string get_c_compiler();
+bool build_executable(const ClassMap &classes, const std::string &out_file,
+                      const BuildOptions &options);
+bool build_shared_object(const std::string &c_file, const std::string &out_file);
+
+#endif
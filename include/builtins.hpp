@@ -6,6 +6,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 // An enumeration of all of the built-in functions
 enum class Builtin: int {
@@ -49,7 +50,11 @@ enum class Builtin: int {
 
 ClassMap get_builtins();
 void remove_builtins(ClassMap &classes);
-bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals);
+bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals,
+                    bool check_types = true);
+std::pair<int, int> builtin_stack_effect(Builtin type);
+std::vector<VarType> builtin_arg_types(Builtin type);
+std::vector<VarType> builtin_result_types(Builtin type);
 std::string builtin_text(Builtin type, const std::string &temp_name);
 
 #endif
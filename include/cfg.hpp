@@ -0,0 +1,43 @@
+#ifndef CFG_HPP
+#define CFG_HPP
+
+#include "command.hpp"
+#include "optimization.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// A sequence of commands that always run one after the other. Only the last
+// command of a block can be a LoopBegin, LoopEnd or Return command, and only
+// the first command of a block can be jumped to
+struct BasicBlock {
+    CommandList commands;
+
+    // The blocks that can run right after this one, by index
+    std::vector<std::size_t> successors;
+
+    // If the block ends with a LoopBegin or LoopEnd command, the index of the
+    // block ending with the matching LoopEnd or LoopBegin command
+    std::size_t loop_match = 0;
+};
+
+// The control-flow graph of a method. Passes can change the commands within
+// the blocks without keeping the jumps of the loops up to date, as they're
+// worked out again when the graph is turned back into a list of commands.
+// The blocks are kept in the order they're laid out in, so the body of every
+// loop stays in one piece between the blocks with its LoopBegin and LoopEnd
+class ControlFlowGraph {
+    private:
+        std::vector<BasicBlock> blocks;
+
+    public:
+        ControlFlowGraph(const CommandList &commands);
+
+        std::vector<BasicBlock> &get_blocks();
+        std::vector<bool> get_reachable() const;
+        CommandList linearize() const;
+};
+
+bool remove_unreachable_code(CommandList &commands, OptStats *stats);
+
+#endif
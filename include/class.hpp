@@ -3,31 +3,50 @@
 
 #include "command.hpp"
 
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 class Class;
 
-using FuncMap = std::unordered_map<std::string, CommandList>;
+// Method bodies are shared between a class and the classes that inherit them,
+// and are only copied when one of the classes changes its body
+using FuncMap = std::unordered_map<std::string, std::shared_ptr<CommandList>>;
 using ClassMap = std::unordered_map<std::string, Class>;
 
 class Class {
     friend bool check_inheritance(const ClassMap &);
+    friend void resolve_inheritance(ClassMap &);
     private:
         FuncMap functions;
         std::vector<std::string> parents;
         std::string name;
 
+        // The names of the inherited constructors to run, in order, before
+        // the class's own constructor
+        std::vector<std::string> parent_ctors;
+
     public:
         Class(const std::string &name);
 
         bool add_function(const std::string &name, const CommandList &commands);
+        bool add_function(const std::string &name,
+                          const std::shared_ptr<CommandList> &commands);
         bool add_parent(const std::string &class_name);
         bool has_function(const std::string &name) const;
+        bool has_constructor() const;
+        void remove_function(const std::string &name);
         CommandList &get_function(const std::string &name);
-        void handle_inheritance(ClassMap &classes);
+        const CommandList &get_function(const std::string &name) const;
+        CommandList get_chained_constructor() const;
         const FuncMap &get_functions() const;
         const std::vector<std::string> &get_parents() const;
+        const std::vector<std::string> &get_parent_ctors() const;
         const std::string &get_name() const;
 };
 
+bool check_inheritance(const ClassMap &classes);
+void resolve_inheritance(ClassMap &classes);
+
 #endif
@@ -1,6 +1,8 @@
 #ifndef COMMAND_HPP
 #define COMMAND_HPP
 
+#include <cstddef>
+#include <optional>
 #include <string>
 #include <variant>
 #include <vector>
@@ -29,9 +31,15 @@ enum class CommandType {
     BuiltinFunction,
 
     // Optimized commands that are made up of several different commands
-    AssignTo, // Equivalent to (name)(1)=,
-    FuncCall, // (objectName)(funcName).?
-    NewInst,  // (objectName)(className)!
+    AssignTo,    // Equivalent to (name)(1)=,
+    FuncCall,    // (objectName)(funcName).?
+    NewInst,     // (objectName)(className)!
+    LoadVar,     // (name)*
+    StoreNumber, // (name)<number>=
+    StoreString, // (name)"string"=
+    CopyVar,     // (name)(otherName)*=
+    StoreSelf,   // (name)$
+    LoadField,   // Pushes a field of another instance, made by inlining
 
     // Does nothing, generated while optimizing and removed quickly afterwards
     Nop,
@@ -48,7 +56,7 @@ class Command {
             // Used for DupElement and PushNumber
             double,
 
-            // Used for PushName, PushString, and AssignTo
+            // Used for PushName, PushString, AssignTo, LoadVar and StoreSelf
             std::string,
 
             // Used for BuiltinFunction
@@ -57,8 +65,11 @@ class Command {
             // Used for LoopBegin and LoopEnd
             std::pair<std::size_t, std::string>,
 
-            // Used for FuncCall and NewInst
-            std::pair<std::string, std::string>
+            // Used for FuncCall, NewInst, StoreString, CopyVar and LoadField
+            std::pair<std::string, std::string>,
+
+            // Used for StoreNumber
+            std::pair<std::string, double>
         > data;
 
         // The name of the file this command was found on
@@ -71,6 +82,14 @@ class Command {
         // multiple tokens
         int line2 = 0, col2 = 0;
 
+        // Whether the operands of the command were proven to have the types
+        // it needs, so they don't have to be checked when it's executed
+        bool unchecked = false;
+
+        // The builtin a FuncCall command calls, if its receiver is proven to
+        // always hold an instance of the builtin's class
+        std::optional<Builtin> resolved_builtin;
+
     public:
         Command(Builtin builtin_type);
 
@@ -90,7 +109,12 @@ class Command {
                 const std::string &fname, const std::string &file_name,
                 int line, int col, int line2 = 0, int col2 = 0);
 
+        Command(CommandType type, const std::string &name, double dval,
+                const std::string &file_name, int line, int col);
+
         void set_jump(std::size_t new_jump);
+        void set_unchecked(bool new_unchecked);
+        void set_resolved_builtin(std::optional<Builtin> builtin);
 
         CommandType get_type() const;
         Builtin get_builtin() const;
@@ -105,8 +129,16 @@ class Command {
         int get_col() const;
         int get_2nd_line() const;
         int get_2nd_col() const;
+        bool is_unchecked() const;
+        std::optional<Builtin> get_resolved_builtin() const;
 };
 
 using CommandList = std::vector<Command>;
 
+// The number of types of command, for tables indexed by them
+const std::size_t NUM_COMMAND_TYPES = static_cast<std::size_t>(CommandType::Nop)
+                                      + 1;
+
+std::string get_command_type_name(CommandType type);
+
 #endif
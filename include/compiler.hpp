@@ -3,6 +3,10 @@
 
 #include "class.hpp"
 
+#include <ostream>
+
+void output_program(std::ostream &file, const ClassMap &classes);
 bool compile_classes(const ClassMap &classes, const std::string &file_name);
+bool compile_classes_split(const ClassMap &classes, const std::string &dir_name);
 
 #endif
@@ -0,0 +1,9 @@
+#ifndef ESCAPE_HPP
+#define ESCAPE_HPP
+
+#include "class.hpp"
+#include "optimization.hpp"
+
+void remove_unused_instances(ClassMap &classes, OptStats *stats);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FOLDING_HPP
+#define FOLDING_HPP
+
+#include "class.hpp"
+#include "optimization.hpp"
+
+bool fold_constants(ClassMap &classes, OptStats *stats);
+
+#endif
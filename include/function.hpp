@@ -4,9 +4,11 @@
 #include "class.hpp"
 #include "command.hpp"
 
+#include <cstddef>
 #include <map>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class Class;
@@ -14,25 +16,75 @@ class Instance;
 class InstanceManager;
 class Variable;
 
+// The number of local variables whose places native code and traces keep
+// track of
+const std::size_t JIT_MAX_SLOTS = 16;
+
+// The state of a running function, which is shared by the interpreter and the
+// native code that the JIT compiles functions to
+struct Frame {
+    InstanceManager &manager;
+    ClassMap &classes;
+    std::vector<Variable> &stack;
+    std::unordered_map<std::string, Variable> &globals;
+    std::unordered_map<std::string, Variable> &locals;
+
+    // Where the interpreter carries on from when native code stops running
+    std::size_t resume = 0;
+
+    // Where native code or a trace found each of the local variables it uses,
+    // or nullptr if it hasn't looked for one yet. Local variables are never
+    // removed, so they stay in the same place once they've been found
+    Variable *slots[JIT_MAX_SLOTS] = {};
+
+    // For a function run by the register engine, the register each of its
+    // local variables is kept in, and the registers themselves. A local
+    // variable without a register is kept in locals as usual
+    const std::unordered_map<std::string, std::size_t> *local_registers = nullptr;
+    std::vector<std::optional<Variable>> *registers = nullptr;
+
+    Variable *get_slot(const std::string &name, std::size_t slot, bool create);
+};
+
+// What running a single command did
+enum class CommandResult {Next, Jump, Return, Error};
+
 class Function {
+    friend class Jit;
+    friend class RegisterVM;
+    friend class Tracer;
     private:
-        CommandList *commands;
+        const CommandList *commands;
         Instance *cur_obj;
         std::string method_name;
 
+        std::optional<Variable> get_val(const Frame &frame,
+                                        const std::string &name) const;
+        void set_val(Frame &frame, const std::string &name, Variable var);
+        CommandResult run_command(const Command &command, std::size_t &i,
+                                  Frame &frame);
+        bool run(InstanceManager &manager, ClassMap &classes,
+                 std::vector<Variable> &stack,
+                 std::unordered_map<std::string, Variable> &globals);
+        template <bool count_ops>
+        bool interpret(Frame &frame, std::size_t start);
         void runtime_error(const Command &command, const std::string &err) const;
         void output_stack_trace_line(const std::string &filename, int line,
                                      int col) const;
 
     public:
-        Function(CommandList &commands, const std::string &name, Instance *cur_obj);
+        Function(const CommandList &commands, const std::string &name, Instance *cur_obj);
         void move_instance(Instance *old_insts, Instance *new_insts);
         Instance *get_obj() const;
+        std::optional<Builtin> get_builtin() const;
         bool execute(InstanceManager &manager, ClassMap &classes,
                      std::vector<Variable> &stack,
                      std::unordered_map<std::string, Variable> &globals);
 };
 
 std::optional<Variable> pop_stack(std::vector<Variable> &stack);
+bool run_constructors(Instance *instance, InstanceManager &manager,
+                      ClassMap &classes, std::vector<Variable> &stack,
+                      std::unordered_map<std::string, Variable> &globals);
 
 #endif
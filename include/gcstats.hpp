@@ -0,0 +1,73 @@
+#ifndef GCSTATS_HPP
+#define GCSTATS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Class;
+
+// The environment variable naming the file each garbage collection is logged
+// to as it happens, or "-" for stderr
+const std::string GC_LOG_VARIABLE = "GLASS_GC_LOG";
+
+// What happened in a single garbage collection
+struct GcCollection {
+    // When the collection started, in seconds from the start of the program
+    double time = 0.0;
+
+    // The number of variables holding instances that marking started from, in
+    // running functions' local variables and registers, in global variables,
+    // and on the stack
+    std::size_t local_roots = 0;
+    std::size_t global_roots = 0;
+    std::size_t stack_roots = 0;
+
+    // The number of instances in use before the collection, the number still
+    // reachable and the number reclaimed
+    std::size_t in_use = 0;
+    std::size_t live = 0;
+    std::size_t reclaimed = 0;
+
+    // The number of instances there was room for before and after the
+    // collection, which differ when the heap grows
+    std::size_t heap_size = 0;
+    std::size_t new_heap_size = 0;
+
+    // How long marking, sweeping and the whole collection took, in seconds
+    double mark_time = 0.0;
+    double sweep_time = 0.0;
+    double pause_time = 0.0;
+};
+
+// Keeps track of the garbage collections of a run, and of the instances
+// allocated of each class, for tuning the size the heap starts at and how
+// full it has to be to grow
+class GcStats {
+    private:
+        std::chrono::steady_clock::time_point start_time;
+        std::vector<GcCollection> collections;
+        std::unordered_map<const Class *, std::size_t> allocations;
+        std::size_t total_allocations = 0;
+
+        // Where collections are logged as they happen, if anywhere
+        std::ofstream log_file;
+        std::ostream *log = nullptr;
+
+        double get_run_time() const;
+
+    public:
+        GcStats();
+        bool open_log(const std::string &file_name);
+        void record_allocation(const Class &type);
+        void record_collection(GcCollection collection);
+        void output_summary(std::ostream &out) const;
+        const std::unordered_map<const Class *, std::size_t> &
+            get_allocations() const;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef HEAP_SNAPSHOT_HPP
+#define HEAP_SNAPSHOT_HPP
+
+#include <csignal>
+#include <cstddef>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The first line of every heap snapshot file
+const std::string HEAP_SNAPSHOT_HEADER = "glass-heap-snapshot 1";
+
+// The number of classes, and of lines of the dominator tree, in a report on a
+// heap snapshot
+const std::size_t HEAP_REPORT_TOP = 20;
+const std::size_t HEAP_REPORT_TREE_LINES = 40;
+
+// An instance that was reachable when a snapshot was taken
+struct HeapObject {
+    // The index of the instance's class in the snapshot's classes
+    std::size_t type = 0;
+
+    // The number of fields the instance has, an estimate of the bytes it takes
+    // up on its own, and the indexes of the instances its fields refer to
+    std::size_t fields = 0;
+    std::size_t size = 0;
+    std::vector<std::size_t> references;
+};
+
+// The reachable instances of a running program, which can be written to a
+// compact file and read back to report on later. A snapshot file has a line
+// for each class, with the number of instances of it allocated so far, a line
+// for each instance, with its class, fields, size and references, and a line
+// of the instances that are referred to from outside any instance
+struct HeapSnapshot {
+    std::vector<std::string> class_names;
+    std::vector<std::size_t> allocations;
+    std::vector<HeapObject> objects;
+    std::vector<std::size_t> roots;
+
+    bool write(const std::string &file_name) const;
+    static std::optional<HeapSnapshot> read(const std::string &file_name);
+    void output_report(std::ostream &out) const;
+};
+
+// Decides when snapshots are taken during a run, which is when the process is
+// sent SIGUSR1, or after every so many garbage collections, and names the
+// files they're written to. The signal only notes that a snapshot is due, and
+// it's taken when the next instance is allocated, when the heap can be walked
+class HeapSnapshotter {
+    private:
+        std::string file_name;
+        std::size_t collection_interval;
+        std::size_t num_collections = 0;
+        std::size_t num_taken = 0;
+        volatile std::sig_atomic_t signalled = 0;
+
+    public:
+        HeapSnapshotter(const std::string &file_name,
+                        std::size_t collection_interval);
+        ~HeapSnapshotter();
+        HeapSnapshotter(const HeapSnapshotter &) = delete;
+        HeapSnapshotter &operator=(const HeapSnapshotter &) = delete;
+
+        static bool is_signal_supported();
+        void start();
+        void stop();
+
+        // Whether the process has asked for a snapshot. This is checked on
+        // every allocation, so it's kept inline
+        bool is_signalled() const {
+            return signalled;
+        }
+        bool count_collection();
+        void write(const HeapSnapshot &snapshot);
+        const std::string &get_file_name() const;
+};
+
+#endif
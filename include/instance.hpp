@@ -14,17 +14,19 @@ class Class;
 class Instance {
     friend class InstanceManager;
     private:
-        Class &type;
+        const Class &type;
         std::map<std::string, Variable> vars;
 
     public:
-        Instance(Class &type);
+        Instance(const Class &type);
 
         void set_var(const std::string &name, Variable &var);
 
         std::optional<Function> get_func(const std::string &name);
         const Variable &get_var(const std::string &name) const;
+        Variable *find_var(const std::string &name);
         const std::string &get_type_name() const;
+        const Class &get_class() const;
 };
 
 #endif
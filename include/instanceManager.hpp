@@ -1,19 +1,38 @@
 #ifndef INSTANCE_MANAGER_HPP
 #define INSTANCE_MANAGER_HPP
 
+#include "heapsnapshot.hpp"
 #include "variable.hpp"
 
+#include <optional>
 #include <string>
 #include <vector>
 
 class Class;
 class Function;
+class GcStats;
 class Instance;
+class Jit;
+class OpCounter;
+class Profiler;
+class RegisterVM;
+class Tracer;
 class Variable;
 
 // Number of instances to initially allocate
 const int NUM_STARTING_INSTANCES = 256;
 
+// The fraction of the instances that have to still be reachable after a
+// garbage collection for the number allocated to be doubled
+const double GC_GROWTH_THRESHOLD = 0.75;
+
+// Where a variable that garbage collection starts from is
+enum class RootType {
+    Local,
+    Global,
+    Stack
+};
+
 // A class for managing dynamically created instances and
 // handling garbage collection
 class InstanceManager {
@@ -21,6 +40,10 @@ class InstanceManager {
         // The local variables from each currently executing function
         std::vector<VarMap *> locals;
 
+        // The registers of each currently executing function run by the
+        // register engine, or nullptr for a function that isn't
+        std::vector<std::vector<std::optional<Variable>> *> registers;
+
         // The objects that are currently executing functions
         std::vector<Function *> executing_funcs;
 
@@ -42,15 +65,60 @@ class InstanceManager {
         // The index of the next instance to use when getting a new instance
         size_t next_instance;
 
+        // The JIT compiling functions to native code, if it's enabled
+        Jit *jit = nullptr;
+
+        // The tracer recording and running hot loops, if it's enabled
+        Tracer *tracer = nullptr;
+
+        // The register engine running functions in place of the interpreter,
+        // if it's enabled
+        RegisterVM *register_vm = nullptr;
+
+        // The profiler sampling the functions run with this manager, if
+        // profiling is enabled
+        Profiler *profiler = nullptr;
+
+        // The counter of the commands interpreted, if they're being counted
+        OpCounter *op_counter = nullptr;
+
+        // The statistics on garbage collection, if they're being kept
+        GcStats *gc_stats = nullptr;
+
+        // What decides when snapshots of the heap are taken, if any are
+        HeapSnapshotter *heap_snapshotter = nullptr;
+
+        template <typename Visit>
+        void visit_roots(Visit visit);
+        std::size_t get_index(const Variable &var) const;
+
     public:
         InstanceManager(std::vector<Variable> &stack,
                         VarMap &globals);
         ~InstanceManager();
         void new_scope(Function *executing_func,
-                       VarMap *new_locals);
+                       VarMap *new_locals,
+                       std::vector<std::optional<Variable>> *new_registers
+                           = nullptr);
         void unwind_scope();
-        Instance *new_instance(Class &type);
+        void clear_scopes();
+        Instance *new_instance(const Class &type);
         void collect_garbage();
+        void set_jit(Jit *new_jit);
+        Jit *get_jit() const;
+        void set_tracer(Tracer *new_tracer);
+        Tracer *get_tracer() const;
+        void set_register_vm(RegisterVM *new_register_vm);
+        RegisterVM *get_register_vm() const;
+        void set_profiler(Profiler *new_profiler);
+        Profiler *get_profiler() const;
+        void set_op_counter(OpCounter *new_op_counter);
+        OpCounter *get_op_counter() const;
+        void set_gc_stats(GcStats *new_gc_stats);
+        GcStats *get_gc_stats() const;
+        void set_heap_snapshotter(HeapSnapshotter *new_snapshotter);
+        HeapSnapshotter *get_heap_snapshotter() const;
+        HeapSnapshot take_heap_snapshot();
 };
 
 #endif
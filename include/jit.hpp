@@ -0,0 +1,91 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "command.hpp"
+#include "function.hpp"
+
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The number of times a function has to be called before it's compiled to
+// native code
+const std::size_t JIT_THRESHOLD = 64;
+
+// The number of times a function's native code can hand the function back to
+// the interpreter before the native code stops being used
+const std::size_t JIT_MAX_DEOPTS = 16;
+
+// How a function's native code, or a routine it calls, stopped running
+enum class JitStatus {Continue, Interpret, Error, Jump, Return};
+
+// Compiles functions that are called often to x86-64 machine code. Each
+// command becomes a call of a routine that runs it, and loops become native
+// jumps. The routines for the simplest commands work on the function's frame
+// directly, and when they find something they don't handle, such as an
+// undefined variable, they hand the function back to the interpreter, which
+// carries on from that command. Every other command is run by the
+// interpreter's own code for it
+class Jit {
+    private:
+        using Entry = int (*)(Function *, Frame *);
+
+        // What is known about a function, by its commands
+        struct FunctionInfo {
+            std::size_t calls = 0;
+            std::size_t deopts = 0;
+            Entry entry = nullptr;
+
+            // Whether the function can't be compiled, or its native code
+            // handed it back to the interpreter too often
+            bool failed = false;
+        };
+        std::unordered_map<const CommandList *, FunctionInfo> functions;
+
+        // The blocks of executable memory holding the native code
+        std::vector<std::pair<void *, std::size_t>> code_blocks;
+
+        Entry compile(const CommandList &commands);
+
+        // The routines that native code calls to run commands. Each one is
+        // given the command and its position, along with the slot in the
+        // frame for the local variable it uses, if it uses one. They return a
+        // JitStatus
+        static int run_command(Function *func, Frame *frame,
+                               const Command *command, std::size_t i,
+                               std::size_t slot);
+        static int push_name(Function *func, Frame *frame,
+                             const Command *command, std::size_t i,
+                             std::size_t slot);
+        static int push_number(Function *func, Frame *frame,
+                               const Command *command, std::size_t i,
+                               std::size_t slot);
+        static int push_string(Function *func, Frame *frame,
+                               const Command *command, std::size_t i,
+                               std::size_t slot);
+        static int assign_local(Function *func, Frame *frame,
+                                const Command *command, std::size_t i,
+                                std::size_t slot);
+        static int store_local_number(Function *func, Frame *frame,
+                                      const Command *command, std::size_t i,
+                                      std::size_t slot);
+        static int load_local(Function *func, Frame *frame,
+                              const Command *command, std::size_t i,
+                              std::size_t slot);
+        static int test_loop(Function *func, Frame *frame,
+                             const Command *command, std::size_t i,
+                             std::size_t slot);
+
+    public:
+        Jit() = default;
+        Jit(const Jit &) = delete;
+        Jit &operator=(const Jit &) = delete;
+        ~Jit();
+
+        static bool is_supported();
+        JitStatus run(const CommandList &commands, Function *func,
+                      Frame &frame);
+};
+
+#endif
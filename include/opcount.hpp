@@ -0,0 +1,37 @@
+#ifndef OPCOUNT_HPP
+#define OPCOUNT_HPP
+
+#include "command.hpp"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The number of entries in each part of the report on the commands counted
+const std::size_t OP_COUNT_TOP = 20;
+
+// Counts every command the interpreter runs, by its type and by the command
+// itself, which gives its position in the source. The types of each pair and
+// triple of commands run one after another in the same method are counted
+// too, as the commonest ones are the ones worth combining into a single
+// optimized command. A sequence is broken by a loop command that jumps, as
+// commands on either side of a jump can't be combined
+class OpCounter {
+    private:
+        std::vector<std::size_t> types;
+        std::vector<std::size_t> pairs;
+        std::vector<std::size_t> triples;
+        std::unordered_map<const Command *, std::size_t> commands;
+        std::size_t total = 0;
+
+    public:
+        OpCounter();
+        void record(const Command &command, CommandType before_previous,
+                    CommandType previous);
+        void output_report(std::ostream &out) const;
+        bool write_json(const std::string &file_name) const;
+};
+
+#endif
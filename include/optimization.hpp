@@ -3,6 +3,54 @@
 
 #include "class.hpp"
 
-void optimize_classes(ClassMap &classes);
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The number of times each optimization was applied, by name
+using OptStats = std::map<std::string, std::size_t>;
+
+// The names of the optimization passes, in the order they're first run
+const std::vector<std::string> OPT_PASSES = {
+    "unreachable", "peephole", "dead-stores", "dead-code", "inline", "fold",
+    "types", "escape"
+};
+
+// The highest optimization level, which is also the default
+const int MAX_OPT_LEVEL = 3;
+
+// Options controlling which optimization passes are run
+struct OptOptions {
+    // The names of the passes to run
+    std::set<std::string> passes{OPT_PASSES.begin(), OPT_PASSES.end()};
+};
+
+// What one of the optimization passes did over the whole optimization
+struct PassReport {
+    // The number of times the pass was run
+    std::size_t runs = 0;
+
+    // The total wall time spent in the pass, in seconds
+    double seconds = 0.0;
+
+    // The number of times the pass applied one of its optimizations
+    std::size_t changes = 0;
+
+    // The number of commands the pass removed from the program, which is
+    // negative if it added commands
+    long long removed = 0;
+};
+
+// The report for each pass that was enabled, in the order they're first run
+using PassReports = std::vector<std::pair<std::string, PassReport>>;
+
+std::optional<OptOptions> get_opt_level(int level);
+void remove_nops(CommandList &commands);
+void optimize_classes(ClassMap &classes, const OptOptions &options = {},
+                      OptStats *stats = nullptr, PassReports *reports = nullptr);
 
 #endif
@@ -0,0 +1,9 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <cstddef>
+#include <functional>
+
+void parallel_for(std::size_t count, const std::function<void(std::size_t)> &func);
+
+#endif
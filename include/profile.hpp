@@ -0,0 +1,80 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include "class.hpp"
+#include "command.hpp"
+
+#include <csignal>
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Function;
+
+// How often the profiler asks to sample, in microseconds of CPU time. The
+// system may sample less often than this, so the time reported for each
+// method is its share of the CPU time measured while profiling
+const long PROFILE_INTERVAL_US = 1000;
+
+// The number of methods listed in the profiler's report
+const std::size_t PROFILE_TOP_METHODS = 20;
+
+// Samples the Glass call stack of the running program on a CPU timer. The
+// timer's signal only notes that a sample is due, and the interpreter takes it
+// at the next command it runs, so the stack is never looked at while it's
+// being changed. Each frame of a sample is a method, along with the command it
+// was running, which for every frame but the innermost is a call
+class Profiler {
+    private:
+        // A method being run, by the index of its name, and the command it's
+        // running, or nullptr if it hasn't started on one yet
+        using ProfileFrame = std::pair<std::size_t, const Command *>;
+        std::vector<ProfileFrame> frames;
+
+        // The names of the methods seen, as Class.method, and the index of
+        // each one by its commands and the class of its instance. The same
+        // commands can be inherited by several classes
+        std::vector<std::string> method_names;
+        std::map<std::pair<const CommandList *, const Class *>, std::size_t>
+            method_indexes;
+
+        // The number of times each stack was sampled
+        std::map<std::vector<ProfileFrame>, std::size_t> samples;
+        std::size_t num_samples = 0;
+
+        // The CPU time when profiling started and stopped
+        std::clock_t start_time = 0;
+        std::clock_t stop_time = 0;
+
+        // Set by the timer's signal when a sample is due
+        volatile std::sig_atomic_t sample_due = 0;
+
+        void take_sample();
+        std::string get_frame_name(const ProfileFrame &frame) const;
+
+    public:
+        Profiler() = default;
+        Profiler(const Profiler &) = delete;
+        Profiler &operator=(const Profiler &) = delete;
+        ~Profiler();
+
+        static bool is_supported();
+        void start();
+        void stop();
+
+        // Called when a function starts and finishes running, and before each
+        // command it runs
+        void enter_function(const CommandList &commands, const Class &type,
+                            const std::string &method_name);
+        void leave_function();
+        void at(const Command &command);
+
+        bool write_folded(const std::string &file_name) const;
+        void output_report(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef REACHABILITY_HPP
+#define REACHABILITY_HPP
+
+#include "class.hpp"
+#include "optimization.hpp"
+
+void remove_unreachable(ClassMap &classes, OptStats *stats);
+
+#endif
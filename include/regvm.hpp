@@ -0,0 +1,133 @@
+#ifndef REGVM_HPP
+#define REGVM_HPP
+
+#include "builtins.hpp"
+#include "command.hpp"
+#include "function.hpp"
+#include "variable.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The kinds of instruction the register engine runs. Registers are numbered
+// from zero for each method, and hold both its local variables and the values
+// its commands would leave on the stack
+enum class RegOpType {
+    // dst = the constant src1
+    Const,
+
+    // dst = the variable in a place, which is an error if it isn't defined
+    Load,
+
+    // The variable in a place = src1
+    Store,
+
+    // The variable in a place = the constant src1
+    StoreConst,
+
+    // dst = the instance running the method
+    LoadSelf,
+
+    // dst = the field field_name of the instance in a place
+    LoadObjectField,
+
+    // Pushes register src1, or the constant src1, onto the stack
+    Push,
+    PushConst,
+
+    // dst = the math builtin run on src1 and src2, where src2 is the argument
+    // that would be on top of the stack
+    Math,
+
+    // Runs a builtin on the registers args, putting what it returns into the
+    // registers results
+    Builtin,
+
+    // Runs a command with the interpreter's code for it, on the stack, which
+    // is also how the method returns
+    Run,
+
+    // Jumps to target if the loop variable in a place is false, or for a
+    // LoopEnd, if it's true
+    LoopBegin,
+    LoopEnd
+};
+
+// Where a named variable is kept: a local variable in a register, a field of
+// the running instance in one of the method's field slots, or a global
+enum class RegPlace {Local, Field, Global};
+
+// A single instruction for the register engine
+struct RegOp {
+    RegOpType type = RegOpType::Run;
+
+    // The command the instruction came from, for its errors
+    const Command *command = nullptr;
+
+    std::size_t dst = 0;
+    std::size_t src1 = 0;
+    std::size_t src2 = 0;
+
+    // For an instruction using a named variable, where it's kept, its
+    // register or field slot, and its name
+    RegPlace place = RegPlace::Global;
+    std::size_t index = 0;
+    const std::string *name = nullptr;
+
+    // For a LoadObjectField, the field loaded
+    const std::string *field_name = nullptr;
+
+    // For a jump, the instruction jumped to
+    std::size_t target = 0;
+
+    // For a builtin, which one, whether its arguments have to be checked, and
+    // the registers it uses
+    Builtin builtin = Builtin::MathAdd;
+    bool check_types = true;
+    std::vector<std::size_t> args;
+    std::vector<std::size_t> results;
+};
+
+// A method lowered to instructions for the register engine
+struct RegMethod {
+    std::vector<RegOp> ops;
+    std::vector<Variable> constants;
+    std::size_t num_registers = 0;
+
+    // The register of each local variable the method's commands name
+    std::unordered_map<std::string, std::size_t> locals;
+
+    // The name of the field in each field slot
+    std::vector<std::string> fields;
+};
+
+// An execution engine that runs methods as register code instead of
+// interpreting their commands. Each method is lowered the first time it's
+// called: its local variables get registers of their own, its fields get slots
+// that find them in the running instance once per call, and a value pushed by
+// one of its commands is kept in a register until a command that needs the
+// real stack, such as a call or a loop, comes along. Commands that can't be
+// lowered are run by the interpreter's own code for them, which finds local
+// variables in their registers
+class RegisterVM {
+    private:
+        std::unordered_map<const CommandList *, std::unique_ptr<RegMethod>>
+            methods;
+
+        // The stack that builtins run on registers use
+        std::vector<Variable> scratch;
+
+        bool run_builtin(const RegOp &op, Function *func, Frame &frame,
+                         std::vector<std::optional<Variable>> &registers);
+
+    public:
+        bool run(const CommandList &commands, Function *func, Frame &frame);
+};
+
+std::unique_ptr<RegMethod> lower_method(const CommandList &commands);
+
+#endif
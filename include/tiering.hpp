@@ -0,0 +1,37 @@
+#ifndef TIERING_HPP
+#define TIERING_HPP
+
+#include "class.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+
+// Runs programs as native code once they've been built. The first time a
+// program is run, it's interpreted while a background thread compiles it to C
+// and builds a shared object from it, which is kept in a cache. Every later
+// run of the same program loads the shared object and runs it instead. A
+// compiled program keeps its objects in a different form from the interpreter,
+// so a program is always run entirely by one or the other
+class TieredCompiler {
+    private:
+        std::string c_source;
+
+        // Where the program's shared object is kept in the cache
+        std::filesystem::path object_path;
+
+        std::thread build_thread;
+
+    public:
+        TieredCompiler(const ClassMap &classes);
+        TieredCompiler(const TieredCompiler &) = delete;
+        TieredCompiler &operator=(const TieredCompiler &) = delete;
+        ~TieredCompiler();
+
+        static bool is_supported();
+        std::optional<int> run_native();
+        void start_build();
+};
+
+#endif
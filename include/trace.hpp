@@ -0,0 +1,189 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "builtins.hpp"
+#include "class.hpp"
+#include "command.hpp"
+#include "function.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The number of times a loop has to go around before it's traced
+const std::size_t TRACE_THRESHOLD = 32;
+
+// The most operations a trace can have before its recording is given up on
+const std::size_t TRACE_MAX_LENGTH = 2048;
+
+// The deepest a trace can follow calls into methods
+const std::size_t TRACE_MAX_DEPTH = 8;
+
+// The number of recordings of a loop that can be given up on before the loop
+// stops being traced
+const std::size_t TRACE_MAX_ABORTS = 4;
+
+// The number of times a trace can leave from the same operation before a side
+// trace is recorded from there
+const std::size_t TRACE_SIDE_THRESHOLD = 8;
+
+// The most side traces a loop can have
+const std::size_t TRACE_MAX_SIDE_TRACES = 64;
+
+// The number of times a loop's traces can hand it back to the interpreter
+// before finishing a single pass through it before they stop being used
+const std::size_t TRACE_MAX_EARLY_EXITS = 64;
+
+// The kinds of operation a trace is made of
+enum class TraceOpType {
+    // Runs a command with the interpreter's code for it
+    Run,
+
+    // Checks that a loop command goes the same way it did when recorded
+    Guard,
+
+    // Calls a method, checking that its receiver is of the recorded class,
+    // after which the trace carries on with the method's commands
+    Enter,
+
+    // Returns from a method that was entered
+    Leave,
+
+    // Runs a builtin, checking that the arguments on the stack have the right
+    // types, and for a builtin method that isn't resolved, that its receiver
+    // is of the recorded class
+    Builtin,
+
+    PushName,
+    PushNumber,
+    PushString,
+    LoadLocal,
+    StoreLocal,
+    StoreLocalNumber
+};
+
+struct Trace;
+
+// A single operation of a trace
+struct TraceOp {
+    TraceOpType type = TraceOpType::Run;
+
+    // The command the operation came from, and its position in its method
+    const Command *command = nullptr;
+    std::size_t index = 0;
+
+    // The local variable the operation uses, if it uses one, and its slot,
+    // or JIT_MAX_SLOTS if it doesn't have one
+    const std::string *name = nullptr;
+    std::size_t slot = JIT_MAX_SLOTS;
+
+    // The number pushed or stored, which can be worked out when the trace is
+    // optimized
+    double number = 0.0;
+
+    // For a Guard, whether the loop command jumps
+    bool jumps = false;
+
+    // For a Builtin, the builtin run, and the types its arguments have to be
+    // checked to have, which is empty if they're proven to have them
+    Builtin builtin = Builtin::MathAdd;
+    std::vector<VarType> arg_types;
+
+    // For an Enter or Builtin that has to check its receiver, the name of the
+    // receiver, the slot it's in if it's a local variable, and its class
+    const std::string *receiver = nullptr;
+    std::size_t receiver_slot = JIT_MAX_SLOTS;
+    const Class *receiver_class = nullptr;
+
+    // For an Enter, the commands of the method
+    const CommandList *callee = nullptr;
+
+    // The number of times the trace has left from the operation, the number
+    // of times recording a side trace from it was given up on, and the side
+    // trace that's run instead of leaving, if there is one
+    std::size_t exits = 0;
+    std::size_t aborts = 0;
+    Trace *side = nullptr;
+};
+
+// A recorded pass through a loop. A side trace starts from where another
+// trace leaves, in the same methods that trace was in
+struct Trace {
+    std::vector<TraceOp> ops;
+
+    // How deep in calls the trace starts
+    std::size_t start_depth = 0;
+};
+
+// Records the commands run by one pass through loops that go around often,
+// following the calls they make into methods, and then runs that recording in
+// place of the loop. Each loop command along the way becomes a guard that
+// checks that it goes the same way as it did when recorded, and each method
+// call a guard on the class of its receiver. Whenever a guard fails, the trace
+// leaves, and the interpreter carries on from there with every method that
+// was entered. If a trace often leaves from the same place, the commands run
+// from there are recorded as a side trace, which is run instead of leaving
+class Tracer {
+    private:
+        // What's known about a loop, by its LoopEnd command
+        struct LoopInfo {
+            std::size_t count = 0;
+            std::size_t aborts = 0;
+            std::unique_ptr<Trace> trace;
+            std::vector<std::unique_ptr<Trace>> side_traces;
+
+            // The number of times the traces handed the loop back to the
+            // interpreter before finishing a pass through it, and whether
+            // they've stopped being used because of that
+            std::size_t early_exits = 0;
+            bool disabled = false;
+        };
+        std::unordered_map<const Command *, LoopInfo> loops;
+
+        // A trace that's being recorded
+        struct Recording {
+            const Command *loop_end;
+            std::vector<TraceOp> ops;
+
+            // For a side trace, the operation it's run from instead of
+            // leaving, and how deep in calls it starts
+            TraceOp *exit = nullptr;
+            std::size_t start_depth = 0;
+
+            // How deep in calls the interpreter is, and the depth of the
+            // method being recorded, both from the function with the loop
+            std::size_t depth = 0;
+            std::size_t traced_depth = 0;
+
+            // Whether an Enter was just recorded, so that the next function
+            // to be interpreted is the one it enters
+            bool entering = false;
+
+            // The slots given to the local variables of each method being
+            // recorded
+            std::vector<std::unordered_map<std::string, std::size_t>> slots;
+        };
+        std::optional<Recording> recording;
+
+        std::size_t get_slot(const std::string &name);
+        void set_local(TraceOp &op, TraceOpType type, const std::string &name);
+        void abort_recording();
+        void finish_recording();
+        bool run_trace(LoopInfo &loop, const Command &loop_end, Function *func,
+                       Frame &frame, std::size_t &i);
+
+    public:
+        bool is_recording() const;
+        void enter_function();
+        void leave_function(bool error);
+        void record(Function *func, std::size_t i, Frame &frame);
+        bool loop_back(Function *func, const Command &command, std::size_t &i,
+                       Frame &frame);
+};
+
+void optimize_trace(std::vector<TraceOp> &ops, std::size_t start_depth);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TYPES_HPP
+#define TYPES_HPP
+
+#include "analysis.hpp"
+#include "class.hpp"
+#include "optimization.hpp"
+#include "variable.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// The type of a value, or std::nullopt if it can't be determined statically
+using ValueType = std::optional<VarType>;
+
+// Maps names to the types of the values they hold
+using NameTypeMap = std::unordered_map<std::string, ValueType>;
+
+// Infers the types of the values used throughout the program, following the
+// values on the stack and in local variables through each method, and the
+// values held by fields and global variables across the whole program
+class TypeInference {
+    private:
+        const ClassMap *classes;
+        const ClassInference *class_inference;
+
+        // The types held by global variables and by the fields of each class
+        NameTypeMap globals;
+        std::unordered_map<std::string, NameTypeMap> fields;
+
+        // Classes with methods that assign to names that can't be determined
+        // statically, meaning nothing is known about their fields
+        std::unordered_set<std::string> dynamic_classes;
+
+        // Whether some method assigns to a name that can't be determined
+        // statically, meaning nothing is known about global variables
+        bool dynamic_globals = false;
+
+        // The fields of each class that its constructor assigns to before
+        // anything else can run
+        std::unordered_map<std::string, std::unordered_set<std::string>>
+            constructed_fields;
+
+        ValueType get_type(const std::string &class_name,
+                           const std::string &name) const;
+
+        void add_assignments(const TypeInference &hypothesis);
+
+    public:
+        TypeInference(const ClassMap &classes,
+                      const ClassInference &class_inference);
+
+        void annotate(CommandList &commands, const std::string &class_name,
+                      const std::string &method_name, OptStats *stats) const;
+};
+
+void annotate_types(ClassMap &classes, OptStats *stats);
+
+#endif
@@ -0,0 +1,14 @@
+Reads one character and takes 32 from its code to get n then runs a loop
+n times inside a loop n times inside a loop n times and prints ok
+,--------------------------------
+[->+>>>+<<<<]>>>>[-<<<<+>>>>]<<<<
+>[
+<[->>+>>+<<<<]>>>>[-<<<<+>>>>]<<
+[
+<<[->>>+>+<<<<]>>>>[-<<<<+>>>>]<
+[->>++<<]
+<-]
+<-]
+>>>>[-]
+++++++++++[>+++++++++++<-]>+.----.
+[-]++++++++++.
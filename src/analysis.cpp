@@ -0,0 +1,356 @@
+#include "analysis.hpp"
+#include "builtins.hpp"
+
+#include <cctype>
+#include <vector>
+
+// Goes through the commands of a method, simulating the stack within each
+// basic block so that the names used by assignments can be determined. Calls
+// the given callback for every assignment that is found
+void for_each_assignment(const CommandList &commands,
+                         const std::string &class_name,
+                         const CallEffectFunc &call_effect,
+                         const AssignmentCallback &callback)
+{
+    // The values on the stack, which are either a name pushed in the current
+    // basic block, or std::nullopt if nothing is known about the value. Any
+    // values below these are unknown
+    std::vector<std::optional<std::string>> stack;
+
+    auto pop = [&] () -> std::optional<std::string> {
+        if (stack.empty()) {
+            return std::nullopt;
+        }
+        auto val = stack.back();
+        stack.pop_back();
+        return val;
+    };
+
+    for (const auto &command: commands) {
+        switch (command.get_type()) {
+            case CommandType::AssignClass: {
+                auto cname = pop();
+                auto name = pop();
+                callback(name, cname);
+                // The constructor could do anything to the stack
+                stack.clear();
+                break;
+            }
+
+            case CommandType::AssignSelf:
+                callback(pop(), class_name);
+                break;
+
+            case CommandType::AssignValue: {
+                pop();
+                auto name = pop();
+                callback(name, std::nullopt);
+                break;
+            }
+
+            case CommandType::DupElement: {
+                auto index = static_cast<std::size_t>(command.get_number());
+                if (index < stack.size()) {
+                    stack.push_back(stack[stack.size() - index - 1]);
+                } else {
+                    stack.emplace_back();
+                }
+                break;
+            }
+
+            case CommandType::GetFunction:
+                pop();
+                pop();
+                stack.emplace_back();
+                break;
+
+            case CommandType::GetValue:
+                pop();
+                stack.emplace_back();
+                break;
+
+            case CommandType::PopStack:
+                pop();
+                break;
+
+            case CommandType::PushName:
+                stack.push_back(command.get_string());
+                break;
+
+            case CommandType::PushNumber:
+            case CommandType::PushString:
+                stack.emplace_back();
+                break;
+
+            case CommandType::BuiltinFunction: {
+                auto [pops, pushes] = builtin_stack_effect(command.get_builtin());
+                for (int i = 0; i < pops; i++) {
+                    pop();
+                }
+                for (int i = 0; i < pushes; i++) {
+                    stack.emplace_back();
+                }
+                break;
+            }
+
+            // A call of a method that always has the same effect on the stack
+            // doesn't need to invalidate what is known about the stack
+            case CommandType::FuncCall: {
+                auto effect = call_effect(command);
+                if (not effect) {
+                    stack.clear();
+                    break;
+                }
+                for (int i = 0; i < effect->first; i++) {
+                    pop();
+                }
+                for (int i = 0; i < effect->second; i++) {
+                    stack.emplace_back();
+                }
+                break;
+            }
+
+            case CommandType::AssignTo:
+                pop();
+                callback(command.get_string(), std::nullopt);
+                break;
+
+            case CommandType::NewInst:
+                callback(command.get_first_name(), command.get_second_name());
+                stack.clear();
+                break;
+
+            case CommandType::LoadVar:
+            case CommandType::LoadField:
+                stack.emplace_back();
+                break;
+
+            case CommandType::StoreNumber:
+            case CommandType::StoreString:
+            case CommandType::CopyVar:
+                callback(command.get_first_name(), std::nullopt);
+                break;
+
+            case CommandType::StoreSelf:
+                callback(command.get_string(), class_name);
+                break;
+
+            // Calls can do anything to the stack, and the stack at the start
+            // of a loop depends on the path taken there
+            case CommandType::ExecuteFunc:
+            case CommandType::LoopBegin:
+            case CommandType::LoopEnd:
+            case CommandType::Return:
+                stack.clear();
+                break;
+
+            case CommandType::Nop:
+                break;
+        }
+    }
+}
+
+// The number of times the inferred classes are refined before giving up
+constexpr int MAX_INFERENCE_PASSES = 16;
+
+// Records that a name is assigned an instance of the given class, or some
+// unknown value if the class is std::nullopt
+void add_assignment(std::unordered_map<std::string, std::optional<std::string>> &names,
+                    const std::string &name,
+                    const std::optional<std::string> &class_name)
+{
+    auto found = names.find(name);
+    if (found == names.end()) {
+        names.emplace(name, class_name);
+    } else if (found->second != class_name) {
+        found->second = std::nullopt;
+    }
+}
+
+// Returns a function giving the effect of a call on the stack, which is known
+// when the receiver's class is known and the method is a builtin, or when
+// every class defining the method implements it with builtins with the same
+// effect on the stack
+CallEffectFunc ClassInference::get_call_effect(const NameClassMap &receivers) const {
+    return [&] (const Command &command) -> std::optional<StackEffect> {
+        auto receiver = receivers.find(command.get_first_name());
+        if (receiver != receivers.end()) {
+            auto class_effects = builtin_effects.find(receiver->second);
+            if (class_effects == builtin_effects.end()) {
+                return std::nullopt;
+            }
+            auto effect = class_effects->second.find(command.get_second_name());
+            if (effect == class_effects->second.end()) {
+                return std::nullopt;
+            }
+            return effect->second;
+        }
+        auto effect = call_effects.find(command.get_second_name());
+        if (effect == call_effects.end()) {
+            return std::nullopt;
+        }
+        return effect->second;
+    };
+}
+
+// Goes through every method, recording the classes assigned to fields and
+// global variables. If a hypothesis is given, the classes it gives to names
+// are used to find the effects of calls on the stack
+void ClassInference::add_assignments(const ClassMap &classes,
+                                     const ClassInference *hypothesis)
+{
+    globals.clear();
+    fields.clear();
+    dynamic_classes.clear();
+    dynamic_globals = false;
+
+    for (const auto &[class_name, class_info]: classes) {
+        auto &class_fields = fields[class_name];
+        for (const auto &[func_name, body]: class_info.get_functions()) {
+            const auto &commands = *body;
+            NameClassMap receivers;
+            if (hypothesis) {
+                receivers = hypothesis->get_scope(class_name, commands);
+            }
+            for_each_assignment(commands, class_name, get_call_effect(receivers),
+                [&] (const auto &name, const auto &assigned_class) {
+                    if (not name) {
+                        dynamic_classes.insert(class_name);
+                        dynamic_globals = true;
+                    } else if (std::islower((*name)[0])) {
+                        add_assignment(class_fields, *name, assigned_class);
+                    } else if ((*name)[0] != '_') {
+                        add_assignment(globals, *name, assigned_class);
+                    }
+                });
+        }
+    }
+}
+
+ClassInference::ClassInference(const ClassMap &classes) {
+    std::unordered_set<std::string> unknown_effects;
+    for (const auto &[class_name, class_info]: classes) {
+        for (const auto &[func_name, body]: class_info.get_functions()) {
+            const auto &commands = *body;
+            if (commands.size() != 1 or
+                commands[0].get_type() != CommandType::BuiltinFunction)
+            {
+                unknown_effects.insert(func_name);
+                continue;
+            }
+            auto effect = builtin_stack_effect(commands[0].get_builtin());
+            builtin_effects[class_name].emplace(func_name, effect);
+            auto found = call_effects.find(func_name);
+            if (found == call_effects.end()) {
+                call_effects.emplace(func_name, effect);
+            } else if (found->second != effect) {
+                unknown_effects.insert(func_name);
+            }
+        }
+    }
+    for (const auto &func_name: unknown_effects) {
+        call_effects.erase(func_name);
+    }
+
+    // Knowing the classes of names tells us the effects of more calls, which
+    // can tell us more about the names being assigned to. So, we start from
+    // the hypothesis that assignments to unknown names don't happen, and
+    // refine it until it agrees with what is found using it, at which point
+    // no assignment can break it
+    add_assignments(classes, nullptr);
+    dynamic_classes.clear();
+    dynamic_globals = false;
+
+    for (int i = 0; i < MAX_INFERENCE_PASSES; i++) {
+        auto refined = *this;
+        refined.add_assignments(classes, this);
+        if (refined.globals == globals and refined.fields == fields and
+            refined.dynamic_classes == dynamic_classes and
+            refined.dynamic_globals == dynamic_globals)
+        {
+            return;
+        }
+        *this = std::move(refined);
+    }
+
+    // If the hypothesis didn't settle, assume nothing
+    globals.clear();
+    fields.clear();
+    dynamic_globals = true;
+    for (const auto &class_info: classes) {
+        dynamic_classes.insert(class_info.first);
+    }
+}
+
+// Returns the names that are known to only hold instances of a single class
+// when used in the given method of the given class
+NameClassMap ClassInference::get_scope(const std::string &class_name,
+                                       const CommandList &method) const
+{
+    NameClassMap scope;
+    auto add_scope = [&] (NameClassMap &to_scope, const auto &names) {
+        for (const auto &[name, assigned_class]: names) {
+            if (assigned_class) {
+                to_scope.emplace(name, *assigned_class);
+            }
+        }
+    };
+
+    if (not dynamic_globals) {
+        add_scope(scope, globals);
+    }
+    if (not dynamic_classes.count(class_name) and fields.count(class_name)) {
+        add_scope(scope, fields.at(class_name));
+    }
+
+    // The local variables are refined the same way as the other names are in
+    // the constructor, starting from ignoring assignments to unknown names
+    NameClassMap locals;
+    bool first_pass = true;
+    for (int i = 0; i < MAX_INFERENCE_PASSES; i++) {
+        std::unordered_map<std::string, std::optional<std::string>> assigned;
+        bool dynamic_locals = false;
+        auto receivers = scope;
+        receivers.insert(locals.begin(), locals.end());
+        for_each_assignment(method, class_name, get_call_effect(receivers),
+            [&] (const auto &name, const auto &assigned_class) {
+                if (not name) {
+                    dynamic_locals = true;
+                } else if ((*name)[0] == '_') {
+                    add_assignment(assigned, *name, assigned_class);
+                }
+            });
+
+        NameClassMap refined;
+        if (first_pass or not dynamic_locals) {
+            add_scope(refined, assigned);
+        }
+        if (not first_pass and refined == locals) {
+            scope.insert(locals.begin(), locals.end());
+            return scope;
+        }
+        locals = std::move(refined);
+        first_pass = false;
+    }
+    return scope;
+}
+
+// If a FuncCall command calls a method that is known to be a builtin, returns
+// the class of the receiver and the builtin
+std::optional<std::pair<std::string, Builtin>>
+get_called_builtin(const Command &command, const ClassMap &classes,
+                   const NameClassMap &receivers)
+{
+    auto receiver = receivers.find(command.get_first_name());
+    if (receiver == receivers.end() or not classes.count(receiver->second)) {
+        return std::nullopt;
+    }
+    const auto &functions = classes.at(receiver->second).get_functions();
+    auto func = functions.find(command.get_second_name());
+    if (func == functions.end() or func->second->size() != 1 or
+        func->second->front().get_type() != CommandType::BuiltinFunction)
+    {
+        return std::nullopt;
+    }
+    return {{receiver->second, func->second->front().get_builtin()}};
+}
@@ -0,0 +1,145 @@
+#include "build.hpp"
+#include "compiler.hpp"
+#include "parallel.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+// Quotes a string so that it is passed as a single argument to the shell
+std::string shell_quote(const std::string &str) {
+    std::string quoted = "'";
+    for (auto c: str) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+// Returns the command used to invoke the C compiler, which is taken from the
+// CC environment variable if it is set
+std::string get_c_compiler() {
+    auto cc = std::getenv("CC");
+    if (cc == nullptr or *cc == '\0') {
+        return "cc";
+    }
+    return cc;
+}
+
+// Runs a shell command, returning whether it failed
+bool run_command(const std::string &command) {
+    if (std::system(command.c_str()) != 0) {
+        std::cerr << "Error! Command failed: " << command << "\n";
+        return true;
+    }
+    return false;
+}
+
+// Compiles the given classes to C, and then invokes the system's C compiler
+// to build an executable from the generated source. If the source is split
+// up, its files are compiled in parallel and then linked together. If a
+// training input is given, the program is built twice, with the first build
+// being run on the training input to gather a profile for the second build.
+// Returns whether there was some error during the build
+bool build_executable(const ClassMap &classes, const std::string &out_file,
+                      const BuildOptions &options)
+{
+    auto c_path = out_file + (options.split ? ".src" : ".c");
+    if (options.split ? compile_classes_split(classes, c_path)
+                      : compile_classes(classes, c_path))
+    {
+        return true;
+    }
+
+    std::vector<std::string> c_files;
+    if (options.split) {
+        for (const auto &entry: std::filesystem::directory_iterator(c_path)) {
+            if (entry.path().extension() == ".c") {
+                c_files.push_back(entry.path().string());
+            }
+        }
+    } else {
+        c_files.push_back(c_path);
+    }
+
+    std::string flags = " -O3";
+    if (options.native) {
+        flags += " -march=native";
+    }
+    if (options.lto) {
+        flags += " -flto=auto";
+    }
+
+    // Builds the executable, returning whether it failed
+    auto build = [&] (const std::string &extra_flags) {
+        auto cc = get_c_compiler() + flags + extra_flags;
+        if (not options.split) {
+            return run_command(cc + " " + shell_quote(c_files[0]) + " -o "
+                               + shell_quote(out_file) + " -lm");
+        }
+
+        std::atomic<bool> failed{false};
+        parallel_for(c_files.size(), [&] (std::size_t i) {
+            if (run_command(cc + " -c " + shell_quote(c_files[i]) + " -o "
+                            + shell_quote(c_files[i] + ".o")))
+            {
+                failed = true;
+            }
+        });
+        if (failed) {
+            return true;
+        }
+
+        std::string objs;
+        for (const auto &c_file: c_files) {
+            objs += " " + shell_quote(c_file + ".o");
+        }
+        return run_command(cc + objs + " -o " + shell_quote(out_file) + " -lm");
+    };
+
+    bool failed = false;
+    if (options.train_input.empty()) {
+        failed = build("");
+    } else {
+        auto profile_dir = std::filesystem::absolute(out_file + ".profile");
+        auto profile_flag = "=" + shell_quote(profile_dir.string());
+
+        // If the output file doesn't have a directory, it has to be prefixed
+        // with one for the shell to run it
+        auto exe_path = out_file;
+        if (exe_path.find('/') == std::string::npos) {
+            exe_path = "./" + exe_path;
+        }
+
+        failed = build(" -fprofile-generate" + profile_flag)
+                 or run_command(shell_quote(exe_path) + " < "
+                                + shell_quote(options.train_input)
+                                + " > /dev/null")
+                 or build(" -fprofile-use" + profile_flag
+                          + " -fprofile-correction -Wno-missing-profile");
+
+        std::error_code err;
+        std::filesystem::remove_all(profile_dir, err);
+    }
+
+    if (not failed) {
+        std::filesystem::remove_all(c_path);
+    }
+    return failed;
+}
+
+// Builds a shared object from a compiled program, with the program's main
+// function renamed to glass_main so that it can be loaded and run by the
+// interpreter. The compiler's own output is discarded, as the build happens
+// while a program is running. Returns whether the build failed
+bool build_shared_object(const std::string &c_file, const std::string &out_file)
+{
+    return run_command(get_c_compiler() + " -O3 -shared -fPIC -Dmain="
+                       + GLASS_MAIN + " " + shell_quote(c_file) + " -o "
+                       + shell_quote(out_file) + " -lm > /dev/null 2>&1");
+}
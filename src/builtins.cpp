@@ -2,6 +2,7 @@
 #include "class.hpp"
 #include "variable.hpp"
 
+#include <cassert>
 #include <cctype>
 #include <cmath>
 #include <iostream>
@@ -118,8 +119,10 @@ bool types_match(const std::vector<Variable> &stack, const std::string &name,
     return true;
 }
 
-// Handles a builtin function, returning true if there was an error
-bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
+// Handles a builtin function, returning true if there was an error. The types
+// of the arguments are only checked if check_types is true
+bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals,
+                    bool check_types)
 {
     switch (type) {
         case Builtin::InputLine: {
@@ -140,7 +143,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
             break;
 
         case Builtin::MathAdd: {
-            if (not types_match(stack, "A.a", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.a", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -150,7 +153,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathSub: {
-            if (not types_match(stack, "A.s", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.s", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -160,7 +163,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathMult: {
-            if (not types_match(stack, "A.m", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.m", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -170,7 +173,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathDiv: {
-            if (not types_match(stack, "A.d", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.d", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -180,7 +183,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathMod: {
-            if (not types_match(stack, "A.mod", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.mod", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -190,7 +193,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathFloor:  {
-            if (not types_match(stack, "A.f", {VarType::Number})) {
+            if (check_types and not types_match(stack, "A.f", {VarType::Number})) {
                 return true;
             }
             auto num = pop_stack(stack)->get_number();
@@ -199,7 +202,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathEqual: {
-            if (not types_match(stack, "A.e", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.e", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -209,7 +212,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathNotEqual:  {
-            if (not types_match(stack, "A.ne", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.ne", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -219,7 +222,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathLessThan: {
-            if (not types_match(stack, "A.lt", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.lt", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -229,7 +232,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathLessOrEqual: {
-            if (not types_match(stack, "A.le", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.le", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -239,7 +242,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathGreaterThan: {
-            if (not types_match(stack, "A.gt", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.gt", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -249,7 +252,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::MathGreaterOrEqual: {
-            if (not types_match(stack, "A.ge", {VarType::Number, VarType::Number})) {
+            if (check_types and not types_match(stack, "A.ge", {VarType::Number, VarType::Number})) {
                 return true;
             }
             auto num1 = pop_stack(stack)->get_number();
@@ -259,7 +262,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::OutputStr: {
-            if (not types_match(stack, "O.o", {VarType::String})) {
+            if (check_types and not types_match(stack, "O.o", {VarType::String})) {
                 return true;
             }
             auto str = pop_stack(stack)->get_string();
@@ -268,7 +271,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::OutputNumber: {
-            if (not types_match(stack, "O.on", {VarType::Number})) {
+            if (check_types and not types_match(stack, "O.on", {VarType::Number})) {
                 return true;
             }
             auto num = pop_stack(stack)->get_number();
@@ -277,7 +280,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrLength: {
-            if (not types_match(stack, "S.l", {VarType::String})) {
+            if (check_types and not types_match(stack, "S.l", {VarType::String})) {
                 return true;
             }
             auto str = pop_stack(stack)->get_string();
@@ -286,7 +289,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrIndex: {
-            if (not types_match(stack, "S.i", {VarType::String, VarType::Number})) {
+            if (check_types and not types_match(stack, "S.i", {VarType::String, VarType::Number})) {
                 return true;
             }
             auto num = pop_stack(stack)->get_number();
@@ -305,7 +308,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrReplace: {
-            if (not types_match(stack, "S.si", {VarType::String, VarType::Number, VarType::String})) {
+            if (check_types and not types_match(stack, "S.si", {VarType::String, VarType::Number, VarType::String})) {
                 return true;
             }
             auto chr = pop_stack(stack)->get_string();
@@ -335,7 +338,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrConcatenate: {
-            if (not types_match(stack, "S.a", {VarType::String, VarType::String})) {
+            if (check_types and not types_match(stack, "S.a", {VarType::String, VarType::String})) {
                 return true;
             }
             auto str1 = pop_stack(stack)->get_string();
@@ -345,7 +348,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrSplit: {
-            if (not types_match(stack, "S.d", {VarType::String, VarType::Number})) {
+            if (check_types and not types_match(stack, "S.d", {VarType::String, VarType::Number})) {
                 return true;
             }
             auto pos = pop_stack(stack)->get_number();
@@ -369,7 +372,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrEqual: {
-            if (not types_match(stack, "S.e", {VarType::String, VarType::String})) {
+            if (check_types and not types_match(stack, "S.e", {VarType::String, VarType::String})) {
                 return true;
             }
             auto str1 = pop_stack(stack)->get_string();
@@ -379,7 +382,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrNumtoChar: {
-            if (not types_match(stack, "S.ns", {VarType::Number})) {
+            if (check_types and not types_match(stack, "S.ns", {VarType::Number})) {
                 return true;
             }
             auto num = pop_stack(stack)->get_number();
@@ -388,7 +391,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::StrChartoNum: {
-            if (not types_match(stack, "S.sn", {VarType::String})) {
+            if (check_types and not types_match(stack, "S.sn", {VarType::String})) {
                 return true;
             }
             auto chr = pop_stack(stack)->get_string();
@@ -413,7 +416,7 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
         }
 
         case Builtin::VarDelete: {
-            if (not types_match(stack, "V.d", {VarType::Name})) {
+            if (check_types and not types_match(stack, "V.d", {VarType::Name})) {
                 return true;
             }
             auto name = pop_stack(stack)->get_name();
@@ -431,6 +434,149 @@ bool handle_builtin(Builtin type, std::vector<Variable> &stack, VarMap &globals)
     return false;
 }
 
+// Returns the number of values a builtin function pops from the stack, and
+// the number of values it pushes to the stack
+std::pair<int, int> builtin_stack_effect(Builtin type) {
+    switch (type) {
+        case Builtin::InputLine:
+        case Builtin::InputChar:
+        case Builtin::InputEof:
+        case Builtin::VarNew:
+            return {0, 1};
+
+        case Builtin::MathFloor:
+        case Builtin::StrLength:
+        case Builtin::StrNumtoChar:
+        case Builtin::StrChartoNum:
+            return {1, 1};
+
+        case Builtin::OutputStr:
+        case Builtin::OutputNumber:
+        case Builtin::VarDelete:
+            return {1, 0};
+
+        case Builtin::StrReplace:
+            return {3, 1};
+
+        case Builtin::StrSplit:
+            return {2, 2};
+
+        case Builtin::MathAdd:
+        case Builtin::MathSub:
+        case Builtin::MathMult:
+        case Builtin::MathDiv:
+        case Builtin::MathMod:
+        case Builtin::MathEqual:
+        case Builtin::MathNotEqual:
+        case Builtin::MathLessThan:
+        case Builtin::MathLessOrEqual:
+        case Builtin::MathGreaterThan:
+        case Builtin::MathGreaterOrEqual:
+        case Builtin::StrIndex:
+        case Builtin::StrConcatenate:
+        case Builtin::StrEqual:
+            return {2, 1};
+    }
+    assert(false);
+    return {0, 0};
+}
+
+// Returns the types of the arguments a builtin function requires, starting
+// from the deepest in the stack
+std::vector<VarType> builtin_arg_types(Builtin type) {
+    switch (type) {
+        case Builtin::InputLine:
+        case Builtin::InputChar:
+        case Builtin::InputEof:
+        case Builtin::VarNew:
+            return {};
+
+        case Builtin::MathFloor:
+        case Builtin::OutputNumber:
+        case Builtin::StrNumtoChar:
+            return {VarType::Number};
+
+        case Builtin::OutputStr:
+        case Builtin::StrLength:
+        case Builtin::StrChartoNum:
+            return {VarType::String};
+
+        case Builtin::VarDelete:
+            return {VarType::Name};
+
+        case Builtin::MathAdd:
+        case Builtin::MathSub:
+        case Builtin::MathMult:
+        case Builtin::MathDiv:
+        case Builtin::MathMod:
+        case Builtin::MathEqual:
+        case Builtin::MathNotEqual:
+        case Builtin::MathLessThan:
+        case Builtin::MathLessOrEqual:
+        case Builtin::MathGreaterThan:
+        case Builtin::MathGreaterOrEqual:
+            return {VarType::Number, VarType::Number};
+
+        case Builtin::StrIndex:
+        case Builtin::StrSplit:
+            return {VarType::String, VarType::Number};
+
+        case Builtin::StrConcatenate:
+        case Builtin::StrEqual:
+            return {VarType::String, VarType::String};
+
+        case Builtin::StrReplace:
+            return {VarType::String, VarType::Number, VarType::String};
+    }
+    assert(false);
+    return {};
+}
+
+// Returns the types of the values a builtin function pushes to the stack, in
+// the order they're pushed
+std::vector<VarType> builtin_result_types(Builtin type) {
+    switch (type) {
+        case Builtin::OutputStr:
+        case Builtin::OutputNumber:
+        case Builtin::VarDelete:
+            return {};
+
+        case Builtin::InputEof:
+        case Builtin::MathAdd:
+        case Builtin::MathSub:
+        case Builtin::MathMult:
+        case Builtin::MathDiv:
+        case Builtin::MathMod:
+        case Builtin::MathFloor:
+        case Builtin::MathEqual:
+        case Builtin::MathNotEqual:
+        case Builtin::MathLessThan:
+        case Builtin::MathLessOrEqual:
+        case Builtin::MathGreaterThan:
+        case Builtin::MathGreaterOrEqual:
+        case Builtin::StrLength:
+        case Builtin::StrEqual:
+        case Builtin::StrChartoNum:
+            return {VarType::Number};
+
+        case Builtin::InputLine:
+        case Builtin::InputChar:
+        case Builtin::StrIndex:
+        case Builtin::StrReplace:
+        case Builtin::StrConcatenate:
+        case Builtin::StrNumtoChar:
+            return {VarType::String};
+
+        case Builtin::StrSplit:
+            return {VarType::String, VarType::String};
+
+        case Builtin::VarNew:
+            return {VarType::Name};
+    }
+    assert(false);
+    return {};
+}
+
 // Returns the text for executing a given builtin function
 // temp_name is a name to be given that won't conflict with any other
 // names in the source code
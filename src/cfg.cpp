@@ -0,0 +1,144 @@
+#include "cfg.hpp"
+
+#include <stack>
+
+// Splits a list of commands into basic blocks, with a new block starting
+// after each command that can jump or return, and links each block to the
+// blocks that can run after it
+ControlFlowGraph::ControlFlowGraph(const CommandList &commands) {
+    // The blocks ending with LoopBegin commands that haven't been matched yet
+    std::stack<std::size_t> loop_stack;
+
+    blocks.emplace_back();
+    for (const auto &command: commands) {
+        blocks.back().commands.push_back(command);
+        auto block = blocks.size() - 1;
+        if (command.get_type() == CommandType::LoopBegin) {
+            loop_stack.push(block);
+        } else if (command.get_type() == CommandType::LoopEnd) {
+            blocks[block].loop_match = loop_stack.top();
+            blocks[loop_stack.top()].loop_match = block;
+            loop_stack.pop();
+        } else if (command.get_type() != CommandType::Return) {
+            continue;
+        }
+        blocks.emplace_back();
+    }
+
+    // Both loop commands either go into the loop's body or past its end,
+    // while a return doesn't go anywhere
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        auto &block = blocks[i];
+        if (block.commands.empty()) {
+            if (i + 1 < blocks.size()) {
+                block.successors.push_back(i + 1);
+            }
+            continue;
+        }
+        switch (block.commands.back().get_type()) {
+            case CommandType::LoopBegin:
+                block.successors = {i + 1, block.loop_match + 1};
+                break;
+
+            case CommandType::LoopEnd:
+                block.successors = {block.loop_match + 1, i + 1};
+                break;
+
+            case CommandType::Return:
+                break;
+
+            default:
+                if (i + 1 < blocks.size()) {
+                    block.successors.push_back(i + 1);
+                }
+                break;
+        }
+    }
+}
+
+// Returns the blocks of the graph, in the order they're laid out in
+std::vector<BasicBlock> &ControlFlowGraph::get_blocks() {
+    return blocks;
+}
+
+// Returns whether each block can be reached from the start of the method
+std::vector<bool> ControlFlowGraph::get_reachable() const {
+    std::vector<bool> reachable(blocks.size(), false);
+    std::stack<std::size_t> to_visit;
+    to_visit.push(0);
+    while (not to_visit.empty()) {
+        auto block = to_visit.top();
+        to_visit.pop();
+        if (reachable[block]) {
+            continue;
+        }
+        reachable[block] = true;
+        for (auto successor: blocks[block].successors) {
+            to_visit.push(successor);
+        }
+    }
+    return reachable;
+}
+
+// Returns the commands of the graph laid out in order, with the jumps of the
+// loops pointing at where their matching commands ended up. A block's
+// LoopBegin or LoopEnd command must only be removed along with the one it
+// matches
+CommandList ControlFlowGraph::linearize() const {
+    // The position each block's last command ends up at
+    std::vector<std::size_t> ends(blocks.size());
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        size += blocks[i].commands.size();
+        ends[i] = size - 1;
+    }
+
+    CommandList commands;
+    commands.reserve(size);
+    for (const auto &block: blocks) {
+        commands.insert(commands.end(), block.commands.begin(),
+                        block.commands.end());
+        if (block.commands.empty()) {
+            continue;
+        }
+        auto &last = commands.back();
+        if (last.get_type() == CommandType::LoopBegin or
+            last.get_type() == CommandType::LoopEnd)
+        {
+            last.set_jump(ends[block.loop_match]);
+        }
+    }
+    return commands;
+}
+
+// Removes the commands that can never run because every way of reaching them
+// returns first. A loop that can't be entered is removed entirely, but a loop
+// that always returns keeps its LoopEnd command so its LoopBegin has somewhere
+// to jump to. Returns whether any command was removed
+bool remove_unreachable_code(CommandList &commands, OptStats *stats) {
+    ControlFlowGraph cfg{commands};
+    auto reachable = cfg.get_reachable();
+    auto &blocks = cfg.get_blocks();
+
+    std::size_t removed = 0;
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        auto &block_commands = blocks[i].commands;
+        if (reachable[i] or block_commands.empty()) {
+            continue;
+        }
+        bool keep_end = block_commands.back().get_type() == CommandType::LoopEnd
+                        and reachable[blocks[i].loop_match];
+        removed += block_commands.size() - keep_end;
+        block_commands.erase(block_commands.begin(),
+                             block_commands.end() - keep_end);
+    }
+
+    if (removed == 0) {
+        return false;
+    }
+    commands = cfg.linearize();
+    if (stats) {
+        (*stats)["remove-dead-code"] += removed;
+    }
+    return true;
+}
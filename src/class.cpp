@@ -1,6 +1,9 @@
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include "class.hpp"
 
@@ -11,6 +14,15 @@ Class::Class(const std::string &name): name(name) {
 // exists within the class. Returns whether or not the class already had
 // a function with the name
 bool Class::add_function(const std::string &name, const CommandList &commands) {
+    return add_function(name, std::make_shared<CommandList>(commands));
+}
+
+// Adds a function to a class, sharing the given body with any other classes
+// that have it, unless a function with the same name already exists within
+// the class. Returns whether or not the class already had a function with
+// the name
+bool Class::add_function(const std::string &name,
+                         const std::shared_ptr<CommandList> &commands) {
     if (has_function(name)) {
         return true;
     }
@@ -36,71 +48,52 @@ bool Class::has_function(const std::string &name) const {
     return functions.count(name);
 }
 
-// Returns the class method with the given name
-CommandList &Class::get_function(const std::string &name) {
-    return functions.at(name);
+// Removes the function with the given name from the class
+void Class::remove_function(const std::string &name) {
+    functions.erase(name);
 }
 
-// Handles inheritance, adding functions to the class that are inherited from
-// its parent classes, and adjusts the constructor to call the parent classes'
-// constructors first
-void Class::handle_inheritance(ClassMap &classes) {
-    // As we may have to rename functions when inheriting constructors, so we
-    // have to get all the unique function names so as to prevent a constructor
-    // being given the same name as an existing function
-    std::unordered_set<std::string> function_names;
-    for (const auto &class_info: classes) {
-        for (const auto &func_info: class_info.second.get_functions()) {
-            function_names.insert(func_info.first);
-        }
+// Returns whether creating an instance of the class runs any constructor,
+// either its own or one that it inherits
+bool Class::has_constructor() const {
+    return has_function("c__") or not parent_ctors.empty();
+}
+
+// Returns the class method with the given name, so that it can be changed. If
+// the body is shared with another class, the class is given its own copy first
+CommandList &Class::get_function(const std::string &name) {
+    auto &commands = functions.at(name);
+    if (commands.use_count() > 1) {
+        commands = std::make_shared<CommandList>(*commands);
     }
+    return *commands;
+}
 
-    // Go through the parents, and copy the parents' functions to the child
-    for (const auto &parent: parents) {
-        if (classes.at(parent).parents.size() > 0) {
-            classes.at(parent).handle_inheritance(classes);
-        }
-        for (const auto &[name, func]: classes.at(parent).functions) {
-            if (name != "c__") {
-                // If the function isn't a constructor, add it to the child
-                add_function(name, func);
-            } else {
-                // Copy the parent's constructor with a changed, unique name, so
-                // as to not conflict with an existing function
-                auto ctor_name = "c__" + parent;
-                while (function_names.count(ctor_name)) {
-                    ctor_name += "_";
-                }
-                add_function(ctor_name, func);
-
-                auto &ctor = functions["c__"];
-                if (ctor.size() < 2 or
-                    ctor[0].get_type() != CommandType::PushName or
-                    ctor[0].get_string() != "_t" or
-                    ctor[1].get_type() != CommandType::AssignSelf)
-                {
-                    // Add two instructions to the beginning, assigning a self
-                    // pointer to a temporary variable, so we can call the parent
-                    // constructors on the newly-created object
-                    ctor.emplace(ctor.begin(), CommandType::AssignSelf, "", 0, 0);
-                    ctor.emplace(ctor.begin(), CommandType::PushName, "_t", "", 0, 0);
-                }
+// Returns the class method with the given name
+const CommandList &Class::get_function(const std::string &name) const {
+    return *functions.at(name);
+}
 
-                // Add the call to the parent constructor to the beginning of
-                // the constructor, after the self-assignment to a temporary
-                CommandList ctor_call {
-                    {CommandType::PushName, "_t", "", 0, 0},
-                    {CommandType::PushName, ctor_name, "", 0, 0},
-                    {CommandType::GetFunction, "", 0, 0},
-                    {CommandType::ExecuteFunc, "", 0, 0}
-                };
-                ctor.insert(ctor.begin() + 2, ctor_call.begin(), ctor_call.end());
-            }
-        }
+// Returns a single constructor that does everything creating an instance of
+// the class does, calling the inherited constructors on a self pointer held in
+// a temporary variable before running the class's own constructor
+CommandList Class::get_chained_constructor() const {
+    CommandList ctor;
+    if (not parent_ctors.empty()) {
+        ctor.emplace_back(CommandType::PushName, "_t", "", 0, 0);
+        ctor.emplace_back(CommandType::AssignSelf, "", 0, 0);
     }
-
-    // Empty the parents list so we know we don't have anything to inherit from
-    parents = {};
+    for (const auto &ctor_name: parent_ctors) {
+        ctor.emplace_back(CommandType::PushName, "_t", "", 0, 0);
+        ctor.emplace_back(CommandType::PushName, ctor_name, "", 0, 0);
+        ctor.emplace_back(CommandType::GetFunction, "", 0, 0);
+        ctor.emplace_back(CommandType::ExecuteFunc, "", 0, 0);
+    }
+    if (has_function("c__")) {
+        const auto &own = get_function("c__");
+        ctor.insert(ctor.end(), own.begin(), own.end());
+    }
+    return ctor;
 }
 
 // Returns all of the functions in the class
@@ -113,6 +106,12 @@ const std::vector<std::string> &Class::get_parents() const {
     return parents;
 }
 
+// Returns the names of the inherited constructors that are run, in order,
+// before the class's own constructor
+const std::vector<std::string> &Class::get_parent_ctors() const {
+    return parent_ctors;
+}
+
 const std::string &Class::get_name() const {
     return name;
 }
@@ -162,3 +161,75 @@ bool check_inheritance(const ClassMap &classes) {
 
     return false;
 }
+
+// Handles inheritance for every class, giving each class the functions it
+// inherits from its parent classes and the list of parent constructors to run
+// before its own. Inherited bodies are shared rather than copied, and the
+// classes are visited once each, with every parent before its children, so
+// a parent's inherited functions are all in place before it's inherited from.
+// The inheritance graph must already have been checked
+void resolve_inheritance(ClassMap &classes) {
+    // As inherited constructors have to be renamed, get all the unique
+    // function names so as to prevent a constructor being given the same name
+    // as an existing function
+    std::unordered_set<std::string> function_names;
+    for (const auto &class_info: classes) {
+        for (const auto &func_info: class_info.second.get_functions()) {
+            function_names.insert(func_info.first);
+        }
+    }
+
+    std::vector<std::string> order;
+    std::unordered_set<std::string> visited;
+    std::function<void(const std::string &)> visit =
+    [&] (const std::string &name) {
+        if (not visited.insert(name).second) {
+            return;
+        }
+        for (const auto &parent: classes.at(name).parents) {
+            visit(parent);
+        }
+        order.push_back(name);
+    };
+    for (const auto &class_info: classes) {
+        visit(class_info.first);
+    }
+
+    for (const auto &class_name: order) {
+        auto &child = classes.at(class_name);
+
+        // The constructors each parent contributes, being the ones it
+        // inherits followed by its own
+        std::vector<std::vector<std::string>> inherited_ctors;
+        for (const auto &parent_name: child.parents) {
+            const auto &parent = classes.at(parent_name);
+            inherited_ctors.push_back(parent.parent_ctors);
+            for (const auto &[name, func]: parent.functions) {
+                if (name != "c__") {
+                    child.add_function(name, func);
+                    continue;
+                }
+                // Share the parent's constructor under a changed, unique name,
+                // so as to not conflict with an existing function
+                auto ctor_name = "c__" + parent_name;
+                while (function_names.count(ctor_name)) {
+                    ctor_name += "_";
+                }
+                child.add_function(ctor_name, func);
+                inherited_ctors.back().push_back(ctor_name);
+            }
+        }
+
+        // Later parents' constructors run first
+        for (auto ctors = inherited_ctors.rbegin();
+             ctors != inherited_ctors.rend(); ctors++)
+        {
+            child.parent_ctors.insert(child.parent_ctors.end(),
+                                      ctors->begin(), ctors->end());
+        }
+
+        // Empty the parents list so we know we don't have anything to
+        // inherit from
+        child.parents = {};
+    }
+}
@@ -1,5 +1,7 @@
 #include "command.hpp"
 
+#include <cassert>
+
 Command::Command(CommandType type, const std::string &file_name, int line,
                  int col):
 type(type), file_name(file_name), line(line), col(col) {
@@ -33,6 +35,12 @@ type(type), data(std::pair{name1, name2}), file_name(file_name), line(line),
 col(col), line2(line2), col2(col2) {
 }
 
+Command::Command(CommandType type, const std::string &name, double dval,
+                 const std::string &file_name, int line, int col):
+type(type), data(std::pair{name, dval}), file_name(file_name), line(line),
+col(col) {
+}
+
 CommandType Command::get_type() const {
     return type;
 }
@@ -42,6 +50,9 @@ Builtin Command::get_builtin() const {
 }
 
 double Command::get_number() const {
+    if (type == CommandType::StoreNumber) {
+        return std::get<std::pair<std::string, double>>(data).second;
+    }
     return std::get<double>(data);
 }
 
@@ -53,6 +64,14 @@ void Command::set_jump(std::size_t new_jump) {
     std::get<std::pair<std::size_t, std::string>>(data).first = new_jump;
 }
 
+void Command::set_unchecked(bool new_unchecked) {
+    unchecked = new_unchecked;
+}
+
+void Command::set_resolved_builtin(std::optional<Builtin> builtin) {
+    resolved_builtin = builtin;
+}
+
 std::size_t Command::get_jump() const {
     return std::get<std::pair<std::size_t, std::string>>(data).first;
 }
@@ -62,6 +81,9 @@ const std::string &Command::get_loop_var() const {
 }
 
 const std::string &Command::get_first_name() const {
+    if (type == CommandType::StoreNumber) {
+        return std::get<std::pair<std::string, double>>(data).first;
+    }
     return std::get<std::pair<std::string, std::string>>(data).first;
 }
 
@@ -88,3 +110,43 @@ int Command::get_2nd_line() const {
 int Command::get_2nd_col() const {
     return col2;
 }
+
+bool Command::is_unchecked() const {
+    return unchecked;
+}
+
+std::optional<Builtin> Command::get_resolved_builtin() const {
+    return resolved_builtin;
+}
+
+std::string get_command_type_name(CommandType type) {
+    switch (type) {
+        case CommandType::AssignClass:     return "AssignClass";
+        case CommandType::AssignSelf:      return "AssignSelf";
+        case CommandType::AssignValue:     return "AssignValue";
+        case CommandType::DupElement:      return "DupElement";
+        case CommandType::ExecuteFunc:     return "ExecuteFunc";
+        case CommandType::GetFunction:     return "GetFunction";
+        case CommandType::GetValue:        return "GetValue";
+        case CommandType::LoopBegin:       return "LoopBegin";
+        case CommandType::LoopEnd:         return "LoopEnd";
+        case CommandType::PopStack:        return "PopStack";
+        case CommandType::PushName:        return "PushName";
+        case CommandType::PushNumber:      return "PushNumber";
+        case CommandType::PushString:      return "PushString";
+        case CommandType::Return:          return "Return";
+        case CommandType::BuiltinFunction: return "BuiltinFunction";
+        case CommandType::AssignTo:        return "AssignTo";
+        case CommandType::FuncCall:        return "FuncCall";
+        case CommandType::NewInst:         return "NewInst";
+        case CommandType::LoadVar:         return "LoadVar";
+        case CommandType::StoreNumber:     return "StoreNumber";
+        case CommandType::StoreString:     return "StoreString";
+        case CommandType::CopyVar:         return "CopyVar";
+        case CommandType::StoreSelf:       return "StoreSelf";
+        case CommandType::LoadField:       return "LoadField";
+        case CommandType::Nop:             return "Nop";
+    }
+    assert(false);
+    return "";
+}
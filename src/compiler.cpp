@@ -1,16 +1,29 @@
+#include "analysis.hpp"
 #include "builtins.hpp"
 #include "compiler.hpp"
+#include "parallel.hpp"
 #include "string-things.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <unordered_set>
 
 // Code that is included in every compiled source
 const std::string COMPILED_CODE_DEFS[] = {
+    "/* Global variables are only declared where GLOBAL is defined as extern */",
+    "#ifndef GLOBAL",
+    "#define GLOBAL",
+    "#endif",
+    "",
     "#include <math.h>",
     "#include <stddef.h>",
     "#include <stdlib.h>",
@@ -52,19 +65,25 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\tstruct Val vars[NUM_CLASS_VARS];",
     "};",
     "",
-    "struct Val global_vars[NUM_GLOBAL_VARS];",
+    "GLOBAL struct Val global_vars[NUM_GLOBAL_VARS];",
+    "",
+    "/* Strings of a single character, which are shared by every use of them */",
+    "GLOBAL struct String *char_strs[256];",
     "",
     "struct DynamicArray {",
     "\tvoid *elems;",
     "\tsize_t num_elems, num_allocated, el_size;",
-    "} *stack, *dynamic_vars, *instances, *insts_used, *this_objs, *locals_list;",
+    "};",
     "",
-    "void error(const char *msg) {",
+    "GLOBAL struct DynamicArray *stack, *dynamic_vars, *instances, *insts_used,",
+    "                           *this_objs, *locals_list;",
+    "",
+    "static void error(const char *msg) {",
     "\tfprintf(stderr, msg);",
     "\texit(1);",
     "}",
     "",
-    "struct DynamicArray *new_array(size_t el_size, size_t initial_cap) {",
+    "static struct DynamicArray *new_array(size_t el_size, size_t initial_cap) {",
     "\tstruct DynamicArray *array = malloc(sizeof(*array));",
     "\tarray->elems = malloc(el_size * initial_cap);",
     "\tarray->num_allocated = initial_cap;",
@@ -73,7 +92,7 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\treturn array;",
     "}",
     "",
-    "void array_add(struct DynamicArray *array, void *to_copy) {",
+    "static void array_add(struct DynamicArray *array, void *to_copy) {",
     "\tif (array->num_elems == array->num_allocated) {",
     "\t\tarray->num_allocated <<= 1;",
     "\t\tarray->elems = realloc(array->elems, array->num_allocated * array->el_size);",
@@ -82,57 +101,71 @@ const std::string COMPILED_CODE_DEFS[] = {
     "to_copy, array->el_size);",
     "}",
     "",
-    "void *array_pop(struct DynamicArray *array) {",
+    "static void *array_pop(struct DynamicArray *array) {",
     "\treturn ((char *) array->elems) + (array->el_size * --array->num_elems);",
     "}",
     "",
-    "void init() {",
-    "\tint i;",
-    "\tstack = new_array(sizeof(struct Val), 16);",
-    "\tdynamic_vars = new_array(sizeof(struct Val), 4);",
-    "\tinstances = new_array(sizeof(struct Instance), 256);",
-    "\tinsts_used = new_array(sizeof(bool), instances->num_allocated);",
-    "\tthis_objs = new_array(sizeof(size_t), 16);",
-    "\tlocals_list = new_array(sizeof(struct Val *), 16);",
-    "\tfor (i = 0; i < insts_used->num_allocated; i++) {",
-    "\t\t((bool *) insts_used->elems)[i] = false;",
-    "\t}",
-    "}",
-    "",
-    "void stack_push(struct Val *val) {",
+    "static void stack_push(struct Val *val) {",
     "\tarray_add(stack, val);",
     "}",
     "",
-    "struct Val stack_pop() {",
+    "static struct Val stack_pop() {",
     "\tif (stack->num_elems == 0) {",
     "\t\terror(\"Error! Tried to pop an empty stack!\\n\");",
     "\t}",
     "\treturn *((struct Val *) array_pop(stack));",
     "}",
     "",
-    "struct String *copy_str(const char *str) {",
-    "\tstruct String *new_str = malloc(sizeof(*new_str));",
-    "\tnew_str->str = strcpy(malloc(strlen(str) + 1), str);",
+    "static struct String *new_str(int len) {",
+    "\tstruct String *new_str = malloc(sizeof(*new_str) + len + 1);",
+    "\tnew_str->str = (char *) (new_str + 1);",
     "\tnew_str->ref_count = 1;",
     "\treturn new_str;",
     "}",
     "",
-    "struct String *new_str(int len) {",
-    "\tstruct String *new_str = malloc(sizeof(*new_str));",
-    "\tnew_str->str = malloc(len + 1);",
-    "\tnew_str->ref_count = 1;",
-    "\treturn new_str;",
+    "static struct String *resize_str(struct String *str, int len) {",
+    "\tstr = realloc(str, sizeof(*str) + len + 1);",
+    "\tstr->str = (char *) (str + 1);",
+    "\treturn str;",
+    "}",
+    "",
+    "static struct String *copy_str(const char *str) {",
+    "\tstruct String *copy = new_str(strlen(str));",
+    "\tstrcpy(copy->str, str);",
+    "\treturn copy;",
     "}",
     "",
-    "void release_str(struct String *str) {",
+    "static void release_str(struct String *str) {",
     "\tstr->ref_count--;",
-    "\tif (str->ref_count == 0) {",
-    "\t\tfree(str->str);",
+    "\tif (str->ref_count == 0)",
     "\t\tfree(str);",
+    "}",
+    "",
+    "static struct String *char_str(char c) {",
+    "\tstruct String *str = char_strs[(unsigned char) c];",
+    "\tstr->ref_count++;",
+    "\treturn str;",
+    "}",
+    "",
+    "static void init() {",
+    "\tint i;",
+    "\tstack = new_array(sizeof(struct Val), 16);",
+    "\tdynamic_vars = new_array(sizeof(struct Val), 4);",
+    "\tinstances = new_array(sizeof(struct Instance), 256);",
+    "\tinsts_used = new_array(sizeof(bool), instances->num_allocated);",
+    "\tthis_objs = new_array(sizeof(size_t), 16);",
+    "\tlocals_list = new_array(sizeof(struct Val *), 16);",
+    "\tfor (i = 0; i < insts_used->num_allocated; i++) {",
+    "\t\t((bool *) insts_used->elems)[i] = false;",
+    "\t}",
+    "\tfor (i = 0; i < 256; i++) {",
+    "\t\tchar_strs[i] = new_str(1);",
+    "\t\tchar_strs[i]->str[0] = (char) i;",
+    "\t\tchar_strs[i]->str[1] = '\\0';",
     "\t}",
     "}",
     "",
-    "void cleanup() {",
+    "static void cleanup() {",
     "\tint i, j;",
     "\tfor (i = 0; i < stack->num_elems; i++) {",
     "\t\tif (((struct Val *) stack->elems)[i].type == TYPE_STR)",
@@ -169,12 +202,12 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\tfree(insts_used);",
     "}",
     "",
-    "void enter_scope(size_t this, struct Val *locals) {",
+    "static void enter_scope(size_t this, struct Val *locals) {",
     "\tarray_add(this_objs, &this);",
     "\tarray_add(locals_list, &locals);",
     "}",
     "",
-    "void leave_scope() {",
+    "static void leave_scope() {",
     "\tint i;",
     "\tstruct Val *locals = *((struct Val **) array_pop(locals_list));",
     "\tfor (i = 0; i < NUM_LOCAL_VARS; i++) {",
@@ -184,7 +217,7 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\tarray_pop(this_objs);",
     "}",
     "",
-    "void do_garbage_collection() {",
+    "static void do_garbage_collection() {",
     "\tstruct DynamicArray *reachable_stack = new_array(sizeof(size_t), 32);",
     "\tsize_t i, j, num_used;",
     "\tfor (i = 0; i < this_objs->num_elems; i++) {",
@@ -248,7 +281,7 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\tfree(reachable_stack);",
     "}",
     "",
-    "size_t get_free_inst_index() {",
+    "static size_t get_free_inst_index() {",
     "\tstatic struct Instance blank_inst = {",
     "\t\tNULL, {{0.0, 0, 0}}",
     "\t};",
@@ -271,11 +304,11 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\treturn cur_inst++;",
     "}",
     "",
-    "struct Instance *get_inst(size_t index) {",
+    "static struct Instance *get_inst(size_t index) {",
     "\treturn ((struct Instance *) instances->elems) + index;",
     "}",
     "",
-    "void assign(enum Name name, size_t this, struct Val *locals, struct Val *new_val) {",
+    "static void assign(enum Name name, size_t this, struct Val *locals, struct Val *new_val) {",
     "\tstruct Val *old_val;",
     "\tif (name < NUM_GLOBAL_VARS)",
     "\t\told_val = &global_vars[name];",
@@ -290,7 +323,7 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\t*old_val = *new_val;",
     "}",
     "",
-    "struct Val get(enum Name name, size_t this, struct Val *locals) {",
+    "static struct Val get(enum Name name, size_t this, struct Val *locals) {",
     "\tstruct Val val;",
     "\tif (name < NUM_GLOBAL_VARS)",
     "\t\tval = global_vars[name];",
@@ -305,7 +338,7 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\treturn val;",
     "}",
     "",
-    "void dup(unsigned index) {",
+    "static void dup(unsigned index) {",
     "\tstruct Val *to_dup = ((struct Val *) stack->elems) + stack->num_elems - index - 1;",
     "\tif (index >= stack->num_elems)",
     "\t\terror(\"Error! Tried to duplicate out-of-bounds stack element!\\n\");",
@@ -314,258 +347,226 @@ const std::string COMPILED_CODE_DEFS[] = {
     "\t\tto_dup->val.sval->ref_count++;",
     "}",
     "",
-    "int is_true(struct Val *val) {",
+    "static int is_true(struct Val *val) {",
     "\treturn (val->type == TYPE_NUM && val->val.dval != 0.0) ||",
     "\t       (val->type == TYPE_STR && val->val.sval->str[0] != '\\0');",
     "}"
 };
 
-// Code used to implement the builtin functions
+// Code used to implement the builtin functions. The arguments of a builtin
+// are given in arg0, arg1 and arg2, with arg0 being the deepest in the stack,
+// and the results are stored in res0 and res1, with res0 being pushed first.
+// The arguments in READ_ONLY_STR_ARGS are released after this code runs
 const std::map<Builtin, std::vector<std::string>> BUILTIN_IMPLS {{
     {Builtin::InputLine, {
         "int c, allocated = 32, i = 0;",
-        "temp.type = TYPE_STR, temp.val.sval = new_str(allocated);",
+        "res0.type = TYPE_STR, res0.val.sval = new_str(allocated);",
         "while ((c = getchar()) != EOF) {",
-        "\ttemp.val.sval->str[i++] = c;",
+        "\tres0.val.sval->str[i++] = c;",
         "\tif (i == allocated) {",
         "\t\tallocated <<= 1;",
-        "\t\ttemp.val.sval->str = realloc(temp.val.sval->str, allocated + 1);",
+        "\t\tres0.val.sval = resize_str(res0.val.sval, allocated);",
         "\t}",
         "\tif (c == '\\n')",
         "\t\tbreak;",
         "}",
-        "temp.val.sval->str[i] = '\\0';",
-        "stack_push(&temp);"
+        "res0.val.sval->str[i] = '\\0';"
     }},
     {Builtin::InputChar, {
-        "temp.type = TYPE_STR, temp.val.sval = new_str(2);",
-        "temp.val.sval->str[0] = getchar();",
-        "temp.val.sval->str[1] = '\\0';",
-        "stack_push(&temp);"
+        "res0.type = TYPE_STR, res0.val.sval = char_str(getchar());"
     }},
     {Builtin::InputEof, {
-        "temp.type = TYPE_NUM, temp.val.dval = (feof(stdin) ? 1: 0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (feof(stdin) ? 1: 0);"
     }},
     {Builtin::MathAdd, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
-        "    error(\"Error! Cannot add non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval + temp2.val.dval);",
-        "stack_push(&temp);"
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
+        "\terror(\"Error! Cannot add non-numbers!\\n\");",
+        "res0.type = TYPE_NUM, res0.val.dval = arg0.val.dval + arg1.val.dval;"
     }},
     {Builtin::MathSub, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot subtract non-numbers!\\n\");",
-        "temp.val.dval = (temp2.val.dval - temp.val.dval);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = arg0.val.dval - arg1.val.dval;"
     }},
     {Builtin::MathMult, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot multiply non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval * temp2.val.dval);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = arg0.val.dval * arg1.val.dval;"
     }},
     {Builtin::MathDiv, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot divide non-numbers!\\n\");",
-        "temp.val.dval = (temp2.val.dval / temp.val.dval);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = arg0.val.dval / arg1.val.dval;"
     }},
     {Builtin::MathMod, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot divide non-numbers!\\n\");",
-        "temp.val.dval = fmod(temp2.val.dval, temp.val.dval);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = fmod(arg0.val.dval, arg1.val.dval);"
     }},
     {Builtin::MathFloor, {
-        "temp = stack_pop();",
-        "if (temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM)",
         "\terror(\"Error! Cannot floor non-number!\\n\");",
-        "temp.val.dval = floor(temp.val.dval);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = floor(arg0.val.dval);"
     }},
     {Builtin::MathEqual, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval == temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval == arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::MathNotEqual, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval != temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval != arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::MathLessThan, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval > temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval < arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::MathLessOrEqual, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval >= temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval <= arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::MathGreaterThan, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval < temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval > arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::MathGreaterOrEqual, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Cannot compare non-numbers!\\n\");",
-        "temp.val.dval = (temp.val.dval <= temp2.val.dval ? 1.0: 0.0);",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM, res0.val.dval = (arg0.val.dval >= arg1.val.dval ? 1.0: 0.0);"
     }},
     {Builtin::OutputStr, {
-        "temp = stack_pop();",
-        "if (temp.type == TYPE_STR)",
-        "\tprintf(\"%s\", temp.val.sval->str);",
-        "else",
+        "if (arg0.type != TYPE_STR)",
         "\terror(\"Cannot output non-string!\\n\");",
-        "release_str(temp.val.sval);"
+        "fputs(arg0.val.sval->str, stdout);"
     }},
     {Builtin::OutputNumber, {
-        "temp = stack_pop();",
-        "if (temp.type == TYPE_NUM)",
-        "\tprintf(\"%g\", temp.val.dval);"
+        "if (arg0.type != TYPE_NUM)",
+        "\terror(\"Cannot output non-number!\\n\");",
+        "printf(\"%g\", arg0.val.dval);"
     }},
     {Builtin::StrLength, {
-        "temp = stack_pop();",
-        "if (temp.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR)",
         "\terror(\"Error! Cannot get the length of a non-string!\\n\");",
-        "temp2.val.dval = (double) strlen(temp.val.sval->str);",
-        "temp2.type = TYPE_NUM;",
-        "stack_push(&temp2);",
-        "release_str(temp.val.sval);"
+        "res0.type = TYPE_NUM, res0.val.dval = (double) strlen(arg0.val.sval->str);"
     }},
     {Builtin::StrIndex, {
-        "int index;",
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp2.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR || arg1.type != TYPE_NUM)",
         "\terror(\"Error! Wrong types for string indexing!\\n\");",
-        "index = (int) temp.val.dval;",
-        "temp.val.sval = new_str(2);",
-        "temp.val.sval->str[1] = '\\0';",
-        "temp.val.sval->str[0] = temp2.val.sval->str[index];",
-        "temp.type = TYPE_STR;",
-        "stack_push(&temp);",
-        "release_str(temp2.val.sval);"
+        "res0.type = TYPE_STR;",
+        "res0.val.sval = char_str(arg0.val.sval->str[(int) arg1.val.dval]);"
     }},
     {Builtin::StrReplace, {
-        "struct Val temp3;",
-        "temp = stack_pop(), temp2 = stack_pop(), temp3 = stack_pop();",
-        "if (temp.type != TYPE_STR || temp2.type != TYPE_NUM || temp3.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR || arg1.type != TYPE_NUM || arg2.type != TYPE_STR)",
         "\terror(\"Wrong types for string replace operation!\\n\");",
-        "if (temp3.val.sval->ref_count > 1) {",
-        "\trelease_str(temp3.val.sval);",
-        "\ttemp3.val.sval = copy_str(temp3.val.sval->str);",
+        "if (arg0.val.sval->ref_count > 1) {",
+        "\tstruct String *old_str = arg0.val.sval;",
+        "\targ0.val.sval = copy_str(old_str->str);",
+        "\trelease_str(old_str);",
         "}",
-        "temp3.val.sval->str[(int) temp2.val.dval] = temp.val.sval->str[0];",
-        "release_str(temp.val.sval);",
-        "stack_push(&temp3);"
+        "arg0.val.sval->str[(int) arg1.val.dval] = arg2.val.sval->str[0];",
+        "res0 = arg0;"
     }},
     {Builtin::StrConcatenate, {
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_STR || temp2.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR || arg1.type != TYPE_STR)",
         "\terror(\"Error! Cannot concatenate non-strings!\\n\");",
-        "if (temp2.val.sval->ref_count == 1) {",
-        "\ttemp2.val.sval->str = realloc(temp2.val.sval->str, "
-        "strlen(temp2.val.sval->str) + strlen(temp.val.sval->str) + 1);",
+        "if (arg0.val.sval->ref_count == 1) {",
+        "\targ0.val.sval = resize_str(arg0.val.sval, "
+        "strlen(arg0.val.sval->str) + strlen(arg1.val.sval->str));",
         "} else {",
-        "\tstruct String *old_str = temp2.val.sval;",
-        "\ttemp2.val.sval = new_str(strlen(old_str->str) +"
-        "strlen(temp.val.sval->str) + 1);",
-        "\tstrcpy(temp2.val.sval->str, old_str->str);",
+        "\tstruct String *old_str = arg0.val.sval;",
+        "\targ0.val.sval = new_str(strlen(old_str->str) + "
+        "strlen(arg1.val.sval->str));",
+        "\tstrcpy(arg0.val.sval->str, old_str->str);",
         "\trelease_str(old_str);",
         "}",
-        "strcat(temp2.val.sval->str, temp.val.sval->str);",
-        "stack_push(&temp2);",
-        "release_str(temp.val.sval);"
+        "strcat(arg0.val.sval->str, arg1.val.sval->str);",
+        "res0 = arg0;"
     }},
     {Builtin::StrSplit, {
         "unsigned index;",
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_NUM || temp2.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR || arg1.type != TYPE_NUM)",
         "\terror(\"Wrong types for string split operation!\\n\");",
-        "index = (unsigned) temp.val.dval;",
-        "temp.val.sval = new_str(strlen(temp2.val.sval->str) - index);",
-        "strcpy(temp.val.sval->str, temp2.val.sval->str + index);",
-        "if (temp2.val.sval->ref_count > 1) {",
-        "\tstruct String *old_str = temp2.val.sval;",
-        "\ttemp2.val.sval = copy_str(old_str->str);",
+        "index = (unsigned) arg1.val.dval;",
+        "res1.type = TYPE_STR;",
+        "res1.val.sval = new_str(strlen(arg0.val.sval->str) - index);",
+        "strcpy(res1.val.sval->str, arg0.val.sval->str + index);",
+        "if (arg0.val.sval->ref_count > 1) {",
+        "\tstruct String *old_str = arg0.val.sval;",
+        "\targ0.val.sval = copy_str(old_str->str);",
         "\trelease_str(old_str);",
         "}",
-        "temp2.val.sval->str[index] = '\\0';",
-        "temp.type = TYPE_STR;",
-        "stack_push(&temp2);",
-        "stack_push(&temp);"
+        "arg0.val.sval->str[index] = '\\0';",
+        "res0 = arg0;"
     }},
     {Builtin::StrEqual, {
-        "double result;",
-        "temp = stack_pop(), temp2 = stack_pop();",
-        "if (temp.type != TYPE_STR || temp2.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR || arg1.type != TYPE_STR)",
         "\terror(\"Error! Cannot compare non-strings!\\n\");",
-        "result = (strcmp(temp.val.sval->str, temp2.val.sval->str) == 0 ? 1.0: 0.0);",
-        "release_str(temp.val.sval);",
-        "release_str(temp2.val.sval);",
-        "temp.type = TYPE_NUM;",
-        "temp.val.dval = result;",
-        "stack_push(&temp);"
+        "res0.type = TYPE_NUM;",
+        "res0.val.dval = (strcmp(arg0.val.sval->str, arg1.val.sval->str) == 0 ? 1.0: 0.0);"
     }},
     {Builtin::StrNumtoChar, {
-        "temp = stack_pop();",
-        "if (temp.type != TYPE_NUM)",
+        "if (arg0.type != TYPE_NUM)",
         "\terror(\"Cannot convert non-number to string!\\n\");",
-        "temp2.val.sval = new_str(2);",
-        "temp2.val.sval->str[0] = (char) temp.val.dval;",
-        "temp2.val.sval->str[1] = '\\0';",
-        "temp2.type = TYPE_STR;",
-        "stack_push(&temp2);"
+        "res0.type = TYPE_STR, res0.val.sval = char_str((char) arg0.val.dval);"
     }},
     {Builtin::StrChartoNum, {
-        "temp = stack_pop();",
-        "if (temp.type != TYPE_STR)",
+        "if (arg0.type != TYPE_STR)",
         "\terror(\"Cannot convert non-string to number!\\n\");",
-        "temp2.val.dval = (double) temp.val.sval->str[0];",
-        "temp2.type = TYPE_NUM;",
-        "stack_push(&temp2);",
-        "release_str(temp.val.sval);"
+        "res0.type = TYPE_NUM, res0.val.dval = (double) arg0.val.sval->str[0];"
     }},
     {Builtin::VarNew, {
-        "if (dynamic_vars.length == dynamic_vars.allocated) {",
-        "\tdynamic_vars.allocated <<= 1;",
-        "\tdynamic_vars.elems = realloc(dynamic_vars.elems,"
-        " sizeof(struct Val) * dynamic_vars.allocated);",
-        "}",
-        "temp.type = TYPE_NAME, temp.name = MIN_DYNAMIC_VAR + dynamic_vars.length;",
-        "dynamic_vars.elems[dynamic_vars.length++].type = TYPE_UNDEFINED;",
-        "stack_push(&temp);"
+        "res0.type = TYPE_UNDEFINED;",
+        "array_add(dynamic_vars, &res0);",
+        "res0.type = TYPE_NAME;",
+        "res0.name = MIN_DYNAMIC_VAR + dynamic_vars->num_elems - 1;"
     }},
     {Builtin::VarDelete, {
-        "temp = stack_pop();",
-        "if (temp.type != TYPE_NAME)",
+        "struct Val *old_val;",
+        "if (arg0.type != TYPE_NAME)",
         "\terror(\"Error! Cannot delete non-name!\\n\");",
-        "if (temp.name < MIN_DYNAMIC_VAR)",
+        "if (arg0.name < MIN_DYNAMIC_VAR)",
         "\terror(\"Cannot delete non-generated name!\\n\");",
-        "dynamic_vars.elems[temp.name - MIN_DYNAMIC_VAR].type = TYPE_UNDEFINED;"
+        "old_val = ((struct Val *) dynamic_vars->elems) + arg0.name - MIN_DYNAMIC_VAR;",
+        "if (old_val->type == TYPE_STR)",
+        "\trelease_str(old_val->val.sval);",
+        "old_val->type = TYPE_UNDEFINED;"
     }}
 }};
 
+// Returns the code implementing a builtin without the checks of the types of
+// its arguments, for when the types are proven to be right
+std::vector<std::string> without_type_checks(const std::vector<std::string> &lines) {
+    std::vector<std::string> unchecked;
+    for (std::size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].rfind("if (arg", 0) == 0 and
+            lines[i].find(".type != TYPE_") != std::string::npos)
+        {
+            // Skip the error following the check too
+            i++;
+            continue;
+        }
+        unchecked.push_back(lines[i]);
+    }
+    return unchecked;
+}
+
+// The arguments of builtins that are strings that the builtin only reads.
+// Since they don't need to be owned by the builtin, the compiled code can pass
+// them without touching their reference count
+const std::map<Builtin, std::vector<int>> READ_ONLY_STR_ARGS {{
+    {Builtin::OutputStr,      {0}},
+    {Builtin::StrLength,      {0}},
+    {Builtin::StrIndex,       {0}},
+    {Builtin::StrReplace,     {2}},
+    {Builtin::StrConcatenate, {1}},
+    {Builtin::StrEqual,       {0, 1}},
+    {Builtin::StrChartoNum,   {0}}
+}};
+
 // Mangles a function name to ensure that the generated function name is unique
 std::string mangle_func_name(const std::string &class_name,
                              const std::string &func_name)
@@ -600,7 +601,7 @@ std::array<std::unordered_set<std::string>, 4> get_names(const ClassMap &classes
 
     for (auto &class_info: classes) {
         for (auto &func_info: class_info.second.get_functions()) {
-            for (auto &command: func_info.second) {
+            for (auto &command: *func_info.second) {
                 if (command.get_type() == CommandType::PushName) {
                     add_name(command.get_string());
                 } else if (command.get_type() == CommandType::LoopBegin) {
@@ -613,9 +614,18 @@ std::array<std::unordered_set<std::string>, 4> get_names(const ClassMap &classes
                     } else {
                         add_name(func_name);
                     }
-                } else if (command.get_type() == CommandType::NewInst) {
+                } else if (command.get_type() == CommandType::NewInst
+                           or command.get_type() == CommandType::CopyVar
+                           or command.get_type() == CommandType::LoadField) {
                     add_name(command.get_first_name());
                     add_name(command.get_second_name());
+                } else if (command.get_type() == CommandType::AssignTo
+                           or command.get_type() == CommandType::LoadVar
+                           or command.get_type() == CommandType::StoreSelf) {
+                    add_name(command.get_string());
+                } else if (command.get_type() == CommandType::StoreNumber
+                           or command.get_type() == CommandType::StoreString) {
+                    add_name(command.get_first_name());
                 }
             }
         }
@@ -630,7 +640,7 @@ std::array<std::unordered_set<std::string>, 4> get_names(const ClassMap &classes
 
 // Prints an enumeration of all the names used in the input file to the
 // compiled file
-void output_name_enums(std::ofstream &file,
+void output_name_enums(std::ostream &file,
                        const std::unordered_set<std::string> &global_vars,
                        const std::unordered_set<std::string> &class_vars,
                        const std::unordered_set<std::string> &func_vars,
@@ -662,29 +672,27 @@ void output_name_enums(std::ofstream &file,
          << "\n};\n\n";
 }
 
-// Outputs String structs that are pushed to the stack by the program. They are
-// set up to have a reference count of at least one at all times so that the
-// program doesn't accidentally free them. Returns a map to convert a given
-// string to the output struct String in the program.
-std::unordered_map<std::string, int> output_strings(std::ofstream &file,
-                                                    const ClassMap &classes)
-{
+// Finds the strings that are pushed to the stack by the program. Returns a
+// map to convert a given string to the index of the String that holds it in
+// the compiled program
+std::unordered_map<std::string, int> get_str_indices(const ClassMap &classes) {
     std::unordered_map<std::string, int> str_map;
     int cur_index = 1;
 
-    file << "\n";
-
     for (const auto &class_info: classes) {
         for (const auto &func_info: class_info.second.get_functions()) {
-            for (const auto &command: func_info.second) {
+            for (const auto &command: *func_info.second) {
+                std::string str;
                 if (command.get_type() == CommandType::PushString) {
-                    auto &str_index = str_map[command.get_string()];
-                    if (str_index == 0) {
-                        str_index = cur_index;
-                        file << "struct String str" << cur_index << " = {\""
-                             << escape_str(command.get_string()) << "\", 1};\n";
-                        cur_index++;
-                    }
+                    str = command.get_string();
+                } else if (command.get_type() == CommandType::StoreString) {
+                    str = command.get_second_name();
+                } else {
+                    continue;
+                }
+                auto &str_index = str_map[str];
+                if (str_index == 0) {
+                    str_index = cur_index++;
                 }
             }
         }
@@ -693,9 +701,81 @@ std::unordered_map<std::string, int> output_strings(std::ofstream &file,
     return str_map;
 }
 
+// Returns the strings of the program, ordered by their index
+std::vector<std::string> sorted_strs(const std::unordered_map<std::string, int> &str_indices) {
+    std::vector<std::string> strs(str_indices.size());
+    for (const auto &[str, index]: str_indices) {
+        strs[index - 1] = str;
+    }
+    return strs;
+}
+
+// Declares the Strings that are pushed to the stack by the program
+void output_str_decls(std::ostream &file,
+                      const std::unordered_map<std::string, int> &str_indices)
+{
+    file << "\n";
+    for (std::size_t i = 1; i <= str_indices.size(); i++) {
+        file << "GLOBAL struct String *str" << i << ";\n";
+    }
+    file << "\nvoid init_strings();\n";
+}
+
+// Outputs the init_strings function that allocates the strings pushed by the
+// program. They are set up to have a reference count of at least one at all
+// times so that the program doesn't accidentally free them. They're allocated
+// on the heap, since the C compiler can't tell that they're never freed
+void output_str_init(std::ostream &file,
+                     const std::unordered_map<std::string, int> &str_indices)
+{
+    file << "\nvoid init_strings() {\n";
+    auto strs = sorted_strs(str_indices);
+    for (std::size_t i = 0; i < strs.size(); i++) {
+        file << "\tstr" << i + 1 << " = copy_str(\""
+             << escape_str(strs[i]) << "\");\n";
+    }
+    file << "}\n";
+}
+
+// Returns whether a class's method is used by the compiled program
+bool is_method_used(const std::string &class_name, const std::string &func_name,
+                    const std::unordered_set<std::string> &class_vars,
+                    const std::unordered_set<std::string> &func_vars)
+{
+    return class_vars.count(func_name) or func_vars.count(func_name) or
+           (class_name == "M" and func_name == "m");
+}
+
+// Declares the functions implementing the classes' methods, the class vtables
+// and the functions used to create instances of the classes
+void output_class_decls(std::ostream &file,
+                        const ClassMap &classes,
+                        const std::unordered_set<std::string> &global_vars,
+                        const std::unordered_set<std::string> &class_vars,
+                        const std::unordered_set<std::string> &func_vars)
+{
+    for (auto &[class_name, class_info]: classes) {
+        if (global_vars.count(class_name) == 0) {
+            // If this global name isn't a class, skip it
+            continue;
+        }
+        file << "\n";
+        for (auto &func: class_info.get_functions()) {
+            if (is_method_used(class_name, func.first, class_vars, func_vars)) {
+                file << "void " << mangle_func_name(class_name, func.first)
+                     << "(size_t);\n";
+            }
+        }
+        file << "extern Class C_" << class_name << ";\n"
+             << "size_t new_C_" << class_name << "();\n";
+    }
+
+    file << "\nextern size_t (*(factory_funcs)[NUM_GLOBAL_VARS])();\n";
+}
+
 // Outputs the definitions necessary to have all of the class vtables, and
 // sets up the class constructors
-void output_class_defs(std::ofstream &file,
+void output_class_defs(std::ostream &file,
                        const ClassMap &classes,
                        const std::unordered_set<std::string> &global_vars,
                        const std::unordered_set<std::string> &class_vars,
@@ -706,26 +786,10 @@ void output_class_defs(std::ofstream &file,
             // If this global name isn't a class, skip it
             continue;
         }
-        // Forward declare all of the class's functions
-        bool is_first = true;
-        for (auto &func: class_info.get_functions()) {
-            if (class_vars.count(func.first) or func_vars.count(func.first)) {
-                if (is_first) {
-                    file << "\nvoid ";
-                    is_first = false;
-                } else {
-                    file << ",\n     ";
-                }
-                file << mangle_func_name(class_name, func.first) << "(size_t)";
-            }
-        }
-        if (not is_first) {
-            file << ";\n";
-        }
 
         // Generate the class's vtable
         file << "\nClass C_" << class_name << " = {";
-        is_first = true;
+        bool is_first = true;
         for (auto var_info: class_vars) {
             if (is_first) {
                 is_first = false;
@@ -757,6 +821,10 @@ void output_class_defs(std::ofstream &file,
              << "size_t new_C_" << class_name << "() {\n"
              << "\tsize_t index = get_free_inst_index();\n"
              << "\tget_inst(index)->class = &C_" << class_name << ";\n";
+        for (const auto &ctor_name: class_info.get_parent_ctors()) {
+            file << "\t" << mangle_func_name(class_name, ctor_name)
+                 << "(index);\n";
+        }
         if (class_info.get_functions().count("c__")) {
             file << "\t" << mangle_func_name(class_name, "c__")
                  << "(index);\n";
@@ -803,42 +871,67 @@ bool must_create_new_scope(const CommandList &commands) {
     return false;
 }
 
-// Translates the Glass commands to C source code
-void output_commands(std::ofstream &file, const CommandList &commands,
-                     const std::unordered_map<std::string, int> &str_indices)
-{
-    // If the function is a builtin, just output the definition of
-    // the function from BUILTIN_IMPLS and leave
-    if (commands.size() == 1 and
-        commands[0].get_type() == CommandType::BuiltinFunction)
-    {
-        file << "\tstruct Val temp, temp2;\n";
-        for (auto &line: BUILTIN_IMPLS.at(commands[0].get_builtin())) {
-            file << "\t" << line << "\n";
-        }
-        return;
+// Returns the C expression for where the value of a name is stored
+std::string var_location(const std::string &name) {
+    if (name[0] == '_') {
+        return "local_vars[N_" + name + " - NUM_GLOBAL_VARS - NUM_FUNC_VARS]";
+    } else if (std::islower(name[0])) {
+        return "get_inst(this)->vars[N_" + name + " - NUM_GLOBAL_VARS]";
+    } else {
+        return "global_vars[N_" + name + "]";
     }
+}
 
-    bool is_new_scope = must_create_new_scope(commands);
-
-    // Create an array for storing the local variables, all initialized
-    // to be undefined values at first
-    file << "\tstruct Val local_vars[NUM_LOCAL_VARS] = {\n"
-         << "\t\t{0.0, 0, TYPE_UNDEFINED}\n"
-         << "\t};\n"
-         << "\tstruct Val temp, temp2;\n";
+// Returns a C literal for a number that doesn't lose any precision
+std::string number_literal(double num) {
+    std::ostringstream literal;
+    literal << std::setprecision(17) << num;
+    auto str = literal.str();
+    if (str.find_first_of(".en") == std::string::npos) {
+        str += ".0";
+    }
+    return str;
+}
 
-    if (is_new_scope) {
-        file << "\tenter_scope(this, local_vars);\n";
+// Returns the declaration of the variables used by a builtin's implementation
+std::string builtin_vars(Builtin type) {
+    auto [num_args, num_results] = builtin_stack_effect(type);
+    std::string vars;
+    for (int i = 0; i < num_args; i++) {
+        vars += (vars.empty() ? "" : ", ") + ("arg" + std::to_string(i));
     }
+    for (int i = 0; i < num_results; i++) {
+        vars += (vars.empty() ? "" : ", ") + ("res" + std::to_string(i));
+    }
+    return "struct Val " + vars + ";";
+}
+
+// A value on the virtual stack used when translating commands to C
+struct VirtualValue {
+    // The value, if it's a name that's known statically
+    std::optional<std::string> name;
+
+    // The variable the value was read from, if its string's reference count
+    // wasn't incremented for it. Such values have to take their own reference
+    // before the variable is changed or before they are kept anywhere else
+    std::optional<std::string> borrowed_from;
+};
 
+// Translates the Glass commands to C source code
+void output_commands(std::ostream &file, const CommandList &commands,
+                     const ClassMap &classes, const NameClassMap &receivers,
+                     const std::unordered_map<std::string, int> &str_indices)
+{
+    // The body of the function is written separately, so that the variables
+    // it ends up needing can be declared before it
+    std::ostringstream body;
     int tab_level = 1;
 
     auto print_lines = [&] (const auto &func, const auto &line, const auto &...lines) {
         for (int i = 0; i < tab_level; i++) {
-            file << "\t";
+            body << "\t";
         }
-        file << line << "\n";
+        body << line << "\n";
         if constexpr (sizeof...(lines) > 0) {
             func(func, lines...);
         }
@@ -848,51 +941,275 @@ void output_commands(std::ofstream &file, const CommandList &commands,
         print_lines(print_lines, args...);
     };
 
-    for (auto &command: commands) {
-        if (command.get_type() == CommandType::LoopEnd) {
-            tab_level--;
+    auto add_line_list = [&] (const std::vector<std::string> &lines) {
+        for (const auto &line: lines) {
+            add_lines(line);
+        }
+    };
+
+    // Within a basic block, values pushed to the stack are kept in the C
+    // variables s0, s1, etc. instead, with the real stack only being used
+    // when the values have to be visible to something else
+    std::vector<VirtualValue> virtual_stack;
+    std::size_t num_slots = 0;
+
+    auto slot = [] (std::size_t index) {
+        return "s" + std::to_string(index);
+    };
+
+    auto push_value = [&] (const VirtualValue &value) {
+        virtual_stack.push_back(value);
+        num_slots = std::max(num_slots, virtual_stack.size());
+    };
+
+    // Adds a value to the virtual stack, returning the variable it is in
+    auto push_slot = [&] (const std::optional<std::string> &borrowed_from = {}) {
+        push_value({std::nullopt, borrowed_from});
+        return slot(virtual_stack.size() - 1);
+    };
+
+    // Makes sure a name on the virtual stack is stored in its variable
+    auto materialize = [&] (std::size_t index) {
+        if (virtual_stack[index].name) {
+            add_lines(slot(index) + ".type = TYPE_NAME, " + slot(index)
+                      + ".name = N_" + *virtual_stack[index].name + ";");
+        }
+    };
+
+    // Makes a value on the virtual stack own a reference to its string
+    auto own = [&] (std::size_t index) {
+        if (virtual_stack[index].borrowed_from) {
+            add_lines("if (" + slot(index) + ".type == TYPE_STR)",
+                      "\t" + slot(index) + ".val.sval->ref_count++;");
+            virtual_stack[index].borrowed_from.reset();
+        }
+    };
+
+    // Makes the values borrowed from a variable own their references, which
+    // has to be done before the variable is assigned to. If no variable is
+    // given, it's done for every value
+    auto own_borrowed = [&] (const std::optional<std::string> &var = {}) {
+        for (std::size_t i = 0; i < virtual_stack.size(); i++) {
+            if (not var or virtual_stack[i].borrowed_from == var) {
+                own(i);
+            }
+        }
+    };
+
+    // Pushes the first values of the virtual stack to the real stack
+    auto spill = [&] (std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            own(i);
+            materialize(i);
+            add_lines("stack_push(&" + slot(i) + ");");
+        }
+    };
+
+    // Pops the first values of the virtual stack back from the real stack
+    auto reload = [&] (std::size_t count) {
+        for (std::size_t i = count; i-- > 0;) {
+            add_lines(slot(i) + " = stack_pop();");
+        }
+    };
+
+    // Moves the entire virtual stack to the real stack
+    auto flush = [&] () {
+        spill(virtual_stack.size());
+        virtual_stack.clear();
+    };
+
+    // Pops the top value of the stack, returning the variable it is in and
+    // whether it is borrowed. If the virtual stack is empty, the value is
+    // popped into the given variable
+    auto pop_borrowed = [&] (const std::string &scratch) {
+        if (virtual_stack.empty()) {
+            add_lines(scratch + " = stack_pop();");
+            return std::make_pair(scratch, false);
+        }
+        materialize(virtual_stack.size() - 1);
+        bool borrowed = virtual_stack.back().borrowed_from.has_value();
+        virtual_stack.pop_back();
+        return std::make_pair(slot(virtual_stack.size()), borrowed);
+    };
+
+    // Pops the top value of the stack, which owns its reference
+    auto pop_value = [&] (const std::string &scratch) {
+        if (not virtual_stack.empty()) {
+            own(virtual_stack.size() - 1);
+        }
+        return pop_borrowed(scratch).first;
+    };
+
+    // If the top of the stack is a name known statically, pops and returns it
+    auto pop_name = [&] () -> std::optional<std::string> {
+        if (virtual_stack.empty() or not virtual_stack.back().name) {
+            return std::nullopt;
+        }
+        auto name = virtual_stack.back().name;
+        virtual_stack.pop_back();
+        return name;
+    };
+
+    // Outputs code releasing the read-only arguments of a builtin, except for
+    // those that are borrowed
+    auto release_args = [&] (Builtin type, const std::vector<bool> &borrowed) {
+        auto read_only = READ_ONLY_STR_ARGS.find(type);
+        if (read_only == READ_ONLY_STR_ARGS.end()) {
+            return;
+        }
+        for (auto arg: read_only->second) {
+            if (not borrowed[arg]) {
+                add_lines("release_str(arg" + std::to_string(arg) + ".val.sval);");
+            }
+        }
+    };
+
+    // Returns whether a builtin only reads the given argument
+    auto is_read_only = [&] (Builtin type, int arg) {
+        auto read_only = READ_ONLY_STR_ARGS.find(type);
+        return read_only != READ_ONLY_STR_ARGS.end() and
+               std::count(read_only->second.begin(), read_only->second.end(), arg);
+    };
+
+    // Outputs the implementation of a builtin, whose arguments have already
+    // been put in place, leaving out the type checks if they're proven to pass
+    auto add_builtin_impl = [&] (Builtin type, bool unchecked = false) {
+        add_lines("{");
+        tab_level++;
+        if (unchecked) {
+            add_line_list(without_type_checks(BUILTIN_IMPLS.at(type)));
+        } else {
+            add_line_list(BUILTIN_IMPLS.at(type));
+        }
+        tab_level--;
+        add_lines("}");
+    };
+
+    // If the function is a builtin, just output the definition of
+    // the function from BUILTIN_IMPLS and leave
+    if (commands.size() == 1 and
+        commands[0].get_type() == CommandType::BuiltinFunction)
+    {
+        auto type = commands[0].get_builtin();
+        auto [num_args, num_results] = builtin_stack_effect(type);
+        add_lines(builtin_vars(type));
+        for (int i = num_args; i-- > 0;) {
+            add_lines("arg" + std::to_string(i) + " = stack_pop();");
+        }
+        add_builtin_impl(type);
+        release_args(type, std::vector<bool>(num_args, false));
+        for (int i = 0; i < num_results; i++) {
+            add_lines("stack_push(&res" + std::to_string(i) + ");");
         }
+        file << body.str();
+        return;
+    }
+
+    bool is_new_scope = must_create_new_scope(commands);
+
+    for (const auto &command: commands) {
         switch (command.get_type()) {
-            case CommandType::AssignClass:
+            case CommandType::AssignClass: {
+                auto cname = pop_name();
+                auto oname = cname ? pop_name() : std::nullopt;
+                if (cname and oname) {
+                    flush();
+                    add_lines(
+                        "if (N_" + *cname + " > NUM_GLOBAL_VARS"
+                        " || factory_funcs[N_" + *cname + "] == NULL)",
+                        "\terror(\"Invalid class name!\\n\");",
+                        "temp.type = TYPE_INST;",
+                        "temp.val.ival = factory_funcs[N_" + *cname + "]();",
+                        "assign(N_" + *oname + ", this, local_vars, &temp);");
+                    break;
+                }
+                if (cname) {
+                    push_value({cname, std::nullopt});
+                }
+                auto class_val = pop_value("temp");
+                add_lines("temp = " + class_val + ";");
+                auto name_val = pop_value("temp2");
+                add_lines("temp2 = " + name_val + ";");
+                flush();
                 add_lines(
-                    "temp = stack_pop();",
                     "if (temp.type != TYPE_NAME || temp.name >= NUM_GLOBAL_VARS)",
                     "\terror(\"Invalid class name!\\n\");",
-                    "temp2 = stack_pop();",
-                    "if (temp.type != TYPE_NAME)",
+                    "if (temp2.type != TYPE_NAME)",
                     "\terror(\"Cannot assign to non-name!\\n\");",
                     "temp.val.ival = factory_funcs[temp.name]();",
                     "temp.type = TYPE_INST;",
                     "assign(temp2.name, this, local_vars, &temp);");
                 break;
+            }
 
-            case CommandType::AssignSelf:
+            case CommandType::AssignSelf: {
+                auto name = pop_name();
+                own_borrowed(name);
+                if (name) {
+                    add_lines("temp2.type = TYPE_INST, temp2.val.ival = this;",
+                              "assign(N_" + *name + ", this, local_vars, &temp2);");
+                    break;
+                }
+                auto name_val = pop_value("temp");
                 add_lines(
-                    "temp = stack_pop();",
-                    "if (temp.type != TYPE_NAME)",
+                    "if (" + name_val + ".type != TYPE_NAME)",
                     "\terror(\"Cannot assign to non-name!\\n\");",
                     "temp2.type = TYPE_INST, temp2.val.ival = this;",
-                    "assign(temp.name, this, local_vars, &temp2);");
+                    "assign(" + name_val + ".name, this, local_vars, &temp2);");
                 break;
+            }
 
-            case CommandType::AssignValue:
+            case CommandType::AssignValue: {
+                auto val = pop_value("temp");
+                auto name = pop_name();
+                own_borrowed(name);
+                if (name) {
+                    add_lines("assign(N_" + *name + ", this, local_vars, &"
+                              + val + ");");
+                    break;
+                }
+                auto name_val = pop_value("temp2");
                 add_lines(
-                    "temp = stack_pop(), temp2 = stack_pop();",
-                    "if (temp2.type != TYPE_NAME) {",
+                    "if (" + name_val + ".type != TYPE_NAME) {",
                     "\terror(\"Cannot assign to a non-name!\\n\");",
                     "}",
-                    "assign(temp2.name, this, local_vars, &temp);");
+                    "assign(" + name_val + ".name, this, local_vars, &" + val
+                    + ");");
                 break;
+            }
 
-            case CommandType::DupElement:
-                add_lines(
-                    "dup((unsigned) " +
-                    std::to_string(command.get_number()) + ");");
+            case CommandType::DupElement: {
+                auto index = static_cast<std::size_t>(command.get_number());
+                if (index >= virtual_stack.size()) {
+                    flush();
+                    add_lines("dup((unsigned) " + std::to_string(index) + ");");
+                    break;
+                }
+                auto source = virtual_stack.size() - index - 1;
+                if (virtual_stack[source].name) {
+                    push_value(virtual_stack[source]);
+                    break;
+                }
+                // A copy of a borrowed value can be borrowed as well
+                auto borrowed_from = virtual_stack[source].borrowed_from;
+                auto dest = push_slot(borrowed_from);
+                if (borrowed_from) {
+                    add_lines(dest + " = " + slot(source) + ";");
+                    break;
+                }
+                add_lines(dest + " = " + slot(source) + ";",
+                          "if (" + dest + ".type == TYPE_STR)",
+                          "\t" + dest + ".val.sval->ref_count++;");
                 break;
+            }
 
-            case CommandType::ExecuteFunc:
+            case CommandType::ExecuteFunc: {
+                auto func = pop_value("temp");
+                if (func != "temp") {
+                    add_lines("temp = " + func + ";");
+                }
+                flush();
                 add_lines(
-                    "temp = stack_pop();",
                     "if (temp.type != TYPE_FUNC)",
                     "\terror(\"Cannot execute non-function!\\n\");",
                     "if (get_inst(temp.val.ival)->class"
@@ -901,83 +1218,129 @@ void output_commands(std::ofstream &file, const CommandList &commands,
                     "(*get_inst(temp.val.ival)->class)"
                     "[temp.name - NUM_GLOBAL_VARS](temp.val.ival);");
                 break;
+            }
 
-            case CommandType::GetFunction:
+            case CommandType::GetFunction: {
+                std::string func_name, obj_name;
+                auto known_func = pop_name();
+                if (known_func) {
+                    func_name = "N_" + *known_func;
+                } else {
+                    auto func_val = pop_value("temp");
+                    add_lines(
+                        "if (" + func_val + ".type != TYPE_NAME)",
+                        "\terror(\"Invalid function name!\\n\");");
+                    func_name = func_val + ".name";
+                    if (func_val != "temp") {
+                        add_lines("temp = " + func_val + ";");
+                        func_name = "temp.name";
+                    }
+                }
                 add_lines(
-                    "temp = stack_pop(), temp2 = stack_pop();",
-                    "if (temp.type != TYPE_NAME || temp.name < NUM_GLOBAL_VARS "
-                    "|| temp.name > NUM_GLOBAL_VARS + NUM_FUNC_VARS)",
-                    "\terror(\"Invalid function name!\\n\");",
-                    "if (temp2.type != TYPE_NAME)",
-                    "\terror(\"Cannot retrieve value of non-name!\\n\");",
-                    "temp2 = get(temp2.name, this, local_vars);",
+                    "if (" + func_name + " < NUM_GLOBAL_VARS "
+                    "|| " + func_name + " > NUM_GLOBAL_VARS + NUM_FUNC_VARS)",
+                    "\terror(\"Invalid function name!\\n\");");
+
+                auto known_obj = pop_name();
+                if (known_obj) {
+                    obj_name = "N_" + *known_obj;
+                } else {
+                    auto obj_val = pop_value("temp2");
+                    add_lines(
+                        "if (" + obj_val + ".type != TYPE_NAME)",
+                        "\terror(\"Cannot retrieve value of non-name!\\n\");");
+                    obj_name = obj_val + ".name";
+                }
+                add_lines(
+                    "temp2 = get(" + obj_name + ", this, local_vars);",
                     "if (temp2.type != TYPE_INST)",
-                    "\terror(\"Cannot retrieve function of non-instance!\\n\");",
-                    "temp.type = TYPE_FUNC, temp.val.ival = temp2.val.ival;",
-                    "stack_push(&temp);");
+                    "\terror(\"Cannot retrieve function of non-instance!\\n\");");
+                auto dest = push_slot();
+                add_lines(dest + ".type = TYPE_FUNC, " + dest + ".name = "
+                          + func_name + ", " + dest + ".val.ival = temp2.val.ival;");
                 break;
+            }
 
-            case CommandType::GetValue:
+            case CommandType::GetValue: {
+                std::string name;
+                auto known_name = pop_name();
+                if (known_name) {
+                    // The value of a name known statically is read straight
+                    // from the variable, borrowing its reference
+                    auto dest = push_slot(known_name);
+                    add_lines(
+                        dest + " = " + var_location(*known_name) + ";",
+                        "if (" + dest + ".type == TYPE_UNDEFINED)",
+                        "\terror(\"Error! Cannot retrieve undefined value!\\n\");");
+                    break;
+                } else {
+                    auto name_val = pop_value("temp");
+                    add_lines(
+                        "if (" + name_val + ".type != TYPE_NAME)",
+                        "\terror(\"Cannot retrieve value of a non-name!\\n\");");
+                    name = name_val + ".name";
+                }
+                auto dest = push_slot();
                 add_lines(
-                    "temp = stack_pop();",
-                    "if (temp.type != TYPE_NAME)",
-                    "\terror(\"Cannot retrieve value of a non-name!\\n\");",
-                    "temp = get(temp.name, this, local_vars);",
-                    "if (temp.type == TYPE_UNDEFINED)",
-                    "\terror(\"Error! Cannot retrieve undefined value!\\n\");",
-                    "stack_push(&temp);");
+                    dest + " = get(" + name + ", this, local_vars);",
+                    "if (" + dest + ".type == TYPE_UNDEFINED)",
+                    "\terror(\"Error! Cannot retrieve undefined value!\\n\");");
                 break;
+            }
 
-            case CommandType::LoopBegin: {
-                std::string new_str = "while (";
-                if (command.get_loop_var()[0] == '_') {
-                    new_str += "is_true(&local_vars[N_" + command.get_loop_var()
-                               + " - NUM_GLOBAL_VARS - NUM_FUNC_VARS";
-                } else if (std::islower(command.get_loop_var()[0])) {
-                    new_str += "is_true(&get_inst(this)->vars[N_"
-                               + command.get_loop_var() + " - NUM_GLOBAL_VARS";
+            // Loop variables proven to be numbers are tested directly
+            case CommandType::LoopBegin:
+                flush();
+                if (command.is_unchecked()) {
+                    add_lines("while (" + var_location(command.get_loop_var())
+                              + ".val.dval != 0.0) {");
                 } else {
-                    new_str += "is_true(&global_vars[N_" + command.get_loop_var();
+                    add_lines("while (is_true(&"
+                              + var_location(command.get_loop_var()) + ")) {");
                 }
-                add_lines(new_str + "])) {");
                 tab_level++;
                 break;
-            }
 
             case CommandType::LoopEnd:
+                flush();
+                tab_level--;
                 add_lines("}");
                 break;
 
-            case CommandType::PopStack:
-                add_lines("temp = stack_pop();",
-                          "if (temp.type == TYPE_STR)",
-                           "\trelease_str(temp.val.sval);");
+            case CommandType::PopStack: {
+                if (pop_name()) {
+                    break;
+                }
+                auto [val, borrowed] = pop_borrowed("temp");
+                if (not borrowed) {
+                    add_lines("if (" + val + ".type == TYPE_STR)",
+                              "\trelease_str(" + val + ".val.sval);");
+                }
                 break;
+            }
 
             case CommandType::PushName:
-                add_lines("temp.name = N_" + command.get_string() + ";",
-                          "temp.type = TYPE_NAME;",
-                          "stack_push(&temp);");
+                push_value({command.get_string(), std::nullopt});
                 break;
 
-            case CommandType::PushNumber:
-                add_lines(
-                    "temp.val.dval = " +
-                    std::to_string(command.get_number()) + ";",
-                    "temp.type = TYPE_NUM;",
-                    "stack_push(&temp);");
+            case CommandType::PushNumber: {
+                auto dest = push_slot();
+                add_lines(dest + ".type = TYPE_NUM, " + dest + ".val.dval = "
+                          + number_literal(command.get_number()) + ";");
                 break;
+            }
 
-            case CommandType::PushString:
+            case CommandType::PushString: {
+                auto dest = push_slot();
                 add_lines(
-                    "temp.type = TYPE_STR, temp.val.sval = &str"
+                    dest + ".type = TYPE_STR, " + dest + ".val.sval = str"
                     + std::to_string(str_indices.at(command.get_string())) + ";",
-                    "temp.val.sval->ref_count++;",
-                    "stack_push(&temp);"
-                );
+                    dest + ".val.sval->ref_count++;");
                 break;
+            }
 
             case CommandType::Return:
+                flush();
                 if (is_new_scope) {
                     add_lines("leave_scope();");
                 }
@@ -985,34 +1348,18 @@ void output_commands(std::ofstream &file, const CommandList &commands,
                 break;
 
             case CommandType::AssignTo: {
-                std::string assign_loc;
-                if (command.get_string()[0] == '_') {
-                    assign_loc = "local_vars[N_" + command.get_string() +
-                                 " - NUM_GLOBAL_VARS - NUM_FUNC_VARS]";
-                } else if (std::islower(command.get_string()[0])) {
-                    assign_loc = "get_inst(this)->vars[N_" +
-                                 command.get_string() + " - NUM_GLOBAL_VARS]";
-                } else {
-                    assign_loc = "global_vars[N_" + command.get_string() + "]";
-                }
-                add_lines("temp = stack_pop();", assign_loc + " = temp;");
+                auto val = pop_value("temp");
+                own_borrowed(command.get_string());
+                auto location = var_location(command.get_string());
+                add_lines("if (" + location + ".type == TYPE_STR)",
+                          "\trelease_str(" + location + ".val.sval);",
+                          location + " = " + val + ";");
                 break;
             }
 
             case CommandType::FuncCall: {
-                std::string new_str = "temp = ";
-                if (command.get_first_name()[0] == '_') {
-                    new_str += "local_vars[N_" + command.get_first_name()
-                               + " - NUM_GLOBAL_VARS - NUM_FUNC_VARS";
-                } else if (std::islower(command.get_first_name()[0])) {
-                    new_str += "get_inst(this)->vars[N_" + command.get_first_name()
-                               + " - NUM_GLOBAL_VARS";
-                } else {
-                    new_str += "global_vars[N_" + command.get_first_name();
-                }
-                new_str += "];";
-                add_lines(
-                    new_str,
+                std::vector<std::string> call_lines {
+                    "temp = " + var_location(command.get_first_name()) + ";",
                     "if (N_" + command.get_second_name() + " < NUM_GLOBAL_VARS)",
                     "\terror(\"Invalid function name!\\n\");",
                     "if (temp.type != TYPE_INST)",
@@ -1021,11 +1368,99 @@ void output_commands(std::ofstream &file, const CommandList &commands,
                     + command.get_second_name() + " - NUM_GLOBAL_VARS] == NULL)",
                     "\terror(\"Cannot execute non-existent function!\\n\");",
                     "(*get_inst(temp.val.ival)->class)[N_" + command.get_second_name()
-                    + " - NUM_GLOBAL_VARS](temp.val.ival);");
+                    + " - NUM_GLOBAL_VARS](temp.val.ival);"
+                };
+
+                // Calls resolved while optimizing are known to call builtins
+                // even when the receiver's class can't be found here, since
+                // the receiver might not even be created anymore
+                auto resolved = command.get_resolved_builtin();
+                auto builtin = resolved
+                    ? std::optional<std::pair<std::string, Builtin>>{{"", *resolved}}
+                    : get_called_builtin(command, classes, receivers);
+                if (not builtin) {
+                    flush();
+                    add_line_list(call_lines);
+                    break;
+                }
+
+                // If the method being called is known to be a builtin, the
+                // builtin's code is inlined here, with a check that the
+                // receiver really is an instance of the builtin's class. If
+                // it isn't, the method is called normally, with the values
+                // on the virtual stack going through the real stack
+                auto [class_name, type] = *builtin;
+                auto [num_args, num_results] = builtin_stack_effect(type);
+                add_lines("{");
+                tab_level++;
+                add_lines(builtin_vars(type));
+                std::vector<bool> borrowed(num_args, false);
+                for (int i = num_args; i-- > 0;) {
+                    auto arg = "arg" + std::to_string(i);
+                    std::string val;
+                    if (is_read_only(type, i)) {
+                        auto popped = pop_borrowed(arg);
+                        val = popped.first;
+                        borrowed[i] = popped.second;
+                    } else {
+                        val = pop_value(arg);
+                    }
+                    if (val != arg) {
+                        add_lines(arg + " = " + val + ";");
+                    }
+                }
+
+                // If the receiver is proven to be an instance of the
+                // builtin's class, there's no need for the fallback path
+                if (command.get_resolved_builtin()) {
+                    add_builtin_impl(type, command.is_unchecked());
+                    release_args(type, borrowed);
+                    for (int i = 0; i < num_results; i++) {
+                        add_lines(push_slot() + " = res" + std::to_string(i) + ";");
+                    }
+                    tab_level--;
+                    add_lines("}");
+                    break;
+                }
+
+                // The values left on the virtual stack might be spilled by
+                // the fallback path, so they can't be borrowed past here
+                own_borrowed();
+                add_lines("temp = " + var_location(command.get_first_name()) + ";",
+                          "if (temp.type == TYPE_INST && "
+                          "get_inst(temp.val.ival)->class == &C_"
+                          + class_name + ") {");
+                tab_level++;
+                add_builtin_impl(type, command.is_unchecked());
+                release_args(type, borrowed);
+                tab_level--;
+                add_lines("} else {");
+                tab_level++;
+                spill(virtual_stack.size());
+                for (int i = 0; i < num_args; i++) {
+                    auto arg = "arg" + std::to_string(i);
+                    if (borrowed[i]) {
+                        add_lines(arg + ".val.sval->ref_count++;");
+                    }
+                    add_lines("stack_push(&" + arg + ");");
+                }
+                add_line_list(call_lines);
+                for (int i = num_results; i-- > 0;) {
+                    add_lines("res" + std::to_string(i) + " = stack_pop();");
+                }
+                reload(virtual_stack.size());
+                tab_level--;
+                add_lines("}");
+                for (int i = 0; i < num_results; i++) {
+                    add_lines(push_slot() + " = res" + std::to_string(i) + ";");
+                }
+                tab_level--;
+                add_lines("}");
                 break;
             }
 
             case CommandType::NewInst: {
+                flush();
                 auto oname = command.get_first_name();
                 auto cname = command.get_second_name();
                 add_lines(
@@ -1038,6 +1473,82 @@ void output_commands(std::ofstream &file, const CommandList &commands,
                 break;
             }
 
+            // Unchecked variables are proven to be defined
+            case CommandType::LoadVar: {
+                auto dest = push_slot(command.get_string());
+                add_lines(dest + " = " + var_location(command.get_string()) + ";");
+                if (not command.is_unchecked()) {
+                    add_lines(
+                        "if (" + dest + ".type == TYPE_UNDEFINED)",
+                        "\terror(\"Error! Cannot retrieve undefined value!\\n\");");
+                }
+                break;
+            }
+
+            case CommandType::StoreNumber: {
+                own_borrowed(command.get_first_name());
+                auto location = var_location(command.get_first_name());
+                add_lines("if (" + location + ".type == TYPE_STR)",
+                          "\trelease_str(" + location + ".val.sval);",
+                          location + ".type = TYPE_NUM, " + location
+                          + ".val.dval = " + number_literal(command.get_number())
+                          + ";");
+                break;
+            }
+
+            case CommandType::StoreString: {
+                own_borrowed(command.get_first_name());
+                auto location = var_location(command.get_first_name());
+                auto str = "str" + std::to_string(
+                    str_indices.at(command.get_second_name()));
+                add_lines(str + "->ref_count++;",
+                          "if (" + location + ".type == TYPE_STR)",
+                          "\trelease_str(" + location + ".val.sval);",
+                          location + ".type = TYPE_STR, " + location
+                          + ".val.sval = " + str + ";");
+                break;
+            }
+
+            case CommandType::CopyVar: {
+                own_borrowed(command.get_first_name());
+                auto location = var_location(command.get_first_name());
+                add_lines("temp = " + var_location(command.get_second_name()) + ";");
+                if (not command.is_unchecked()) {
+                    add_lines(
+                        "if (temp.type == TYPE_UNDEFINED)",
+                        "\terror(\"Error! Cannot retrieve undefined value!\\n\");");
+                }
+                add_lines(
+                    "if (temp.type == TYPE_STR)",
+                    "\ttemp.val.sval->ref_count++;",
+                    "if (" + location + ".type == TYPE_STR)",
+                    "\trelease_str(" + location + ".val.sval);",
+                    location + " = temp;");
+                break;
+            }
+
+            case CommandType::StoreSelf:
+                own_borrowed(command.get_string());
+                add_lines("temp2.type = TYPE_INST, temp2.val.ival = this;",
+                          "assign(N_" + command.get_string()
+                          + ", this, local_vars, &temp2);");
+                break;
+
+            case CommandType::LoadField: {
+                auto dest = push_slot();
+                add_lines(
+                    "temp = " + var_location(command.get_first_name()) + ";",
+                    "if (temp.type != TYPE_INST)",
+                    "\terror(\"Cannot retrieve field from non-instance!\\n\");",
+                    dest + " = get_inst(temp.val.ival)->vars[N_"
+                    + command.get_second_name() + " - NUM_GLOBAL_VARS];",
+                    "if (" + dest + ".type == TYPE_UNDEFINED)",
+                    "\terror(\"Error! Cannot retrieve undefined value!\\n\");",
+                    "if (" + dest + ".type == TYPE_STR)",
+                    "\t" + dest + ".val.sval->ref_count++;");
+                break;
+            }
+
             case CommandType::BuiltinFunction:
             case CommandType::Nop:
                 assert(false);
@@ -1045,44 +1556,69 @@ void output_commands(std::ofstream &file, const CommandList &commands,
         }
     }
 
+    flush();
     if (is_new_scope) {
         add_lines("leave_scope();");
     }
+
+    // Create an array for storing the local variables, all initialized
+    // to be undefined values at first
+    file << "\tstruct Val local_vars[NUM_LOCAL_VARS] = {\n"
+         << "\t\t{0.0, 0, TYPE_UNDEFINED}\n"
+         << "\t};\n"
+         << "\tstruct Val temp, temp2;\n";
+
+    for (std::size_t i = 0; i < num_slots; i++) {
+        file << (i == 0 ? "\tstruct Val " : ", ") << slot(i)
+             << (i + 1 == num_slots ? ";\n" : "");
+    }
+
+    if (is_new_scope) {
+        file << "\tenter_scope(this, local_vars);\n";
+    }
+
+    file << body.str();
 }
 
-// Outputs all of the functions necessary for implementing the all of
-// the Glass classes' methods
-void output_functions(std::ofstream &file,
-                      const ClassMap &classes,
-                      const std::unordered_set<std::string> &global_vars,
-                      const std::unordered_set<std::string> &class_vars,
-                      const std::unordered_set<std::string> &func_vars,
-                      const std::unordered_map<std::string, int> &str_indices)
+// Outputs the functions implementing the methods of each class, returning the
+// source code for each class separately. The classes are translated in
+// parallel, in the order given
+std::vector<std::string> output_functions(const ClassMap &classes,
+                                          const std::vector<std::string> &class_names,
+                                          const std::unordered_set<std::string> &class_vars,
+                                          const std::unordered_set<std::string> &func_vars,
+                                          const std::unordered_map<std::string, int> &str_indices)
 {
-    for (auto &[class_name, class_info]: classes) {
-        if (not global_vars.count(class_name)) {
-            continue;
-        }
-        for (auto &[func_name, commands]: class_info.get_functions()) {
-            if (not class_vars.count(func_name) and not func_vars.count(func_name)
-                and not (class_name == "M" and func_name == "m"))
-            {
+    ClassInference inference{classes};
+    std::vector<std::string> sources(class_names.size());
+
+    parallel_for(class_names.size(), [&] (std::size_t i) {
+        const auto &class_name = class_names[i];
+        std::ostringstream file;
+        for (auto &[func_name, commands]: classes.at(class_name).get_functions()) {
+            if (not is_method_used(class_name, func_name, class_vars, func_vars)) {
                 continue;
             }
             file << "\nvoid " << mangle_func_name(class_name, func_name)
                  << "(size_t this) {\n";
 
-            output_commands(file, commands, str_indices);
+            output_commands(file, *commands, classes,
+                            inference.get_scope(class_name, *commands),
+                            str_indices);
             file << "}\n";
         }
-    }
+        sources[i] = file.str();
+    });
+
+    return sources;
 }
 
 // Outputs the main function, used to start the program
-void output_main_func(std::ofstream &file) {
+void output_main_func(std::ostream &file) {
     file << "\nint main() {\n"
          << "\tsize_t main_obj;\n"
          << "\tinit();\n"
+         << "\tinit_strings();\n"
          << "\tatexit(cleanup);\n"
          << "\tmain_obj = new_C_M();\n"
          << "\tF1M1m(main_obj);\n"
@@ -1090,16 +1626,19 @@ void output_main_func(std::ofstream &file) {
          << "}\n";
 }
 
-// Compiles the given classes to ANSI C.
-// Returns whether there was some error during compilation
-bool compile_classes(const ClassMap &classes, const std::string &file_name)
-{
-    std::ofstream file{file_name};
-    if (not file.is_open()) {
-        std::cerr << "Error! Unable to open \"" << file_name << "\"!\n";
-        return true;
-    }
+// Everything needed to output a compiled program
+struct CompiledProgram {
+    std::unordered_set<std::string> global_vars, class_vars, func_vars, local_vars;
+    std::unordered_map<std::string, int> str_indices;
 
+    // The classes that are compiled, along with the source code of their
+    // methods
+    std::vector<std::string> class_names, class_sources;
+};
+
+// Translates all of the classes to C
+CompiledProgram compile_program(const ClassMap &classes) {
+    CompiledProgram program;
     auto [global_vars, class_vars, func_vars, local_vars] = get_names(classes);
 
     // Make sure that the main class is included in the output source
@@ -1118,17 +1657,134 @@ bool compile_classes(const ClassMap &classes, const std::string &file_name)
         func_vars.insert("c__");
     }
 
-    output_name_enums(file, global_vars, class_vars, func_vars, local_vars);
+    // The factory functions run the inherited constructors, so they have to
+    // be compiled even if they're never called by name
+    for (auto &class_info: classes) {
+        for (auto &ctor_name: class_info.second.get_parent_ctors()) {
+            if (class_vars.count(ctor_name) == 0) {
+                func_vars.insert(ctor_name);
+            }
+        }
+    }
+
+    for (auto &class_info: classes) {
+        if (global_vars.count(class_info.first)) {
+            program.class_names.push_back(class_info.first);
+        }
+    }
+
+    program.str_indices = get_str_indices(classes);
+    program.class_sources = output_functions(classes, program.class_names,
+                                             class_vars, func_vars,
+                                             program.str_indices);
+    program.global_vars = std::move(global_vars);
+    program.class_vars = std::move(class_vars);
+    program.func_vars = std::move(func_vars);
+    program.local_vars = std::move(local_vars);
+    return program;
+}
+
+// Outputs the declarations shared by all of the compiled code
+void output_header(std::ostream &file, const ClassMap &classes,
+                   const CompiledProgram &program)
+{
+    output_name_enums(file, program.global_vars, program.class_vars,
+                      program.func_vars, program.local_vars);
 
     for (auto &line: COMPILED_CODE_DEFS) {
         file << line << "\n";
     }
 
-    auto str_indices = output_strings(file, classes);
+    output_str_decls(file, program.str_indices);
+    output_class_decls(file, classes, program.global_vars, program.class_vars,
+                       program.func_vars);
+}
 
-    output_class_defs(file, classes, global_vars, class_vars, func_vars);
-    output_functions(file, classes, global_vars, class_vars, func_vars, str_indices);
+// Outputs the definitions that aren't part of any class's methods
+void output_main_defs(std::ostream &file, const ClassMap &classes,
+                      const CompiledProgram &program)
+{
+    output_str_init(file, program.str_indices);
+    output_class_defs(file, classes, program.global_vars, program.class_vars,
+                      program.func_vars);
     output_main_func(file);
+}
 
+// Compiles the given classes to ANSI C, outputting the program to the stream
+void output_program(std::ostream &file, const ClassMap &classes) {
+    auto program = compile_program(classes);
+
+    output_header(file, classes, program);
+    output_main_defs(file, classes, program);
+    for (auto &source: program.class_sources) {
+        file << source;
+    }
+}
+
+// Compiles the given classes to ANSI C.
+// Returns whether there was some error during compilation
+bool compile_classes(const ClassMap &classes, const std::string &file_name)
+{
+    std::ofstream file{file_name};
+    if (not file.is_open()) {
+        std::cerr << "Error! Unable to open \"" << file_name << "\"!\n";
+        return true;
+    }
+
+    output_program(file, classes);
     return false;
 }
+
+// Compiles the given classes to ANSI C, split up across several files in the
+// given directory, so that they can be compiled in parallel. The directory
+// gets a header, program.h, that's shared by the other files, main.c, which
+// has the definitions used by the whole program, and a file for each class
+// with its methods. The class files are written in parallel.
+// Returns whether there was some error during compilation
+bool compile_classes_split(const ClassMap &classes, const std::string &dir_name)
+{
+    std::error_code err;
+    std::filesystem::create_directories(dir_name, err);
+    if (err) {
+        std::cerr << "Error! Unable to create directory \"" << dir_name
+                  << "\"!\n";
+        return true;
+    }
+
+    auto program = compile_program(classes);
+    auto dir = std::filesystem::path{dir_name};
+
+    std::vector<std::string> file_names {"program.h", "main.c"};
+    for (auto &class_name: program.class_names) {
+        file_names.push_back("C_" + class_name + ".c");
+    }
+
+    std::atomic<bool> failed{false};
+    parallel_for(file_names.size(), [&] (std::size_t i) {
+        auto path = (dir / file_names[i]).string();
+        std::ofstream file{path};
+        if (not file.is_open()) {
+            static std::mutex error_mutex;
+            std::lock_guard lock{error_mutex};
+            std::cerr << "Error! Unable to open \"" << path << "\"!\n";
+            failed = true;
+            return;
+        }
+
+        if (i == 0) {
+            file << "#ifndef GLASS_PROGRAM_H\n"
+                 << "#define GLASS_PROGRAM_H\n\n";
+            output_header(file, classes, program);
+            file << "\n#endif\n";
+        } else if (i == 1) {
+            file << "#include \"program.h\"\n";
+            output_main_defs(file, classes, program);
+        } else {
+            file << "#define GLOBAL extern\n"
+                 << "#include \"program.h\"\n"
+                 << program.class_sources[i - 2];
+        }
+    });
+
+    return failed;
+}
@@ -0,0 +1,94 @@
+#include "escape.hpp"
+
+#include <string>
+#include <unordered_set>
+
+// Returns the local variables in a method whose values are used by the
+// method. Calls that are resolved to builtins don't use their receivers
+std::unordered_set<std::string> get_used_locals(const CommandList &commands) {
+    std::unordered_set<std::string> used;
+    for (const auto &command: commands) {
+        switch (command.get_type()) {
+            case CommandType::PushName:
+            case CommandType::LoadVar:
+                used.insert(command.get_string());
+                break;
+
+            case CommandType::LoopBegin:
+            case CommandType::LoopEnd:
+                used.insert(command.get_loop_var());
+                break;
+
+            case CommandType::FuncCall:
+                if (not command.get_resolved_builtin()) {
+                    used.insert(command.get_first_name());
+                }
+                break;
+
+            case CommandType::LoadField:
+                used.insert(command.get_first_name());
+                break;
+
+            case CommandType::CopyVar:
+                used.insert(command.get_second_name());
+                break;
+
+            case CommandType::AssignClass:
+            case CommandType::AssignSelf:
+            case CommandType::AssignValue:
+            case CommandType::DupElement:
+            case CommandType::ExecuteFunc:
+            case CommandType::GetFunction:
+            case CommandType::GetValue:
+            case CommandType::PopStack:
+            case CommandType::PushNumber:
+            case CommandType::PushString:
+            case CommandType::Return:
+            case CommandType::BuiltinFunction:
+            case CommandType::AssignTo:
+            case CommandType::NewInst:
+            case CommandType::StoreNumber:
+            case CommandType::StoreString:
+            case CommandType::StoreSelf:
+            case CommandType::Nop:
+                break;
+        }
+    }
+    return used;
+}
+
+// Removes the creation of instances that never escape the method creating
+// them, and that the method never uses either. This happens when an instance
+// of a builtin class is only used to call builtins, once the calls have been
+// resolved. Since nothing can ever reach these instances, and creating them
+// doesn't run any code, they don't need to be allocated at all
+void remove_unused_instances(ClassMap &classes, OptStats *stats) {
+    for (auto &[class_name, class_info]: classes) {
+        for (const auto &func_info: class_info.get_functions()) {
+            auto &commands = class_info.get_function(func_info.first);
+            auto used = get_used_locals(commands);
+            bool removed = false;
+            for (auto &command: commands) {
+                if (command.get_type() != CommandType::NewInst) {
+                    continue;
+                }
+                const auto &name = command.get_first_name();
+                auto new_class = classes.find(command.get_second_name());
+                if (name[0] != '_' or used.count(name) or
+                    new_class == classes.end() or
+                    new_class->second.has_constructor())
+                {
+                    continue;
+                }
+                command = {CommandType::Nop, "", 0, 0};
+                removed = true;
+                if (stats) {
+                    (*stats)["remove-instance"]++;
+                }
+            }
+            if (removed) {
+                remove_nops(commands);
+            }
+        }
+    }
+}
@@ -0,0 +1,435 @@
+#include "analysis.hpp"
+#include "builtins.hpp"
+#include "folding.hpp"
+#include "variable.hpp"
+
+#include <cmath>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// The builtins that can be evaluated while optimizing. These builtins only
+// depend on their arguments, and can't fail when given the right types
+const std::unordered_set<Builtin> FOLDABLE_BUILTINS {
+    Builtin::MathAdd,
+    Builtin::MathSub,
+    Builtin::MathMult,
+    Builtin::MathDiv,
+    Builtin::MathMod,
+    Builtin::MathFloor,
+    Builtin::MathEqual,
+    Builtin::MathNotEqual,
+    Builtin::MathLessThan,
+    Builtin::MathLessOrEqual,
+    Builtin::MathGreaterThan,
+    Builtin::MathGreaterOrEqual,
+    Builtin::StrLength,
+    Builtin::StrIndex,
+    Builtin::StrConcatenate,
+    Builtin::StrSplit,
+    Builtin::StrEqual,
+    Builtin::StrNumtoChar,
+    Builtin::StrChartoNum,
+};
+
+// A value on the stack while looking for constants
+struct StackValue {
+    // The value, if it's known to be constant
+    std::optional<Variable> constant;
+
+    // The value, if it's a name that's known statically
+    std::optional<std::string> name;
+
+    // The index of the command that pushed the value, if that command does
+    // nothing but push a constant or a name
+    std::optional<std::size_t> producer;
+};
+
+// Maps the names of local variables to their values, if they're constant
+using ConstantMap = std::unordered_map<std::string, Variable>;
+
+// Evaluates a builtin with constant arguments, returning the values it
+// pushes, or std::nullopt if it can't be evaluated ahead of time
+std::optional<std::vector<Variable>> evaluate_builtin(Builtin type,
+                                                      std::vector<Variable> args)
+{
+    if (not FOLDABLE_BUILTINS.count(type)) {
+        return std::nullopt;
+    }
+    auto arg_types = builtin_arg_types(type);
+    for (std::size_t i = 0; i < args.size(); i++) {
+        if (args[i].get_type() != arg_types[i]) {
+            return std::nullopt;
+        }
+    }
+    if (type == Builtin::StrChartoNum and args[0].get_string()->size() != 1) {
+        return std::nullopt;
+    }
+
+    VarMap globals;
+    if (handle_builtin(type, args, globals)) {
+        return std::nullopt;
+    }
+
+    // The results have to be representable as literals in the compiled C
+    for (const auto &result: args) {
+        auto num = result.get_number();
+        auto str = result.get_string();
+        if ((num and not std::isfinite(*num)) or
+            (str and str->find('\0') != std::string::npos))
+        {
+            return std::nullopt;
+        }
+    }
+    return args;
+}
+
+// Returns a command that pushes a constant, positioned at the given command
+Command push_constant(const Variable &value, const Command &pos) {
+    if (value.get_type() == VarType::Number) {
+        return {CommandType::PushNumber, *value.get_number(),
+                pos.get_file_name(), pos.get_line(), pos.get_col()};
+    } else {
+        return {CommandType::PushString, *value.get_string(),
+                pos.get_file_name(), pos.get_line(), pos.get_col()};
+    }
+}
+
+// Returns a command that assigns a constant to a name, positioned at the
+// given command
+Command store_constant(const std::string &name, const Variable &value,
+                       const Command &pos)
+{
+    if (value.get_type() == VarType::Number) {
+        return {CommandType::StoreNumber, name, *value.get_number(),
+                pos.get_file_name(), pos.get_line(), pos.get_col()};
+    } else {
+        return {CommandType::StoreString, name, *value.get_string(),
+                pos.get_file_name(), pos.get_line(), pos.get_col()};
+    }
+}
+
+// Folds the constants in a method, tracking the constant values on the stack
+// and in local variables. Calls of builtins with constant arguments are
+// replaced with their results, reads of constant local variables are replaced
+// with the constant, and loops whose condition is known to be false at the
+// start are removed. Removed commands are replaced with NOPs. Returns whether
+// anything was changed
+bool fold_method(CommandList &commands, const std::string &class_name,
+                 const ClassMap &classes, const NameClassMap &receivers,
+                 OptStats *stats)
+{
+    std::vector<StackValue> stack;
+    ConstantMap locals;
+    bool changed = false;
+
+    // The locals assigned within each loop that's being gone through, or
+    // std::nullopt if the loop assigns to names not known statically
+    std::vector<std::optional<std::unordered_set<std::string>>> loop_assignments;
+
+    auto call_effect = [&] (const Command &call) -> std::optional<StackEffect> {
+        auto builtin = get_called_builtin(call, classes, receivers);
+        if (not builtin) {
+            return std::nullopt;
+        }
+        return builtin_stack_effect(builtin->second);
+    };
+
+    auto applied = [&] (const std::string &name) {
+        changed = true;
+        if (stats) {
+            (*stats)[name]++;
+        }
+    };
+
+    auto pop = [&] () -> StackValue {
+        if (stack.empty()) {
+            return {};
+        }
+        auto value = std::move(stack.back());
+        stack.pop_back();
+        return value;
+    };
+
+    // Returns the value of a local variable, if it's known to be constant
+    auto get_constant = [&] (const std::string &name) -> std::optional<Variable> {
+        auto local = locals.find(name);
+        if (local == locals.end()) {
+            return std::nullopt;
+        }
+        return local->second;
+    };
+
+    // Records an assignment to a name. If the name isn't known statically,
+    // any local variable could have been assigned to
+    auto assign = [&] (const std::optional<std::string> &name,
+                       const std::optional<Variable> &value)
+    {
+        if (not name) {
+            locals.clear();
+        } else if ((*name)[0] != '_') {
+            return;
+        } else if (value) {
+            locals.insert_or_assign(*name, *value);
+        } else {
+            locals.erase(*name);
+        }
+    };
+
+    // Finds the locals that are assigned to within a loop
+    auto get_loop_assignments = [&] (std::size_t begin, std::size_t end) {
+        std::optional<std::unordered_set<std::string>> assigned{std::in_place};
+        CommandList body(commands.begin() + begin + 1, commands.begin() + end);
+        for_each_assignment(body, class_name, call_effect,
+            [&] (const auto &name, const auto &) {
+                if (not name) {
+                    assigned.reset();
+                } else if (assigned and (*name)[0] == '_') {
+                    assigned->insert(*name);
+                }
+            });
+        return assigned;
+    };
+
+    // Forgets the values of the locals assigned within a loop
+    auto forget = [&] (const std::optional<std::unordered_set<std::string>> &names) {
+        if (not names) {
+            locals.clear();
+            return;
+        }
+        for (const auto &name: *names) {
+            locals.erase(name);
+        }
+    };
+
+    // Replaces the call of a builtin at the given index with its results, if
+    // its arguments are constants pushed by the commands right before it
+    auto fold_call = [&] (std::size_t index, Builtin type, int num_args) {
+        if (stack.size() < static_cast<std::size_t>(num_args)) {
+            return false;
+        }
+
+        std::vector<std::size_t> slots;
+        std::vector<Variable> args;
+        auto pos = index;
+        for (int i = 0; i < num_args; i++) {
+            const auto &arg = stack[stack.size() - 1 - i];
+            do {
+                if (pos == 0) {
+                    return false;
+                }
+                pos--;
+            } while (commands[pos].get_type() == CommandType::Nop);
+            if (not arg.constant or arg.producer != pos) {
+                return false;
+            }
+            slots.insert(slots.begin(), pos);
+            args.insert(args.begin(), *arg.constant);
+        }
+        slots.push_back(index);
+
+        auto results = evaluate_builtin(type, args);
+        if (not results or results->size() > slots.size()) {
+            return false;
+        }
+
+        stack.resize(stack.size() - num_args);
+        for (std::size_t i = 0; i < slots.size(); i++) {
+            if (i < results->size()) {
+                commands[slots[i]] = push_constant((*results)[i], commands[index]);
+                stack.push_back({(*results)[i], std::nullopt, slots[i]});
+            } else {
+                commands[slots[i]] = {CommandType::Nop, "", 0, 0};
+            }
+        }
+        return true;
+    };
+
+    for (std::size_t i = 0; i < commands.size(); i++) {
+        const auto &command = commands[i];
+        switch (command.get_type()) {
+            case CommandType::AssignClass: {
+                pop();
+                assign(pop().name, std::nullopt);
+                stack.clear();
+                break;
+            }
+
+            case CommandType::AssignSelf:
+                assign(pop().name, std::nullopt);
+                break;
+
+            case CommandType::AssignValue: {
+                auto val = pop();
+                assign(pop().name, val.constant);
+                break;
+            }
+
+            case CommandType::DupElement: {
+                auto index = static_cast<std::size_t>(command.get_number());
+                if (index >= stack.size()) {
+                    stack.emplace_back();
+                    break;
+                }
+                auto copy = stack[stack.size() - index - 1];
+                copy.producer.reset();
+                stack.push_back(std::move(copy));
+                break;
+            }
+
+            case CommandType::GetFunction:
+                pop();
+                pop();
+                stack.emplace_back();
+                break;
+
+            case CommandType::GetValue:
+                pop();
+                stack.emplace_back();
+                break;
+
+            // A loop that isn't entered can be removed entirely. Otherwise,
+            // whatever is assigned within the loop isn't known at its start
+            case CommandType::LoopBegin: {
+                auto end = command.get_jump();
+                auto condition = get_constant(command.get_loop_var());
+                if (condition and not *condition) {
+                    for (auto j = i; j <= end; j++) {
+                        commands[j] = {CommandType::Nop, "", 0, 0};
+                    }
+                    applied("remove-dead-loop");
+                    i = end;
+                    break;
+                }
+                loop_assignments.push_back(get_loop_assignments(i, end));
+                forget(loop_assignments.back());
+                stack.clear();
+                break;
+            }
+
+            // After a loop, whatever was assigned within the loop depends on
+            // how many times the loop ran
+            case CommandType::LoopEnd:
+                forget(loop_assignments.back());
+                loop_assignments.pop_back();
+                stack.clear();
+                break;
+
+            case CommandType::PopStack:
+                pop();
+                break;
+
+            case CommandType::PushName:
+                stack.push_back({std::nullopt, command.get_string(), i});
+                break;
+
+            case CommandType::PushNumber:
+                stack.push_back({command.get_number(), std::nullopt, i});
+                break;
+
+            case CommandType::PushString:
+                stack.push_back({Variable{VarType::String, command.get_string()},
+                                 std::nullopt, i});
+                break;
+
+            case CommandType::Return:
+            case CommandType::BuiltinFunction:
+            case CommandType::ExecuteFunc:
+                stack.clear();
+                break;
+
+            case CommandType::AssignTo:
+                assign(command.get_string(), pop().constant);
+                break;
+
+            case CommandType::FuncCall: {
+                auto builtin = get_called_builtin(command, classes, receivers);
+                if (not builtin) {
+                    stack.clear();
+                    break;
+                }
+                auto [num_args, num_results] = builtin_stack_effect(builtin->second);
+                if (fold_call(i, builtin->second, num_args)) {
+                    applied("fold-builtin");
+                    break;
+                }
+                for (int j = 0; j < num_args; j++) {
+                    pop();
+                }
+                for (int j = 0; j < num_results; j++) {
+                    stack.emplace_back();
+                }
+                break;
+            }
+
+            case CommandType::NewInst:
+                assign(command.get_first_name(), std::nullopt);
+                stack.clear();
+                break;
+
+            case CommandType::LoadVar: {
+                auto value = get_constant(command.get_string());
+                if (not value) {
+                    stack.emplace_back();
+                    break;
+                }
+                commands[i] = push_constant(*value, command);
+                applied("propagate-constant");
+                stack.push_back({value, std::nullopt, i});
+                break;
+            }
+
+            case CommandType::StoreNumber:
+                assign(command.get_first_name(), command.get_number());
+                break;
+
+            case CommandType::StoreString:
+                assign(command.get_first_name(),
+                       Variable{VarType::String, command.get_second_name()});
+                break;
+
+            case CommandType::CopyVar: {
+                auto value = get_constant(command.get_second_name());
+                auto name = command.get_first_name();
+                if (value) {
+                    commands[i] = store_constant(name, *value, command);
+                    applied("propagate-constant");
+                }
+                assign(name, value);
+                break;
+            }
+
+            case CommandType::StoreSelf:
+                assign(command.get_string(), std::nullopt);
+                break;
+
+            case CommandType::LoadField:
+                stack.emplace_back();
+                break;
+
+            case CommandType::Nop:
+                break;
+        }
+    }
+
+    return changed;
+}
+
+// Folds the constants in every method of the program, returning whether
+// anything was changed
+bool fold_constants(ClassMap &classes, OptStats *stats) {
+    ClassInference inference{classes};
+    bool changed = false;
+    for (auto &[class_name, class_info]: classes) {
+        for (auto &func_info: class_info.get_functions()) {
+            auto &commands = class_info.get_function(func_info.first);
+            auto receivers = inference.get_scope(class_name, commands);
+            if (fold_method(commands, class_name, classes, receivers, stats)) {
+                remove_nops(commands);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
@@ -3,6 +3,11 @@
 #include "function.hpp"
 #include "instance.hpp"
 #include "instanceManager.hpp"
+#include "jit.hpp"
+#include "opcount.hpp"
+#include "profile.hpp"
+#include "regvm.hpp"
+#include "trace.hpp"
 #include "variable.hpp"
 
 #include <cassert>
@@ -10,7 +15,7 @@
 #include <cstddef>
 #include <iostream>
 
-Function::Function(CommandList &commands, const std::string &name, Instance *cur_obj):
+Function::Function(const CommandList &commands, const std::string &name, Instance *cur_obj):
 commands(&commands), cur_obj(cur_obj), method_name(name) {
 }
 
@@ -18,6 +23,16 @@ Instance *Function::get_obj() const {
     return cur_obj;
 }
 
+// If the function is implemented by a builtin, returns the builtin
+std::optional<Builtin> Function::get_builtin() const {
+    if (commands->size() != 1 or
+        commands->front().get_type() != CommandType::BuiltinFunction)
+    {
+        return std::nullopt;
+    }
+    return commands->front().get_builtin();
+}
+
 // If the array with the instances is moved, this function updates the Instance
 // pointer in the function to be in the right position
 void Function::move_instance(Instance *old_insts, Instance *new_insts) {
@@ -25,317 +40,590 @@ void Function::move_instance(Instance *old_insts, Instance *new_insts) {
     cur_obj = &new_insts[index];
 }
 
+// Returns the local variable with the given slot, looking it up the first time
+// and creating it if asked to, or nullptr if it isn't defined
+Variable *Frame::get_slot(const std::string &name, std::size_t slot,
+                          bool create)
+{
+    auto &var = slots[slot];
+    if (var) {
+        return var;
+    }
+    auto found = locals.find(name);
+    if (found != locals.end()) {
+        var = &found->second;
+    } else if (create) {
+        var = &locals.emplace(name, 0.0).first->second;
+    }
+    return var;
+}
+
+// Gets the value of a name from the proper context
+std::optional<Variable> Function::get_val(const Frame &frame,
+                                          const std::string &name) const
+{
+    try {
+        if (name[0] == '_') {
+            if (frame.registers) {
+                auto found = frame.local_registers->find(name);
+                if (found != frame.local_registers->end()) {
+                    return (*frame.registers)[found->second];
+                }
+            }
+            return frame.locals.at(name);
+        } else if (std::islower(name[0])) {
+            return cur_obj->get_var(name);
+        } else {
+            return frame.globals.at(name);
+        }
+    } catch (const std::out_of_range &e) {
+        return std::nullopt;
+    }
+}
+
+// Sets the value of a name in the proper context
+void Function::set_val(Frame &frame, const std::string &name, Variable var) {
+    if (name[0] == '_') {
+        if (frame.registers) {
+            auto found = frame.local_registers->find(name);
+            if (found != frame.local_registers->end()) {
+                (*frame.registers)[found->second] = var;
+                return;
+            }
+        }
+        frame.locals.insert_or_assign(name, var);
+    } else if (std::islower(name[0])) {
+        cur_obj->set_var(name, var);
+    } else {
+        frame.globals.insert_or_assign(name, var);
+    }
+}
+
 // Executes a function, given references to the classes, stack and global
 // variables. Returns whether there was an error of some sort
 bool Function::execute(InstanceManager &manager, ClassMap &classes,
                        std::vector<Variable> &stack, VarMap &globals)
+{
+    auto profiler = manager.get_profiler();
+    if (not profiler) {
+        return run(manager, classes, stack, globals);
+    }
+
+    // The profiler's stack is left as it is after an error, so that the
+    // sample that's due belongs to where the program stopped
+    profiler->enter_function(*commands, cur_obj->get_class(), method_name);
+    if (run(manager, classes, stack, globals)) {
+        return true;
+    }
+    profiler->leave_function();
+    return false;
+}
+
+// Runs the function with whichever engine is enabled. Returns whether there
+// was an error of some sort
+bool Function::run(InstanceManager &manager, ClassMap &classes,
+                   std::vector<Variable> &stack, VarMap &globals)
 {
     VarMap locals;
+    Frame frame{manager, classes, stack, globals, locals};
+
+    // The register engine runs the whole function itself, apart from a
+    // builtin, which has nothing to lower
+    auto register_vm = manager.get_register_vm();
+    if (register_vm and not get_builtin()) {
+        return register_vm->run(*commands, this, frame);
+    }
+
     manager.new_scope(this, &locals);
 
-    // Gets the value of a name from the proper context
-    auto get_val = [&] (const std::string &name) -> std::optional<Variable> {
-        try {
-            if (name[0] == '_') {
-                return locals.at(name);
-            } else if (std::islower(name[0])) {
-                return cur_obj->get_var(name);
-            } else {
-                return globals.at(name);
-            }
-        } catch (const std::out_of_range &e) {
-            return std::nullopt;
+    // If the function has been compiled to native code, that runs first, and
+    // the interpreter carries on from wherever it stopped. A builtin has
+    // nothing to gain from it
+    std::size_t start = 0;
+    auto jit = manager.get_jit();
+    if (jit and not get_builtin()) {
+        auto status = jit->run(*commands, this, frame);
+        if (status == JitStatus::Error) {
+            return true;
+        } else if (status == JitStatus::Return) {
+            manager.unwind_scope();
+            return false;
         }
-    };
+        start = frame.resume;
+    }
 
-    // Sets the value of a name in the proper context
-    auto set_val = [&] (const std::string &name, Variable var) {
-        if (name[0] == '_') {
-            locals.insert_or_assign(name, var);
-        } else if (std::islower(name[0])) {
-            cur_obj->set_var(name, var);
-        } else {
-            globals.insert_or_assign(name, var);
+    if (manager.get_op_counter()) {
+        return interpret<true>(frame, start);
+    }
+    return interpret<false>(frame, start);
+}
+
+// Interprets the function's commands from the given position until it returns,
+// unwinding its scope if there wasn't an error. Loops that go around often
+// enough are handed to the tracer, if there is one, and it can carry on with
+// them from wherever it likes. The commands are counted if count_ops is true,
+// which is a template parameter so that the loop has no trace of the counting
+// otherwise. Returns whether there was an error of some sort
+template <bool count_ops>
+bool Function::interpret(Frame &frame, std::size_t start) {
+    auto tracer = frame.manager.get_tracer();
+    if (tracer) {
+        tracer->enter_function();
+    }
+    auto profiler = frame.manager.get_profiler();
+
+    // The types of the last two commands run in a sequence without jumps,
+    // where Nop stands for there not being one
+    [[maybe_unused]] auto counter = frame.manager.get_op_counter();
+    [[maybe_unused]] auto previous = CommandType::Nop;
+    [[maybe_unused]] auto before_previous = CommandType::Nop;
+
+    for (std::size_t i = start; i < commands->size(); i++) {
+        const auto &command = (*commands)[i];
+        if (profiler) {
+            profiler->at(command);
         }
-    };
-
-    for (std::size_t i = 0; i < commands->size(); i++) {
-        const auto &command = commands->at(i);
-        switch (command.get_type()) {
-            case CommandType::AssignClass: {
-                auto cname = pop_stack(stack);
-                auto name = pop_stack(stack);
-                if (not name) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
-                }
-                auto name_str = name->get_name();
-                auto cname_str = cname->get_name();
-                if (not name_str) {
-                    runtime_error(command, "Cannot assign to non-name.");
-                    return true;
-                } else if (not cname_str) {
-                    runtime_error(command,
-                                  "Cannot create instance of non-name.");
-                    return true;
-                }
-                if (not classes.count(*cname_str)) {
-                    runtime_error(command, "Cannot instantiate non-class \""
-                                           + *cname_str + "\".");
-                    return true;
-                }
-                auto new_inst = manager.new_instance(classes.at(*cname_str));
-                set_val(*name_str, new_inst);
-                auto ctor = new_inst->get_func("c__");
-                if (ctor and ctor->execute(manager, classes, stack, globals)) {
-                    output_stack_trace_line(command.get_file_name(),
-                                            command.get_line(),
-                                            command.get_col());
-                    return true;
-                }
+        if constexpr (count_ops) {
+            counter->record(command, before_previous, previous);
+            before_previous = previous;
+            previous = command.get_type();
+        }
+        if (tracer and tracer->is_recording()) {
+            tracer->record(this, i, frame);
+        }
+        switch (run_command(command, i, frame)) {
+            case CommandResult::Next:
                 break;
-            }
 
-            case CommandType::AssignSelf: {
-                auto name = pop_stack(stack);
-                if (not name) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
+            case CommandResult::Jump:
+                if constexpr (count_ops) {
+                    previous = CommandType::Nop;
+                    before_previous = CommandType::Nop;
                 }
-                auto name_str = name->get_name();
-                if (not name_str) {
-                    runtime_error(command, "Cannot assign to non-name.");
+                if (tracer and command.get_type() == CommandType::LoopEnd
+                    and tracer->loop_back(this, command, i, frame))
+                {
+                    tracer->leave_function(true);
                     return true;
-                } else {
-                    set_val(*name_str, {cur_obj});
                 }
                 break;
-            }
 
-            case CommandType::AssignValue: {
-                auto val = pop_stack(stack);
-                auto name = pop_stack(stack);
-                if (not name) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
+            case CommandResult::Return:
+                if (tracer) {
+                    tracer->leave_function(false);
                 }
-                auto name_str = name->get_name();
-                if (not name_str) {
-                    runtime_error(command, "Cannot assign to non-name.");
-                    return true;
-                } else {
-                    set_val(*name_str, *val);
+                frame.manager.unwind_scope();
+                return false;
+
+            case CommandResult::Error:
+                if (tracer) {
+                    tracer->leave_function(true);
                 }
-                break;
+                return true;
+        }
+    }
+
+    if (tracer) {
+        tracer->leave_function(false);
+    }
+    frame.manager.unwind_scope();
+    return false;
+}
+
+template bool Function::interpret<false>(Frame &frame, std::size_t start);
+template bool Function::interpret<true>(Frame &frame, std::size_t start);
+
+// Runs a single command of the function, where i is the command's position.
+// Loop commands that jump set i to the position of their matching command
+CommandResult Function::run_command(const Command &command, std::size_t &i,
+                                    Frame &frame)
+{
+    auto &manager = frame.manager;
+    auto &classes = frame.classes;
+    auto &stack = frame.stack;
+    auto &globals = frame.globals;
+    auto &locals = frame.locals;
+
+    switch (command.get_type()) {
+        case CommandType::AssignClass: {
+            auto cname = pop_stack(stack);
+            auto name = pop_stack(stack);
+            if (not name) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            auto name_str = name->get_name();
+            auto cname_str = cname->get_name();
+            if (not name_str) {
+                runtime_error(command, "Cannot assign to non-name.");
+                return CommandResult::Error;
+            } else if (not cname_str) {
+                runtime_error(command,
+                              "Cannot create instance of non-name.");
+                return CommandResult::Error;
+            }
+            if (not classes.count(*cname_str)) {
+                runtime_error(command, "Cannot instantiate non-class \""
+                                       + *cname_str + "\".");
+                return CommandResult::Error;
+            }
+            auto new_inst = manager.new_instance(classes.at(*cname_str));
+            set_val(frame, *name_str, new_inst);
+            if (run_constructors(new_inst, manager, classes, stack,
+                                 globals))
+            {
+                output_stack_trace_line(command.get_file_name(),
+                                        command.get_line(),
+                                        command.get_col());
+                return CommandResult::Error;
             }
+            break;
+        }
 
-            case CommandType::DupElement: {
-                auto dup = static_cast<std::size_t>(command.get_number());
-                if (dup >= stack.size()) {
-                    runtime_error(command,
-                                  "Cannot duplicate out-of-range stack value.");
-                    return true;
-                }
-                stack.push_back(stack[stack.size() - dup - 1]);
-                break;
+        case CommandType::AssignSelf: {
+            auto name = pop_stack(stack);
+            if (not name) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            auto name_str = name->get_name();
+            if (not name_str) {
+                runtime_error(command, "Cannot assign to non-name.");
+                return CommandResult::Error;
+            } else {
+                set_val(frame, *name_str, {cur_obj});
             }
+            break;
+        }
 
-            case CommandType::ExecuteFunc: {
-                auto func = pop_stack(stack);
-                if (not func) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
-                }
-                auto to_run = func->get_function();
-                if (not to_run) {
-                    runtime_error(command, "Cannot execute a non-function.");
-                    return true;
-                }
-                if (to_run->execute(manager, classes, stack, globals)) {
-                    output_stack_trace_line(command.get_file_name(),
-                                            command.get_line(),
-                                            command.get_col());
-                    return true;
-                }
-                break;
+        case CommandType::AssignValue: {
+            auto val = pop_stack(stack);
+            auto name = pop_stack(stack);
+            if (not name) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
             }
+            auto name_str = name->get_name();
+            if (not name_str) {
+                runtime_error(command, "Cannot assign to non-name.");
+                return CommandResult::Error;
+            } else {
+                set_val(frame, *name_str, *val);
+            }
+            break;
+        }
 
-            case CommandType::GetFunction: {
-                auto fname = pop_stack(stack);
-                auto oname = pop_stack(stack);
-                if (not oname) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
-                }
-                auto fname_str = fname->get_name();
-                auto oname_str = oname->get_name();
-                if (not fname_str or not oname_str) {
-                    runtime_error(command,
-                                  "Cannot retrieve value of a non-name.");
-                    return true;
-                }
-                auto obj_var = get_val(*oname_str);
-                if (not obj_var) {
-                    runtime_error(command, "\"" + *oname_str
-                                           + "\" is not defined.");
-                    return true;
-                }
-                auto object = obj_var->get_instance();
-                if (not object) {
-                    runtime_error(command,
-                                  "Cannot retrieve function from non-instance.");
-                    return true;
-                }
-                auto func = (*object)->get_func(*fname_str);
-                if (not func) {
-                    runtime_error(command, *oname_str + " has no function "
-                                           + *fname_str + ".");
-                    return true;
-                }
-                stack.emplace_back(*func);
-                break;
+        case CommandType::DupElement: {
+            auto dup = static_cast<std::size_t>(command.get_number());
+            if (dup >= stack.size()) {
+                runtime_error(command,
+                              "Cannot duplicate out-of-range stack value.");
+                return CommandResult::Error;
             }
+            stack.push_back(stack[stack.size() - dup - 1]);
+            break;
+        }
 
-            case CommandType::GetValue: {
-                auto name = pop_stack(stack);
-                if (not name) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
-                }
-                auto name_str = name->get_name();
-                if (not name_str) {
-                    runtime_error(command, "Cannot retrieve value of non-name.");
-                    return true;
-                }
-                auto val = get_val(*name_str);
-                if (not val) {
-                    runtime_error(command, "\"" + *name_str + "\" is not defined.");
-                    return true;
-                }
-                stack.push_back(*val);
-                break;
+        case CommandType::ExecuteFunc: {
+            auto func = pop_stack(stack);
+            if (not func) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            auto to_run = func->get_function();
+            if (not to_run) {
+                runtime_error(command, "Cannot execute a non-function.");
+                return CommandResult::Error;
             }
+            if (to_run->execute(manager, classes, stack, globals)) {
+                output_stack_trace_line(command.get_file_name(),
+                                        command.get_line(),
+                                        command.get_col());
+                return CommandResult::Error;
+            }
+            break;
+        }
 
-            case CommandType::LoopBegin: {
-                auto val = get_val(command.get_loop_var());
-                if (not val) {
-                    runtime_error(command, "\"" + command.get_string()
-                                           + "\" is not defined.");
-                    return true;
-                } else if (not *val) {
-                    i = command.get_jump();
-                }
-                break;
+        case CommandType::GetFunction: {
+            auto fname = pop_stack(stack);
+            auto oname = pop_stack(stack);
+            if (not oname) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            auto fname_str = fname->get_name();
+            auto oname_str = oname->get_name();
+            if (not fname_str or not oname_str) {
+                runtime_error(command,
+                              "Cannot retrieve value of a non-name.");
+                return CommandResult::Error;
+            }
+            auto obj_var = get_val(frame, *oname_str);
+            if (not obj_var) {
+                runtime_error(command, "\"" + *oname_str
+                                       + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            auto object = obj_var->get_instance();
+            if (not object) {
+                runtime_error(command,
+                              "Cannot retrieve function from non-instance.");
+                return CommandResult::Error;
             }
+            auto func = (*object)->get_func(*fname_str);
+            if (not func) {
+                runtime_error(command, *oname_str + " has no function "
+                                       + *fname_str + ".");
+                return CommandResult::Error;
+            }
+            stack.emplace_back(*func);
+            break;
+        }
+
+        case CommandType::GetValue: {
+            auto name = pop_stack(stack);
+            if (not name) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            auto name_str = name->get_name();
+            if (not name_str) {
+                runtime_error(command, "Cannot retrieve value of non-name.");
+                return CommandResult::Error;
+            }
+            auto val = get_val(frame, *name_str);
+            if (not val) {
+                runtime_error(command, "\"" + *name_str + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            stack.push_back(*val);
+            break;
+        }
 
-            case CommandType::LoopEnd: {
-                auto val = get_val(command.get_loop_var());
-                // We don't need to check if this variable is defined, because
-                // the matching LoopBegin command would've failed if it wasn't
-                if (*val) {
+        // Loop variables proven to be numbers are tested directly
+        case CommandType::LoopBegin: {
+            if (command.is_unchecked()) {
+                if (*locals.at(command.get_loop_var()).get_number() == 0.0) {
                     i = command.get_jump();
+                    return CommandResult::Jump;
                 }
                 break;
             }
+            auto val = get_val(frame, command.get_loop_var());
+            if (not val) {
+                runtime_error(command, "\"" + command.get_string()
+                                       + "\" is not defined.");
+                return CommandResult::Error;
+            } else if (not *val) {
+                i = command.get_jump();
+                return CommandResult::Jump;
+            }
+            break;
+        }
 
-            case CommandType::PopStack:
-                if (not pop_stack(stack)) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
+        case CommandType::LoopEnd: {
+            if (command.is_unchecked()) {
+                if (*locals.at(command.get_loop_var()).get_number() != 0.0) {
+                    i = command.get_jump();
+                    return CommandResult::Jump;
                 }
                 break;
+            }
+            auto val = get_val(frame, command.get_loop_var());
+            // We don't need to check if this variable is defined, because
+            // the matching LoopBegin command would've failed if it wasn't
+            if (*val) {
+                i = command.get_jump();
+                return CommandResult::Jump;
+            }
+            break;
+        }
 
-            case CommandType::PushName:
-                stack.emplace_back(VarType::Name, command.get_string());
-                break;
+        case CommandType::PopStack:
+            if (not pop_stack(stack)) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            break;
 
-            case CommandType::PushNumber:
-                stack.emplace_back(command.get_number());
-                break;
+        case CommandType::PushName:
+            stack.emplace_back(VarType::Name, command.get_string());
+            break;
 
-            case CommandType::PushString:
-                stack.emplace_back(VarType::String, command.get_string());
-                break;
+        case CommandType::PushNumber:
+            stack.emplace_back(command.get_number());
+            break;
 
-            case CommandType::Return:
-                manager.unwind_scope();
-                return false;
+        case CommandType::PushString:
+            stack.emplace_back(VarType::String, command.get_string());
+            break;
 
-            case CommandType::BuiltinFunction:
-                if (handle_builtin(command.get_builtin(), stack, globals)) {
-                    std::cerr << "Stack trace:\n";
-                    return true;
-                }
-                break;
+        case CommandType::Return:
+            return CommandResult::Return;
 
-            case CommandType::AssignTo: {
-                auto val = pop_stack(stack);
-                if (not val) {
-                    runtime_error(command, "Attempted to pop empty stack.");
-                    return true;
-                }
-                set_val(command.get_string(), *val);
-                break;
+        case CommandType::BuiltinFunction:
+            if (handle_builtin(command.get_builtin(), stack, globals)) {
+                std::cerr << "Stack trace:\n";
+                return CommandResult::Error;
             }
+            break;
 
-            case CommandType::FuncCall: {
-                auto oname = command.get_first_name();
-                auto fname = command.get_second_name();
+        case CommandType::AssignTo: {
+            auto val = pop_stack(stack);
+            if (not val) {
+                runtime_error(command, "Attempted to pop empty stack.");
+                return CommandResult::Error;
+            }
+            set_val(frame, command.get_string(), *val);
+            break;
+        }
 
-                auto obj_var = get_val(oname);
-                if (not obj_var) {
-                    runtime_error(command, "\"" + oname + "\" is not defined.");
-                    return true;
-                }
-                auto object = obj_var->get_instance();
-                if (not object) {
-                    runtime_error(command,
-                                  "Cannot retrieve function from non-instance.");
-                    return true;
-                }
-                auto func = (*object)->get_func(fname);
-                if (not func) {
-                    runtime_error(command, oname + " has no function " + fname
-                                           + ".");
-                    return true;
-                }
-                if (func->execute(manager, classes, stack, globals)) {
+        case CommandType::FuncCall: {
+            // A builtin called on a receiver that's proven to be an
+            // instance of its class doesn't need the receiver looked up
+            auto resolved = command.get_resolved_builtin();
+            if (resolved) {
+                if (handle_builtin(*resolved, stack, globals,
+                                   not command.is_unchecked()))
+                {
+                    std::cerr << "Stack trace:\n";
                     output_stack_trace_line(command.get_file_name(),
                                             command.get_2nd_line(),
                                             command.get_2nd_col());
-                    return true;
+                    return CommandResult::Error;
                 }
                 break;
             }
 
-            case CommandType::NewInst: {
-                auto oname = command.get_first_name();
-                auto cname = command.get_second_name();
-                if (not classes.count(cname)) {
-                    runtime_error(command, "Cannot instantiate non-class "
-                                           + cname + ".");
-                    return true;
-                }
-                auto new_inst = manager.new_instance(classes.at(cname));
-                set_val(oname, new_inst);
-                auto ctor = new_inst->get_func("c__");
-                if (ctor and ctor->execute(manager, classes, stack, globals)) {
+            auto oname = command.get_first_name();
+            auto fname = command.get_second_name();
+
+            auto obj_var = get_val(frame, oname);
+            if (not obj_var) {
+                runtime_error(command, "\"" + oname + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            auto object = obj_var->get_instance();
+            if (not object) {
+                runtime_error(command,
+                              "Cannot retrieve function from non-instance.");
+                return CommandResult::Error;
+            }
+            auto func = (*object)->get_func(fname);
+            if (not func) {
+                runtime_error(command, oname + " has no function " + fname
+                                       + ".");
+                return CommandResult::Error;
+            }
+
+            // A builtin whose arguments are proven to have the right
+            // types can be run directly, without checking them
+            auto builtin = command.is_unchecked() ? func->get_builtin()
+                                                  : std::nullopt;
+            if (builtin) {
+                if (handle_builtin(*builtin, stack, globals, false)) {
+                    std::cerr << "Stack trace:\n";
                     output_stack_trace_line(command.get_file_name(),
-                                            command.get_line(),
-                                            command.get_col());
-                    return true;
+                                            command.get_2nd_line(),
+                                            command.get_2nd_col());
+                    return CommandResult::Error;
                 }
                 break;
             }
+            if (func->execute(manager, classes, stack, globals)) {
+                output_stack_trace_line(command.get_file_name(),
+                                        command.get_2nd_line(),
+                                        command.get_2nd_col());
+                return CommandResult::Error;
+            }
+            break;
+        }
 
-            case CommandType::Nop:
-                assert(false);
-                break;
+        case CommandType::NewInst: {
+            auto oname = command.get_first_name();
+            auto cname = command.get_second_name();
+            if (not classes.count(cname)) {
+                runtime_error(command, "Cannot instantiate non-class "
+                                       + cname + ".");
+                return CommandResult::Error;
+            }
+            auto new_inst = manager.new_instance(classes.at(cname));
+            set_val(frame, oname, new_inst);
+            if (run_constructors(new_inst, manager, classes, stack,
+                                 globals))
+            {
+                output_stack_trace_line(command.get_file_name(),
+                                        command.get_line(),
+                                        command.get_col());
+                return CommandResult::Error;
+            }
+            break;
         }
+
+        case CommandType::LoadVar: {
+            auto val = get_val(frame, command.get_string());
+            if (not val) {
+                runtime_error(command, "\"" + command.get_string()
+                                       + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            stack.push_back(*val);
+            break;
+        }
+
+        case CommandType::StoreNumber:
+            set_val(frame, command.get_first_name(), command.get_number());
+            break;
+
+        case CommandType::StoreString:
+            set_val(frame, command.get_first_name(),
+                    {VarType::String, command.get_second_name()});
+            break;
+
+        case CommandType::CopyVar: {
+            auto val = get_val(frame, command.get_second_name());
+            if (not val) {
+                runtime_error(command, "\"" + command.get_second_name()
+                                       + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            set_val(frame, command.get_first_name(), *val);
+            break;
+        }
+
+        case CommandType::StoreSelf:
+            set_val(frame, command.get_string(), {cur_obj});
+            break;
+
+        case CommandType::LoadField: {
+            auto oname = command.get_first_name();
+            auto obj_var = get_val(frame, oname);
+            if (not obj_var) {
+                runtime_error(command, "\"" + oname + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            auto object = obj_var->get_instance();
+            if (not object) {
+                runtime_error(command,
+                              "Cannot retrieve field from non-instance.");
+                return CommandResult::Error;
+            }
+            try {
+                stack.push_back((*object)->get_var(command.get_second_name()));
+            } catch (const std::out_of_range &e) {
+                runtime_error(command, "\"" + command.get_second_name()
+                                       + "\" is not defined.");
+                return CommandResult::Error;
+            }
+            break;
+        }
+
+        case CommandType::Nop:
+            assert(false);
+            break;
     }
 
-    manager.unwind_scope();
-    return false;
+    return CommandResult::Next;
 }
 
 void Function::runtime_error(const Command &command, const std::string &err) const {
@@ -366,3 +654,28 @@ std::optional<Variable> pop_stack(std::vector<Variable> &stack) {
         return back_val;
     }
 }
+
+// Runs the constructors for a newly-created instance, first the ones it
+// inherits from its parent classes, then its own. As the instance may be moved
+// by the garbage collector while a constructor runs, each constructor is taken
+// from where the previous one left the instance. Returns whether there was an
+// error of some sort
+bool run_constructors(Instance *instance, InstanceManager &manager,
+                      ClassMap &classes, std::vector<Variable> &stack,
+                      std::unordered_map<std::string, Variable> &globals)
+{
+    const auto &parent_ctors = classes.at(instance->get_type_name())
+                                      .get_parent_ctors();
+    for (std::size_t i = 0; i <= parent_ctors.size(); i++) {
+        auto ctor = instance->get_func(i < parent_ctors.size()
+                                       ? parent_ctors[i] : "c__");
+        if (not ctor) {
+            continue;
+        }
+        if (ctor->execute(manager, classes, stack, globals)) {
+            return true;
+        }
+        instance = ctor->get_obj();
+    }
+    return false;
+}
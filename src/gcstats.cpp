@@ -0,0 +1,129 @@
+#include "gcstats.hpp"
+#include "class.hpp"
+#include "instanceManager.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+GcStats::GcStats(): start_time(std::chrono::steady_clock::now()) {
+}
+
+// Returns the number of seconds since the program started
+double GcStats::get_run_time() const {
+    std::chrono::duration<double> run_time = std::chrono::steady_clock::now()
+                                             - start_time;
+    return run_time.count();
+}
+
+// Starts logging each collection to a file, or to stderr if the file name is
+// "-". Returns whether there was an error
+bool GcStats::open_log(const std::string &file_name) {
+    if (file_name == "-") {
+        log = &std::cerr;
+        return false;
+    }
+    log_file.open(file_name);
+    if (not log_file.is_open()) {
+        return true;
+    }
+    log = &log_file;
+    return false;
+}
+
+void GcStats::record_allocation(const Class &type) {
+    allocations[&type]++;
+    total_allocations++;
+}
+
+const std::unordered_map<const Class *, std::size_t> &
+    GcStats::get_allocations() const
+{
+    return allocations;
+}
+
+// Records a collection that just finished, logging it if there's a log. Each
+// line of the log has the fields of a collection, as name=value pairs
+void GcStats::record_collection(GcCollection collection) {
+    collection.time = get_run_time() - collection.pause_time;
+    collections.push_back(collection);
+    if (not log) {
+        return;
+    }
+    *log << std::fixed << std::setprecision(6)
+         << "gc=" << collections.size()
+         << " time=" << collection.time
+         << " local_roots=" << collection.local_roots
+         << " global_roots=" << collection.global_roots
+         << " stack_roots=" << collection.stack_roots
+         << " in_use=" << collection.in_use
+         << " live=" << collection.live
+         << " reclaimed=" << collection.reclaimed
+         << " heap=" << collection.heap_size
+         << " new_heap=" << collection.new_heap_size
+         << std::setprecision(3)
+         << " mark_ms=" << collection.mark_time * 1000
+         << " sweep_ms=" << collection.sweep_time * 1000
+         << " pause_ms=" << collection.pause_time * 1000 << "\n";
+    log->flush();
+}
+
+// Outputs a summary of the collections of the run, the growth of the heap, and
+// the number of instances of each class allocated, along with the rate they
+// were allocated at
+void GcStats::output_summary(std::ostream &out) const {
+    double pause = 0.0, max_pause = 0.0, mark = 0.0, sweep = 0.0;
+    std::size_t reclaimed = 0, peak_in_use = 0;
+    std::vector<const GcCollection *> resizes;
+    for (const auto &collection: collections) {
+        pause += collection.pause_time;
+        max_pause = std::max(max_pause, collection.pause_time);
+        mark += collection.mark_time;
+        sweep += collection.sweep_time;
+        reclaimed += collection.reclaimed;
+        peak_in_use = std::max(peak_in_use, collection.in_use);
+        if (collection.new_heap_size != collection.heap_size) {
+            resizes.push_back(&collection);
+        }
+    }
+    auto run_time = get_run_time();
+    auto starting_size = static_cast<std::size_t>(NUM_STARTING_INSTANCES);
+
+    out << std::fixed << std::setprecision(3)
+        << "Garbage collections: " << collections.size() << " in "
+        << run_time << " s\n"
+        << "Pause time: " << pause * 1000 << " ms in total, "
+        << max_pause * 1000 << " ms at most, "
+        << (collections.empty() ? 0.0 : pause * 1000 / collections.size())
+        << " ms on average\n"
+        << "Marking: " << mark * 1000 << " ms, sweeping: " << sweep * 1000
+        << " ms\n"
+        << "Heap: " << starting_size << " instances at the start, "
+        << (collections.empty() ? starting_size
+                                : collections.back().new_heap_size)
+        << " at the end, most in use at a collection " << peak_in_use << "\n";
+    for (auto resize: resizes) {
+        out << "  grew from " << resize->heap_size << " to "
+            << resize->new_heap_size << " at " << resize->time
+            << " s, with " << resize->live << " live\n";
+    }
+    out << "Instances: " << total_allocations << " allocated, " << reclaimed
+        << " reclaimed, " << total_allocations - reclaimed
+        << " left at the end\n";
+
+    std::vector<std::pair<const Class *, std::size_t>> sorted{
+        allocations.begin(), allocations.end()
+    };
+    std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+        return a.second != b.second ? a.second > b.second
+                                    : a.first->get_name() < b.first->get_name();
+    });
+    out << std::left << std::setw(24) << "class" << std::right
+        << std::setw(12) << "allocated" << std::setw(16) << "per second"
+        << "\n" << std::setprecision(1);
+    for (const auto &[type, count]: sorted) {
+        out << std::left << std::setw(24) << type->get_name() << std::right
+            << std::setw(12) << count << std::setw(16)
+            << (run_time > 0.0 ? count / run_time : 0.0) << "\n";
+    }
+}
@@ -0,0 +1,397 @@
+#include "heapsnapshot.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+#if defined(__unix__)
+#define HEAP_SIGNAL_SUPPORTED 1
+#else
+#define HEAP_SIGNAL_SUPPORTED 0
+#endif
+
+// Where the signal notes that a snapshot is due. A signal handler can't be
+// given anything, so this is the one place the snapshotter can be found from it
+volatile std::sig_atomic_t *snapshot_flag = nullptr;
+
+void note_snapshot_due(int) {
+    if (snapshot_flag) {
+        *snapshot_flag = 1;
+    }
+}
+
+// Writes the snapshot to a file. Returns whether there was an error
+bool HeapSnapshot::write(const std::string &file_name) const {
+    std::ofstream file{file_name};
+    if (not file.is_open()) {
+        return true;
+    }
+
+    file << HEAP_SNAPSHOT_HEADER << "\nclasses " << class_names.size() << "\n";
+    for (std::size_t i = 0; i < class_names.size(); i++) {
+        file << class_names[i] << " " << allocations[i] << "\n";
+    }
+    file << "objects " << objects.size() << "\n";
+    for (const auto &object: objects) {
+        file << object.type << " " << object.fields << " " << object.size << " "
+             << object.references.size();
+        for (auto reference: object.references) {
+            file << " " << reference;
+        }
+        file << "\n";
+    }
+    file << "roots " << roots.size();
+    for (auto root: roots) {
+        file << " " << root;
+    }
+    file << "\n";
+    return not file.good();
+}
+
+// Reads a snapshot written to a file, or returns nothing if it couldn't be read
+// or isn't a snapshot, with an error message
+std::optional<HeapSnapshot> HeapSnapshot::read(const std::string &file_name) {
+    std::ifstream file{file_name};
+    if (not file.is_open()) {
+        std::cerr << "Error! Could not open heap snapshot \"" << file_name
+                  << "\"!\n";
+        return std::nullopt;
+    }
+
+    auto fail = [&]() {
+        std::cerr << "Error! \"" << file_name << "\" is not a valid heap"
+                  << " snapshot!\n";
+        return std::nullopt;
+    };
+    std::string header;
+    std::getline(file, header);
+    if (header != HEAP_SNAPSHOT_HEADER) {
+        return fail();
+    }
+
+    HeapSnapshot snapshot;
+    std::string word;
+    std::size_t count;
+    if (not (file >> word >> count) or word != "classes") {
+        return fail();
+    }
+    snapshot.class_names.resize(count);
+    snapshot.allocations.resize(count);
+    for (std::size_t i = 0; i < count; i++) {
+        if (not (file >> snapshot.class_names[i] >> snapshot.allocations[i])) {
+            return fail();
+        }
+    }
+
+    if (not (file >> word >> count) or word != "objects") {
+        return fail();
+    }
+    snapshot.objects.resize(count);
+    for (auto &object: snapshot.objects) {
+        std::size_t num_references;
+        if (not (file >> object.type >> object.fields >> object.size
+                      >> num_references)
+            or object.type >= snapshot.class_names.size())
+        {
+            return fail();
+        }
+        object.references.resize(num_references);
+        for (auto &reference: object.references) {
+            if (not (file >> reference) or reference >= count) {
+                return fail();
+            }
+        }
+    }
+
+    if (not (file >> word >> count) or word != "roots") {
+        return fail();
+    }
+    snapshot.roots.resize(count);
+    for (auto &root: snapshot.roots) {
+        if (not (file >> root) or root >= snapshot.objects.size()) {
+            return fail();
+        }
+    }
+    return snapshot;
+}
+
+// Returns the immediate dominator of each object, which is the object every
+// path to it from the roots goes through last, or the number of objects if
+// it's only the roots, and the order the objects were finished in by a depth
+// first search from the roots. The roots are treated as one extra object,
+// which refers to every root, and dominators are found with the iterative
+// algorithm of Cooper, Harvey and Kennedy
+std::pair<std::vector<std::size_t>, std::vector<std::size_t>>
+    get_dominators(const HeapSnapshot &snapshot)
+{
+    auto root = snapshot.objects.size();
+    auto get_references = [&](std::size_t index)
+        -> const std::vector<std::size_t> &
+    {
+        return index == root ? snapshot.roots
+                             : snapshot.objects[index].references;
+    };
+
+    // Number the objects in the order a search finishes them, without
+    // recursing, as chains of instances can be as long as the heap
+    std::vector<std::size_t> order, numbers(root + 1, SIZE_MAX);
+    std::vector<bool> seen(root + 1);
+    std::vector<std::pair<std::size_t, std::size_t>> search{{root, 0}};
+    seen[root] = true;
+    while (not search.empty()) {
+        auto &[index, next] = search.back();
+        const auto &references = get_references(index);
+        if (next < references.size()) {
+            auto reference = references[next++];
+            if (not seen[reference]) {
+                seen[reference] = true;
+                search.emplace_back(reference, 0);
+            }
+        } else {
+            numbers[index] = order.size();
+            order.push_back(index);
+            search.pop_back();
+        }
+    }
+
+    std::vector<std::vector<std::size_t>> referrers(root + 1);
+    for (auto index: order) {
+        for (auto reference: get_references(index)) {
+            referrers[reference].push_back(index);
+        }
+    }
+
+    std::vector<std::size_t> dominators(root + 1, SIZE_MAX);
+    dominators[root] = root;
+    auto intersect = [&](std::size_t a, std::size_t b) {
+        while (a != b) {
+            while (numbers[a] < numbers[b]) {
+                a = dominators[a];
+            }
+            while (numbers[b] < numbers[a]) {
+                b = dominators[b];
+            }
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = order.size() - 1; i-- > 0;) {
+            auto index = order[i];
+            auto dominator = SIZE_MAX;
+            for (auto referrer: referrers[index]) {
+                if (dominators[referrer] == SIZE_MAX) {
+                    continue;
+                }
+                dominator = dominator == SIZE_MAX
+                            ? referrer : intersect(referrer, dominator);
+            }
+            if (dominators[index] != dominator) {
+                dominators[index] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return {dominators, order};
+}
+
+// Outputs the classes with the most instances, and the ones whose instances
+// keep the most memory reachable, followed by the dominator tree, where each
+// object's children are the objects that would become unreachable if it did.
+// Sizes are the snapshot's estimates in bytes
+void HeapSnapshot::output_report(std::ostream &out) const {
+    auto root = objects.size();
+    auto [dominators, order] = get_dominators(*this);
+
+    // An object's retained size is its own size along with the retained sizes
+    // of its children, which are always finished before it
+    std::vector<std::size_t> retained(root + 1), retained_count(root + 1);
+    std::vector<std::vector<std::size_t>> children(root + 1);
+    for (auto index: order) {
+        if (index == root) {
+            continue;
+        }
+        retained[index] += objects[index].size;
+        retained_count[index]++;
+        retained[dominators[index]] += retained[index];
+        retained_count[dominators[index]] += retained_count[index];
+        children[dominators[index]].push_back(index);
+    }
+
+    // A class retains what its instances do, except for instances that are
+    // dominated by another instance of the same class, which are already
+    // counted. The tree is walked keeping track of the classes above each
+    // object
+    auto num_classes = class_names.size();
+    std::vector<std::size_t> counts(num_classes), shallow(num_classes),
+                             class_retained(num_classes), above(num_classes);
+    std::vector<std::pair<std::size_t, bool>> walk;
+    for (auto child: children[root]) {
+        walk.emplace_back(child, false);
+    }
+    while (not walk.empty()) {
+        auto [index, leaving] = walk.back();
+        walk.pop_back();
+        auto type = objects[index].type;
+        if (leaving) {
+            above[type]--;
+            continue;
+        }
+        counts[type]++;
+        shallow[type] += objects[index].size;
+        if (above[type] == 0) {
+            class_retained[type] += retained[index];
+        }
+        above[type]++;
+        walk.emplace_back(index, true);
+        for (auto child: children[index]) {
+            walk.emplace_back(child, false);
+        }
+    }
+
+    auto total = retained[root];
+    auto percent = [&](std::size_t size) {
+        return total ? 100.0 * size / total : 0.0;
+    };
+    out << objects.size() << " reachable instances of " << num_classes
+        << " classes, taking up about " << total << " bytes, from "
+        << roots.size() << " roots\n" << std::fixed << std::setprecision(1);
+
+    auto output_classes = [&](const std::vector<std::size_t> &sort_by,
+                              const std::string &title)
+    {
+        std::vector<std::size_t> sorted(num_classes);
+        std::iota(sorted.begin(), sorted.end(), 0);
+        std::stable_sort(sorted.begin(), sorted.end(), [&](auto a, auto b) {
+            return sort_by[a] > sort_by[b];
+        });
+        sorted.resize(std::min(sorted.size(), HEAP_REPORT_TOP));
+        out << "\n" << title << "\n" << std::left << std::setw(24) << "class"
+            << std::right << std::setw(12) << "instances" << std::setw(12)
+            << "allocated" << std::setw(14) << "shallow" << std::setw(14)
+            << "retained" << std::setw(8) << "%" << "\n";
+        for (auto type: sorted) {
+            out << std::left << std::setw(24) << class_names[type]
+                << std::right << std::setw(12) << counts[type]
+                << std::setw(12) << allocations[type]
+                << std::setw(14) << shallow[type]
+                << std::setw(14) << class_retained[type]
+                << std::setw(8) << percent(class_retained[type]) << "\n";
+        }
+    };
+    output_classes(counts, "By number of instances:");
+    output_classes(class_retained, "By retained size:");
+
+    // Only objects retaining a good share of the heap are shown, from the
+    // largest down, as many levels deep as fit. A chain of objects of the same
+    // class that each only dominate the next, like a linked list, is shown as
+    // one line
+    out << "\nDominator tree:\n";
+    std::size_t lines = 0;
+    std::vector<std::pair<std::size_t, std::size_t>> tree;
+    auto add_children = [&](std::size_t index, std::size_t depth) {
+        auto sorted = children[index];
+        std::stable_sort(sorted.begin(), sorted.end(), [&](auto a, auto b) {
+            return retained[a] > retained[b];
+        });
+        for (auto i = sorted.size(); i-- > 0;) {
+            if (percent(retained[sorted[i]]) >= 1.0) {
+                tree.emplace_back(sorted[i], depth);
+            }
+        }
+    };
+    add_children(root, 0);
+    while (not tree.empty() and lines < HEAP_REPORT_TREE_LINES) {
+        auto [index, depth] = tree.back();
+        tree.pop_back();
+        auto type = objects[index].type;
+        auto last = index;
+        std::size_t chain_length = 1;
+        while (children[last].size() == 1
+               and objects[children[last][0]].type == type)
+        {
+            last = children[last][0];
+            chain_length++;
+        }
+
+        out << std::string(2 * depth + 2, ' ') << class_names[type] << " #"
+            << index;
+        if (chain_length > 1) {
+            out << " to #" << last << ", a chain of " << chain_length;
+        }
+        out << ": " << retained[index] << " bytes ("
+            << percent(retained[index]) << "%) in " << retained_count[index]
+            << " instances\n";
+        lines++;
+        add_children(last, depth + 1);
+    }
+    if (not tree.empty()) {
+        out << "  ...\n";
+    }
+}
+
+HeapSnapshotter::HeapSnapshotter(const std::string &file_name,
+                                 std::size_t collection_interval):
+file_name(file_name), collection_interval(collection_interval) {
+}
+
+HeapSnapshotter::~HeapSnapshotter() {
+    stop();
+}
+
+// Returns whether a snapshot can be asked for with a signal on this machine
+bool HeapSnapshotter::is_signal_supported() {
+    return HEAP_SIGNAL_SUPPORTED;
+}
+
+// Starts listening for the signal asking for a snapshot
+void HeapSnapshotter::start() {
+#if HEAP_SIGNAL_SUPPORTED
+    snapshot_flag = &signalled;
+    struct sigaction action = {};
+    action.sa_handler = note_snapshot_due;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+#endif
+}
+
+// Stops listening for the signal, which goes back to ending the process
+void HeapSnapshotter::stop() {
+#if HEAP_SIGNAL_SUPPORTED
+    if (snapshot_flag != &signalled) {
+        return;
+    }
+    std::signal(SIGUSR1, SIG_DFL);
+    snapshot_flag = nullptr;
+#endif
+}
+
+// Counts a garbage collection that just finished, returning whether a snapshot
+// is due after it
+bool HeapSnapshotter::count_collection() {
+    num_collections++;
+    return collection_interval and num_collections % collection_interval == 0;
+}
+
+// Writes a snapshot taken during the run to the next numbered file after the
+// one the snapshot at the end goes to. Not being able to write it isn't a
+// reason to stop the program, so any error is only reported
+void HeapSnapshotter::write(const HeapSnapshot &snapshot) {
+    signalled = 0;
+    auto name = file_name + "." + std::to_string(++num_taken);
+    if (snapshot.write(name)) {
+        std::cerr << "Error! Could not write heap snapshot to \"" << name
+                  << "\"!\n";
+    } else {
+        std::cerr << "Heap snapshot written to \"" << name << "\"\n";
+    }
+}
+
+const std::string &HeapSnapshotter::get_file_name() const {
+    return file_name;
+}
@@ -1,7 +1,7 @@
 #include "instance.hpp"
 #include "class.hpp"
 
-Instance::Instance(Class &type): type(type) {
+Instance::Instance(const Class &type): type(type) {
 }
 
 // Sets a variable in the instance
@@ -23,7 +23,20 @@ const Variable &Instance::get_var(const std::string &name) const {
     return vars.at(name);
 }
 
+// Returns the variable with the given name, or nullptr if there isn't one.
+// Variables are never removed from an instance, and stay where they are when
+// the instance is moved, so the pointer stays valid as long as the instance
+Variable *Instance::find_var(const std::string &name) {
+    auto found = vars.find(name);
+    return found == vars.end() ? nullptr : &found->second;
+}
+
 // Returns the name of the instance's class
 const std::string &Instance::get_type_name() const {
     return type.get_name();
 }
+
+// Returns the instance's class
+const Class &Instance::get_class() const {
+    return type;
+}
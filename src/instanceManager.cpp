@@ -1,9 +1,16 @@
 #include "instanceManager.hpp"
+#include "class.hpp"
+#include "gcstats.hpp"
+#include "heapsnapshot.hpp"
 #include "instance.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <queue>
+#include <unordered_map>
 
 InstanceManager::InstanceManager(std::vector<Variable> &stack, VarMap &globals):
 stack(stack), globals(globals), num_instances(NUM_STARTING_INSTANCES), next_instance(0) {
@@ -26,26 +33,47 @@ InstanceManager::~InstanceManager() {
     operator delete [] (static_cast<void *>(instances));
 }
 
-// Adds the local variables from a new scope to the manager
-void InstanceManager::new_scope(Function *executing_func, VarMap *new_locals) {
+// Adds the local variables from a new scope to the manager, along with its
+// registers if it's run by the register engine
+void InstanceManager::new_scope(Function *executing_func, VarMap *new_locals,
+                                std::vector<std::optional<Variable>> *new_registers)
+{
     executing_funcs.push_back(executing_func);
     locals.push_back(new_locals);
+    registers.push_back(new_registers);
 }
 
 // Removes the variables from the current scope from the managed variables
 void InstanceManager::unwind_scope() {
     executing_funcs.pop_back();
     locals.pop_back();
+    registers.pop_back();
+}
+
+// Removes the scopes of every function, for after an error, which stops the
+// functions being run without unwinding their scopes, leaving behind local
+// variables that no longer exist
+void InstanceManager::clear_scopes() {
+    executing_funcs.clear();
+    locals.clear();
+    registers.clear();
 }
 
 // Returns a pointer to a newly-allocated instance of a certain type
-Instance *InstanceManager::new_instance(Class &type) {
+Instance *InstanceManager::new_instance(const Class &type) {
+    if (heap_snapshotter and heap_snapshotter->is_signalled()) {
+        heap_snapshotter->write(take_heap_snapshot());
+    }
+
     while (next_instance < num_instances and instances_used[next_instance]) {
         next_instance++;
     }
 
     if (next_instance < num_instances) {
         instances_used[next_instance] = true;
+        if (gc_stats) {
+            gc_stats->record_allocation(type);
+        }
         return new (&instances[next_instance++]) Instance(type);
     } else {
         collect_garbage();
@@ -53,49 +81,96 @@ Instance *InstanceManager::new_instance(Class &type) {
     }
 }
 
-// Performs a mark and swap garbage collection
-void InstanceManager::collect_garbage() {
-    // Sets all the instances as being unreachable
-    for (size_t i = 0; i < num_instances; i++) {
-        instances_used[i] = false;
-    }
-
-    // A vector of pointers to variables that have instance pointers in them,
-    // kept track of in case we need to move the instances and the pointers
-    // need to be updated
-    std::vector<Variable *> reachable_vars;
-
-    // The queue of instances to be marked and saved from being collected
-    std::queue<Variable *> queue;
-
-    // Add local variables with instance pointers to the queue
+// Calls a function on each variable with an instance pointer that isn't in an
+// instance, which are the local variables and registers of the functions being
+// run, the global variables and the stack, along with which of them it is
+template <typename Visit>
+void InstanceManager::visit_roots(Visit visit) {
     for (auto &local_vars: locals) {
         for (auto &var: *local_vars) {
             if (var.second.get_type() == VarType::Function or
                 var.second.get_type() == VarType::Instance)
             {
-                queue.push(&var.second);
+                visit(var.second, RootType::Local);
+            }
+        }
+    }
+
+    for (auto &func_registers: registers) {
+        if (not func_registers) {
+            continue;
+        }
+        for (auto &var: *func_registers) {
+            if (var and (var->get_type() == VarType::Function or
+                         var->get_type() == VarType::Instance))
+            {
+                visit(*var, RootType::Local);
             }
         }
     }
 
-    // Add global variables with instance pointers to the queue
     for (auto &var: globals) {
         if (var.second.get_type() == VarType::Function or
             var.second.get_type() == VarType::Instance)
         {
-            queue.push(&var.second);
+            visit(var.second, RootType::Global);
         }
     }
 
-    // Add all the variables in the stack with instance pointers to the queue
     for (auto &var: stack) {
         if (var.get_type() == VarType::Function or
             var.get_type() == VarType::Instance)
         {
-            queue.push(&var);
+            visit(var, RootType::Stack);
         }
     }
+}
+
+// Returns the index in the instances array of the instance a variable with an
+// instance pointer points to, or the object of a function
+std::size_t InstanceManager::get_index(const Variable &var) const {
+    if (var.get_type() == VarType::Instance) {
+        return *(var.get_instance()) - instances;
+    }
+    return var.get_function()->get_obj() - instances;
+}
+
+// Performs a mark and swap garbage collection
+void InstanceManager::collect_garbage() {
+    auto start_time = std::chrono::steady_clock::now();
+    GcCollection collection;
+    collection.heap_size = num_instances;
+
+    // Sets all the instances as being unreachable
+    for (size_t i = 0; i < num_instances; i++) {
+        collection.in_use += instances_used[i];
+        instances_used[i] = false;
+    }
+
+    // A vector of pointers to variables that have instance pointers in them,
+    // kept track of in case we need to move the instances and the pointers
+    // need to be updated
+    std::vector<Variable *> reachable_vars;
+
+    // The queue of instances to be marked and saved from being collected
+    std::queue<Variable *> queue;
+
+    // Add the variables with instance pointers that are outside of any
+    // instance to the queue
+    visit_roots([&](Variable &var, RootType root_type) {
+        queue.push(&var);
+        switch (root_type) {
+            case RootType::Local:
+                collection.local_roots++;
+                break;
+            case RootType::Global:
+                collection.global_roots++;
+                break;
+            case RootType::Stack:
+                collection.stack_roots++;
+                break;
+        }
+    });
 
     // Go through the queue, marking all the variables with instances in the
     // queue as reachable, and add all the variables with instances that it
@@ -112,12 +187,7 @@ void InstanceManager::collect_garbage() {
             // see if we've already marked it as reachable
             var->set_marked(true);
             reachable_vars.push_back(var);
-            std::ptrdiff_t index;
-            if (var->get_type() == VarType::Instance) {
-                index = *(var->get_instance()) - instances;
-            } else {
-                index = var->get_function()->get_obj() - instances;
-            }
+            auto index = get_index(*var);
             // If we haven't already set this instance pointer as being
             // reachable, set it as reachable, and add all of its variables
             // with instance pointers to the queue
@@ -135,6 +205,8 @@ void InstanceManager::collect_garbage() {
         }
     }
 
+    auto mark_end_time = std::chrono::steady_clock::now();
+
     // Calls the destructor for every instance that isn't reachable
     for (size_t i = 0; i < num_instances; i++) {
         if (not instances_used[i]) {
@@ -142,9 +214,13 @@ void InstanceManager::collect_garbage() {
         }
     }
 
+    auto sweep_end_time = std::chrono::steady_clock::now();
+
     // If enough of the instances are still in use, we double the allocated
     // memory for the instances and move the old instances to the larger array
-    if (static_cast<double>(insts_reachable) / num_instances > 0.75) {
+    if (static_cast<double>(insts_reachable) / num_instances
+        > GC_GROWTH_THRESHOLD)
+    {
         // Allocate more memory for the instances and the array keeping track
         // of whether they're still in use
         size_t new_num_insts = num_instances << 1;
@@ -192,4 +268,175 @@ void InstanceManager::collect_garbage() {
     }
 
     next_instance = 0;
+
+    if (gc_stats) {
+        using Seconds = std::chrono::duration<double>;
+        auto end_time = std::chrono::steady_clock::now();
+        collection.live = insts_reachable;
+        collection.reclaimed = collection.in_use - insts_reachable;
+        collection.new_heap_size = num_instances;
+        collection.mark_time = Seconds(mark_end_time - start_time).count();
+        collection.sweep_time = Seconds(sweep_end_time - mark_end_time).count();
+        collection.pause_time = Seconds(end_time - start_time).count();
+        gc_stats->record_collection(collection);
+    }
+
+    if (heap_snapshotter and heap_snapshotter->count_collection()) {
+        heap_snapshotter->write(take_heap_snapshot());
+    }
+}
+
+// Returns the number of bytes a string has allocated outside of itself, which
+// short strings don't
+std::size_t get_string_size(const std::string &str) {
+    auto data = str.data();
+    auto inside = reinterpret_cast<const char *>(&str);
+    if (data >= inside and data < inside + sizeof(str)) {
+        return 0;
+    }
+    return str.capacity() + 1;
+}
+
+// Returns a snapshot of the instances that are reachable, found the same way
+// garbage collection finds them, but without changing what's marked. Sizes are
+// estimates, counting each instance, the nodes of its map of fields, and any
+// strings they allocate
+HeapSnapshot InstanceManager::take_heap_snapshot() {
+    HeapSnapshot snapshot;
+    std::unordered_map<const Class *, std::size_t> class_indexes;
+    auto get_class_index = [&](const Class &type) {
+        auto [found, added] = class_indexes.emplace(&type,
+                                                    class_indexes.size());
+        if (added) {
+            snapshot.class_names.push_back(type.get_name());
+            snapshot.allocations.push_back(0);
+        }
+        return found->second;
+    };
+
+    // The index of each reachable instance in the snapshot, by its index in
+    // the instances array, and the instances yet to be looked at
+    std::vector<std::size_t> object_indexes(num_instances, SIZE_MAX);
+    std::vector<std::size_t> queue;
+    auto get_object_index = [&](const Variable &var) {
+        auto index = get_index(var);
+        if (object_indexes[index] == SIZE_MAX) {
+            object_indexes[index] = queue.size();
+            queue.push_back(index);
+        }
+        return object_indexes[index];
+    };
+
+    visit_roots([&](Variable &var, RootType) {
+        snapshot.roots.push_back(get_object_index(var));
+    });
+    std::sort(snapshot.roots.begin(), snapshot.roots.end());
+    snapshot.roots.erase(std::unique(snapshot.roots.begin(),
+                                     snapshot.roots.end()),
+                         snapshot.roots.end());
+
+    const std::size_t field_size = sizeof(decltype(Instance::vars)::value_type)
+                                   + 4 * sizeof(void *);
+    for (std::size_t i = 0; i < queue.size(); i++) {
+        const auto &instance = instances[queue[i]];
+        HeapObject object;
+        object.type = get_class_index(instance.type);
+        object.fields = instance.vars.size();
+        object.size = sizeof(Instance);
+        for (const auto &[name, var]: instance.vars) {
+            object.size += field_size + get_string_size(name);
+            switch (var.get_type()) {
+                case VarType::Function:
+                case VarType::Instance:
+                    object.references.push_back(get_object_index(var));
+                    break;
+                case VarType::Name:
+                    object.size += get_string_size(*var.get_name());
+                    break;
+                case VarType::String:
+                    object.size += get_string_size(*var.get_string());
+                    break;
+                case VarType::Number:
+                    break;
+            }
+        }
+        snapshot.objects.push_back(std::move(object));
+    }
+
+    if (gc_stats) {
+        for (const auto &[type, count]: gc_stats->get_allocations()) {
+            snapshot.allocations[get_class_index(*type)] = count;
+        }
+    }
+    return snapshot;
+}
+
+// Sets the JIT that compiles the functions run with this manager, or nullptr
+// to only interpret them
+void InstanceManager::set_jit(Jit *new_jit) {
+    jit = new_jit;
+}
+
+Jit *InstanceManager::get_jit() const {
+    return jit;
+}
+
+// Sets the tracer that records and runs the hot loops of the functions run
+// with this manager, or nullptr to not trace them
+void InstanceManager::set_tracer(Tracer *new_tracer) {
+    tracer = new_tracer;
+}
+
+Tracer *InstanceManager::get_tracer() const {
+    return tracer;
+}
+
+// Sets the register engine that runs the functions run with this manager, or
+// nullptr to interpret them
+void InstanceManager::set_register_vm(RegisterVM *new_register_vm) {
+    register_vm = new_register_vm;
+}
+
+RegisterVM *InstanceManager::get_register_vm() const {
+    return register_vm;
+}
+
+// Sets the profiler that samples the functions run with this manager, or
+// nullptr to not profile them
+void InstanceManager::set_profiler(Profiler *new_profiler) {
+    profiler = new_profiler;
+}
+
+Profiler *InstanceManager::get_profiler() const {
+    return profiler;
+}
+
+// Sets the counter of the commands interpreted with this manager, or nullptr
+// to not count them
+void InstanceManager::set_op_counter(OpCounter *new_op_counter) {
+    op_counter = new_op_counter;
+}
+
+OpCounter *InstanceManager::get_op_counter() const {
+    return op_counter;
+}
+
+// Sets the statistics the garbage collections and allocations of this manager
+// are recorded in, or nullptr to not record them
+void InstanceManager::set_gc_stats(GcStats *new_gc_stats) {
+    gc_stats = new_gc_stats;
+}
+
+GcStats *InstanceManager::get_gc_stats() const {
+    return gc_stats;
+}
+
+// Sets what decides when snapshots of the heap are taken while the functions
+// run with this manager allocate instances, or nullptr to not take any
+void InstanceManager::set_heap_snapshotter(HeapSnapshotter *new_snapshotter) {
+    heap_snapshotter = new_snapshotter;
+}
+
+HeapSnapshotter *InstanceManager::get_heap_snapshotter() const {
+    return heap_snapshotter;
 }
@@ -0,0 +1,363 @@
+#include "jit.hpp"
+#include "instanceManager.hpp"
+#include "variable.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#if defined(__x86_64__) and defined(__unix__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Frees the executable memory holding the native code
+Jit::~Jit() {
+#if JIT_SUPPORTED
+    for (const auto &[memory, size]: code_blocks) {
+        munmap(memory, size);
+    }
+#endif
+}
+
+// Returns whether native code can be generated for the machine this is
+// running on
+bool Jit::is_supported() {
+    return JIT_SUPPORTED;
+}
+
+// Runs a function's native code, compiling the function first if it's now
+// been called often enough. If the function has no native code, or its native
+// code handed it back to the interpreter, frame.resume is the command the
+// interpreter carries on from
+JitStatus Jit::run(const CommandList &commands, Function *func, Frame &frame) {
+    auto &info = functions[&commands];
+    if (not info.entry) {
+        frame.resume = 0;
+        if (info.failed or ++info.calls < JIT_THRESHOLD) {
+            return JitStatus::Interpret;
+        }
+        info.entry = compile(commands);
+        if (not info.entry) {
+            info.failed = true;
+            return JitStatus::Interpret;
+        }
+    }
+
+    auto status = static_cast<JitStatus>(info.entry(func, &frame));
+    if (status == JitStatus::Interpret and ++info.deopts == JIT_MAX_DEOPTS) {
+        // The native code stays where it is, as it may still be running
+        // further up the call stack
+        info.entry = nullptr;
+        info.failed = true;
+    }
+    return status;
+}
+
+// Runs any command with the interpreter's code for it
+int Jit::run_command(Function *func, Frame *frame, const Command *command,
+                     std::size_t i, std::size_t)
+{
+    switch (func->run_command(*command, i, *frame)) {
+        case CommandResult::Next:
+            return static_cast<int>(JitStatus::Continue);
+
+        case CommandResult::Jump:
+            return static_cast<int>(JitStatus::Jump);
+
+        case CommandResult::Return:
+            return static_cast<int>(JitStatus::Return);
+
+        case CommandResult::Error:
+            break;
+    }
+    return static_cast<int>(JitStatus::Error);
+}
+
+int Jit::push_name(Function *, Frame *frame, const Command *command,
+                   std::size_t, std::size_t)
+{
+    frame->stack.emplace_back(VarType::Name, command->get_string());
+    return static_cast<int>(JitStatus::Continue);
+}
+
+int Jit::push_number(Function *, Frame *frame, const Command *command,
+                     std::size_t, std::size_t)
+{
+    frame->stack.emplace_back(command->get_number());
+    return static_cast<int>(JitStatus::Continue);
+}
+
+int Jit::push_string(Function *, Frame *frame, const Command *command,
+                     std::size_t, std::size_t)
+{
+    frame->stack.emplace_back(VarType::String, command->get_string());
+    return static_cast<int>(JitStatus::Continue);
+}
+
+// Pops the stack into a local variable, unless the stack is empty
+int Jit::assign_local(Function *, Frame *frame, const Command *command,
+                      std::size_t i, std::size_t slot)
+{
+    if (frame->stack.empty()) {
+        frame->resume = i;
+        return static_cast<int>(JitStatus::Interpret);
+    }
+    *frame->get_slot(command->get_string(), slot, true)
+        = std::move(frame->stack.back());
+    frame->stack.pop_back();
+    return static_cast<int>(JitStatus::Continue);
+}
+
+int Jit::store_local_number(Function *, Frame *frame, const Command *command,
+                            std::size_t, std::size_t slot)
+{
+    *frame->get_slot(command->get_first_name(), slot, true)
+        = command->get_number();
+    return static_cast<int>(JitStatus::Continue);
+}
+
+// Pushes the value of a local variable, unless it isn't defined
+int Jit::load_local(Function *, Frame *frame, const Command *command,
+                    std::size_t i, std::size_t slot)
+{
+    auto var = frame->get_slot(command->get_string(), slot, false);
+    if (not var) {
+        frame->resume = i;
+        return static_cast<int>(JitStatus::Interpret);
+    }
+    frame->stack.push_back(*var);
+    return static_cast<int>(JitStatus::Continue);
+}
+
+// Tests the local variable of a LoopBegin or LoopEnd command, returning
+// whether to jump, unless the variable isn't a number
+int Jit::test_loop(Function *, Frame *frame, const Command *command,
+                   std::size_t i, std::size_t slot)
+{
+    auto var = frame->get_slot(command->get_loop_var(), slot, false);
+    if (not var or var->get_type() != VarType::Number) {
+        frame->resume = i;
+        return static_cast<int>(JitStatus::Interpret);
+    }
+    bool is_zero = *var->get_number() == 0.0;
+    bool jump = command->get_type() == CommandType::LoopBegin ? is_zero
+                                                              : not is_zero;
+    return static_cast<int>(jump ? JitStatus::Jump : JitStatus::Continue);
+}
+
+// Machine code for the parts of the native code, with the function being run
+// kept in rbx and its frame in r12
+const std::vector<std::uint8_t> X86_PROLOGUE = {
+    0x53,                   // push rbx
+    0x41, 0x54,             // push r12
+    0x41, 0x55,             // push r13, keeping the stack aligned
+    0x48, 0x89, 0xfb,       // mov rbx, rdi
+    0x49, 0x89, 0xf4        // mov r12, rsi
+};
+const std::vector<std::uint8_t> X86_EPILOGUE = {
+    0x41, 0x5d,             // pop r13
+    0x41, 0x5c,             // pop r12
+    0x5b,                   // pop rbx
+    0xc3                    // ret
+};
+const std::vector<std::uint8_t> X86_PASS_FRAME = {
+    0x48, 0x89, 0xdf,       // mov rdi, rbx
+    0x4c, 0x89, 0xe6        // mov rsi, r12
+};
+const std::vector<std::uint8_t> X86_MOV_RDX = {0x48, 0xba};
+const std::vector<std::uint8_t> X86_MOV_RCX = {0x48, 0xb9};
+const std::vector<std::uint8_t> X86_MOV_R8 = {0x49, 0xb8};
+const std::vector<std::uint8_t> X86_MOV_RAX = {0x48, 0xb8};
+const std::vector<std::uint8_t> X86_MOV_EAX = {0xb8};
+const std::vector<std::uint8_t> X86_CALL_RAX = {0xff, 0xd0};
+const std::vector<std::uint8_t> X86_TEST_EAX = {0x85, 0xc0};
+const std::vector<std::uint8_t> X86_CMP_EAX = {0x83, 0xf8};
+const std::vector<std::uint8_t> X86_JE = {0x0f, 0x84};
+const std::vector<std::uint8_t> X86_JNE = {0x0f, 0x85};
+const std::vector<std::uint8_t> X86_JMP = {0xe9};
+
+// Generates native code for a function's commands, returning nullptr if
+// that isn't possible. The native code returns a JitStatus, which is only ever
+// Interpret, Error or Return
+Jit::Entry Jit::compile(const CommandList &commands) {
+#if JIT_SUPPORTED
+    if (commands.size() >= std::numeric_limits<std::int32_t>::max()) {
+        return nullptr;
+    }
+
+    std::vector<std::uint8_t> code;
+    auto emit = [&] (const std::vector<std::uint8_t> &bytes) {
+        code.insert(code.end(), bytes.begin(), bytes.end());
+    };
+    auto emit_value = [&] (auto value) {
+        std::uint8_t bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        code.insert(code.end(), bytes, bytes + sizeof(value));
+    };
+    auto emit_imm64 = [&] (const std::vector<std::uint8_t> &opcode,
+                           std::uint64_t value) {
+        emit(opcode);
+        emit_value(value);
+    };
+
+    // Jumps are emitted before the position they go to is known, so they're
+    // kept track of by the position of their offset and the label they go to
+    std::vector<std::size_t> labels(commands.size() + 2);
+    std::vector<std::pair<std::size_t, std::size_t>> jumps;
+    auto end_label = commands.size();
+    auto epilogue_label = commands.size() + 1;
+    auto emit_jump = [&] (const std::vector<std::uint8_t> &opcode,
+                          std::size_t label) {
+        emit(opcode);
+        jumps.emplace_back(code.size(), label);
+        emit_value(std::int32_t{0});
+    };
+
+    // The local variables used by the simplest commands are given slots in
+    // the frame, so they're only looked up once per call. Commands using any
+    // other local variables are run by the interpreter's code
+    std::unordered_map<std::string, std::size_t> slots;
+    auto get_slot = [&] (const std::string &name) {
+        if (name[0] != '_') {
+            return JIT_MAX_SLOTS;
+        }
+        auto found = slots.find(name);
+        if (found != slots.end()) {
+            return found->second;
+        }
+        if (slots.size() == JIT_MAX_SLOTS) {
+            return JIT_MAX_SLOTS;
+        }
+        return slots.emplace(name, slots.size()).first->second;
+    };
+
+    emit(X86_PROLOGUE);
+    for (std::size_t i = 0; i < commands.size(); i++) {
+        labels[i] = code.size();
+        const auto &command = commands[i];
+
+        // The routine that runs the command, and whether it can stop the
+        // function or jump
+        int (*routine)(Function *, Frame *, const Command *, std::size_t,
+                       std::size_t) = run_command;
+        auto slot = JIT_MAX_SLOTS;
+        bool can_stop = true;
+        switch (command.get_type()) {
+            case CommandType::Nop:
+                continue;
+
+            case CommandType::Return:
+                emit(X86_MOV_EAX);
+                emit_value(static_cast<std::int32_t>(JitStatus::Return));
+                emit_jump(X86_JMP, epilogue_label);
+                continue;
+
+            case CommandType::PushName:
+                routine = push_name;
+                can_stop = false;
+                break;
+
+            case CommandType::PushNumber:
+                routine = push_number;
+                can_stop = false;
+                break;
+
+            case CommandType::PushString:
+                routine = push_string;
+                can_stop = false;
+                break;
+
+            case CommandType::AssignTo:
+                slot = get_slot(command.get_string());
+                if (slot != JIT_MAX_SLOTS) {
+                    routine = assign_local;
+                }
+                break;
+
+            case CommandType::StoreNumber:
+                slot = get_slot(command.get_first_name());
+                if (slot != JIT_MAX_SLOTS) {
+                    routine = store_local_number;
+                    can_stop = false;
+                }
+                break;
+
+            case CommandType::LoadVar:
+                slot = get_slot(command.get_string());
+                if (slot != JIT_MAX_SLOTS) {
+                    routine = load_local;
+                }
+                break;
+
+            case CommandType::LoopBegin:
+            case CommandType::LoopEnd:
+                slot = get_slot(command.get_loop_var());
+                if (slot != JIT_MAX_SLOTS) {
+                    routine = test_loop;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        emit(X86_PASS_FRAME);
+        emit_imm64(X86_MOV_RDX, reinterpret_cast<std::uint64_t>(&command));
+        emit_imm64(X86_MOV_RCX, i);
+        emit_imm64(X86_MOV_R8, slot);
+        emit_imm64(X86_MOV_RAX, reinterpret_cast<std::uint64_t>(routine));
+        emit(X86_CALL_RAX);
+
+        // A LoopBegin jumps past its LoopEnd, and a LoopEnd jumps back to
+        // the command after its LoopBegin
+        if (command.get_type() == CommandType::LoopBegin or
+            command.get_type() == CommandType::LoopEnd)
+        {
+            emit(X86_CMP_EAX);
+            code.push_back(static_cast<std::uint8_t>(JitStatus::Jump));
+            emit_jump(X86_JE, command.get_jump() + 1);
+        }
+        if (can_stop) {
+            emit(X86_TEST_EAX);
+            emit_jump(X86_JNE, epilogue_label);
+        }
+    }
+    labels[end_label] = code.size();
+    emit(X86_MOV_EAX);
+    emit_value(static_cast<std::int32_t>(JitStatus::Return));
+    labels[epilogue_label] = code.size();
+    emit(X86_EPILOGUE);
+
+    for (const auto &[offset, label]: jumps) {
+        auto rel = static_cast<std::int32_t>(
+            static_cast<std::int64_t>(labels[label])
+            - static_cast<std::int64_t>(offset + sizeof(std::int32_t)));
+        std::memcpy(&code[offset], &rel, sizeof(rel));
+    }
+
+    // The code is written before the memory is made executable, so the memory
+    // is never both writable and executable
+    void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        return nullptr;
+    }
+    code_blocks.emplace_back(memory, code.size());
+
+    Entry entry;
+    std::memcpy(&entry, &memory, sizeof(entry));
+    return entry;
+#else
+    (void) commands;
+    return nullptr;
+#endif
+}
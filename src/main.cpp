@@ -1,13 +1,27 @@
+#include "build.hpp"
 #include "compiler.hpp"
+#include "gcstats.hpp"
+#include "heapsnapshot.hpp"
 #include "instance.hpp"
 #include "instanceManager.hpp"
+#include "jit.hpp"
 #include "minify.hpp"
+#include "opcount.hpp"
 #include "optimization.hpp"
 #include "parse.hpp"
+#include "profile.hpp"
+#include "regvm.hpp"
+#include "tiering.hpp"
+#include "trace.hpp"
 #include "variable.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <optional>
 #include <set>
 
 void print_help(const std::string &interpreter_name) {
@@ -15,19 +29,46 @@ void print_help(const std::string &interpreter_name) {
               << interpreter_name
               << " glass_file [args...]" << "\n";
 
-    std::cout << "--convert   Convert glass code with extensions to standard glass\n"
-              << "--compile   Convert the source to a C program\n"
-              << "--help      Display this help message\n"
-              << "--no-opt    Don't perform optimizations\n"
-              << "--minify    Outputs a minified version of the source code\n"
-              << "--pedantic  Disallow extensions to the base language of Glass\n"
-              << "--width     Restricts the length of lines of minified source\n";
+    std::cout << "--build        Compile the source to an optimized native executable\n"
+              << "--convert      Convert glass code with extensions to standard glass\n"
+              << "--count-ops    Count the commands run and write the counts to a JSON file\n"
+              << "--compile      Convert the source to a C program\n"
+              << "--disable-pass Don't run the named optimization pass\n"
+              << "--enable-pass  Run the named optimization pass\n"
+              << "--engine=NAME  Run programs on the stack (default) or reg engine\n"
+              << "--gc-stats     Report on garbage collection and allocation after running\n"
+              << "--heap-report  Report on the classes and dominator tree in a heap snapshot\n"
+              << "--heap-snapshot Write a snapshot of the heap to a file at exit or on SIGUSR1\n"
+              << "--heap-snapshot-every Also write a snapshot after every N collections\n"
+              << "--help         Display this help message\n"
+              << "--jit          Compile functions that are called often to native code\n"
+              << "-O0 to -O3     Set the optimization level (default -O3)\n"
+              << "--no-opt       Don't perform optimizations, the same as -O0\n"
+              << "--opt-stats    Report how often each optimization was applied\n"
+              << "--minify       Outputs a minified version of the source code\n"
+              << "--native       Tune a --build executable for the building machine\n"
+              << "--pedantic     Disallow extensions to the base language of Glass\n"
+              << "--profile      Sample the running program and write its profile to a file\n"
+              << "--split        Split compiled C into a directory with a file per class\n"
+              << "--tiered       Run a program built in the background on an earlier run\n"
+              << "--time-passes  Report the time taken by each optimization pass\n"
+              << "--trace        Record loops that go around often and run the recordings\n"
+              << "--train        Profile a --build executable on an input and rebuild\n"
+              << "--width        Restricts the length of lines of minified source\n";
 }
 
 int main(int argc, char *argv[]) {
-    std::string filename, out_file;
+    std::string filename, out_file, build_file, profile_file, count_file,
+                snapshot_file, heap_report_file;
+    std::size_t snapshot_interval = 0;
     bool minify_code = false, pedantic = false, convert_code = false,
-         optimize = true;
+         opt_stats = false, time_passes = false, use_jit = false,
+         tiered = false, use_tracer = false, gc_stats = false;
+    std::string engine = "stack";
+    int opt_level = MAX_OPT_LEVEL;
+    // The passes enabled or disabled by name, which override the level
+    std::vector<std::pair<std::string, bool>> pass_overrides;
+    BuildOptions build_options;
     std::size_t width = 0;
 
     for (int i = 1; i < argc; i++) {
@@ -39,17 +80,118 @@ int main(int argc, char *argv[]) {
         } else if (arg == "--convert") {
             convert_code = true;
         } else if (arg == "--no-opt") {
-            optimize = false;
+            opt_level = 0;
+        } else if (arg.size() == 3 and arg.compare(0, 2, "-O") == 0
+                   and std::isdigit(arg[2])) {
+            opt_level = arg[2] - '0';
+            if (opt_level > MAX_OPT_LEVEL) {
+                std::cerr << "Error! There is no optimization level "
+                          << opt_level << "!\n";
+                return 1;
+            }
+        } else if (arg == "--enable-pass" or arg == "--disable-pass") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! " << arg << " argument supplied, but no"
+                          << " pass was named!\n";
+                return 1;
+            }
+            std::string pass_name{argv[++i]};
+            if (std::find(OPT_PASSES.begin(), OPT_PASSES.end(), pass_name)
+                == OPT_PASSES.end())
+            {
+                std::cerr << "Error! There is no optimization pass named \""
+                          << pass_name << "\"!\n";
+                return 1;
+            }
+            pass_overrides.emplace_back(pass_name, arg == "--enable-pass");
+        } else if (arg == "--opt-stats") {
+            opt_stats = true;
+        } else if (arg == "--time-passes") {
+            time_passes = true;
+        } else if (arg == "--jit") {
+            use_jit = true;
+        } else if (arg == "--trace") {
+            use_tracer = true;
+        } else if (arg.rfind("--engine=", 0) == 0) {
+            engine = arg.substr(9);
+            if (engine != "stack" and engine != "reg") {
+                std::cerr << "Error! Unknown engine \"" << engine << "\"!\n";
+                return 1;
+            }
+        } else if (arg == "--profile") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! --profile argument supplied, but no output"
+                          << " file was specified!\n";
+                return 1;
+            }
+            profile_file = argv[++i];
+        } else if (arg == "--count-ops") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! --count-ops argument supplied, but no"
+                          << " output file was specified!\n";
+                return 1;
+            }
+            count_file = argv[++i];
+        } else if (arg == "--gc-stats") {
+            gc_stats = true;
+        } else if (arg == "--heap-snapshot" or arg == "--heap-report") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! " << arg << " argument supplied, but no"
+                          << " file was specified!\n";
+                return 1;
+            }
+            (arg == "--heap-snapshot" ? snapshot_file
+                                      : heap_report_file) = argv[++i];
+        } else if (arg == "--heap-snapshot-every") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! --heap-snapshot-every argument supplied,"
+                          << " but no number of collections was specified!\n";
+                return 1;
+            }
+            arg = argv[++i];
+            try {
+                snapshot_interval = std::stoul(arg);
+            } catch (const std::logic_error &e) {
+                snapshot_interval = 0;
+            }
+            if (snapshot_interval == 0) {
+                std::cerr << "Error! Supplied number of collections is not a"
+                          << " valid value!\n";
+                return 1;
+            }
+        } else if (arg == "--tiered") {
+            tiered = true;
         } else if (arg == "--compile") {
             if (i + 1 == argc) {
                 std::cerr << "Error! --compile argument supplied, but no output"
                           << " file was given!\n";
                 return 1;
-            } else if (not out_file.empty()) {
+            } else if (not out_file.empty() or not build_file.empty()) {
                 std::cerr << "Error! Multiple compilation targets specified!\n";
                 return 1;
             }
             out_file = argv[++i];
+        } else if (arg == "--build") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! --build argument supplied, but no output"
+                          << " file was given!\n";
+                return 1;
+            } else if (not out_file.empty() or not build_file.empty()) {
+                std::cerr << "Error! Multiple compilation targets specified!\n";
+                return 1;
+            }
+            build_file = argv[++i];
+        } else if (arg == "--native") {
+            build_options.native = true;
+        } else if (arg == "--split") {
+            build_options.split = true;
+        } else if (arg == "--train") {
+            if (i + 1 == argc) {
+                std::cerr << "Error! --train argument supplied, but no"
+                          << " training input was given!\n";
+                return 1;
+            }
+            build_options.train_input = argv[++i];
         } else if (arg == "--width") {
             if (i + 1 == argc) {
                 std::cerr << "Error! " << arg << " argument supplied, but no"
@@ -85,6 +227,31 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    auto opt_options = *get_opt_level(opt_level);
+    for (const auto &[pass_name, enable]: pass_overrides) {
+        if (enable) {
+            opt_options.passes.insert(pass_name);
+        } else {
+            opt_options.passes.erase(pass_name);
+        }
+    }
+    bool optimize = not opt_options.passes.empty();
+
+    // A snapshot is reported on without a program
+    if (not heap_report_file.empty()) {
+        if (not filename.empty()) {
+            std::cerr << "Error! --heap-report cannot be used with a"
+                      << " program!\n";
+            return 1;
+        }
+        auto snapshot = HeapSnapshot::read(heap_report_file);
+        if (not snapshot) {
+            return 1;
+        }
+        snapshot->output_report(std::cout);
+        return 0;
+    }
+
     if (filename.empty()) {
         print_help(argv[0]);
         return 1;
@@ -92,7 +259,102 @@ int main(int argc, char *argv[]) {
         std::cerr << "Error! Width command-line parameter specified without"
                   << " --minify or --convert!\n";
         return 1;
-    } else if ((convert_code or minify_code) and not out_file.empty()) {
+    } else if ((build_options.native or not build_options.train_input.empty())
+               and build_file.empty())
+    {
+        std::cerr << "Error! --native or --train specified without --build!\n";
+        return 1;
+    } else if (build_options.split and out_file.empty() and build_file.empty()) {
+        std::cerr << "Error! --split specified without --compile or --build!\n";
+        return 1;
+    } else if ((opt_stats or time_passes) and not optimize) {
+        std::cerr << "Error! " << (opt_stats ? "--opt-stats" : "--time-passes")
+                  << " specified without any optimizations!\n";
+        return 1;
+    } else if (use_jit and (not out_file.empty() or not build_file.empty()
+                            or minify_code or convert_code)) {
+        std::cerr << "Error! --jit can only be used when running a program!\n";
+        return 1;
+    } else if (use_jit and not Jit::is_supported()) {
+        std::cerr << "Error! --jit isn't supported on this machine!\n";
+        return 1;
+    } else if (use_tracer and (not out_file.empty() or not build_file.empty()
+                               or minify_code or convert_code)) {
+        std::cerr << "Error! --trace can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (use_tracer and use_jit) {
+        std::cerr << "Error! --trace and --jit cannot be used together!\n";
+        return 1;
+    } else if (engine != "stack" and (not out_file.empty()
+                                      or not build_file.empty()
+                                      or minify_code or convert_code)) {
+        std::cerr << "Error! --engine can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (engine != "stack" and (use_jit or use_tracer)) {
+        std::cerr << "Error! The " << engine << " engine cannot be used with "
+                  << (use_jit ? "--jit" : "--trace") << "!\n";
+        return 1;
+    } else if (not profile_file.empty() and (not out_file.empty()
+                                             or not build_file.empty()
+                                             or minify_code or convert_code)) {
+        std::cerr << "Error! --profile can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (not profile_file.empty() and (use_jit or use_tracer or tiered)) {
+        std::cerr << "Error! --profile cannot be used with "
+                  << (use_jit ? "--jit" : use_tracer ? "--trace" : "--tiered")
+                  << "!\n";
+        return 1;
+    } else if (not profile_file.empty() and not Profiler::is_supported()) {
+        std::cerr << "Error! --profile isn't supported on this machine!\n";
+        return 1;
+    } else if (not count_file.empty() and (not out_file.empty()
+                                           or not build_file.empty()
+                                           or minify_code or convert_code)) {
+        std::cerr << "Error! --count-ops can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (not count_file.empty()
+               and (use_jit or use_tracer or tiered or engine != "stack")) {
+        std::cerr << "Error! --count-ops cannot be used with "
+                  << (use_jit ? "--jit" : use_tracer ? "--trace"
+                      : tiered ? "--tiered" : "--engine=" + engine)
+                  << "!\n";
+        return 1;
+    } else if (gc_stats and (not out_file.empty() or not build_file.empty()
+                             or minify_code or convert_code)) {
+        std::cerr << "Error! --gc-stats can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (gc_stats and tiered) {
+        std::cerr << "Error! --gc-stats cannot be used with --tiered!\n";
+        return 1;
+    } else if (snapshot_interval and snapshot_file.empty()) {
+        std::cerr << "Error! --heap-snapshot-every specified without"
+                  << " --heap-snapshot!\n";
+        return 1;
+    } else if (not snapshot_file.empty() and (not out_file.empty()
+                                              or not build_file.empty()
+                                              or minify_code or convert_code)) {
+        std::cerr << "Error! --heap-snapshot can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (not snapshot_file.empty() and tiered) {
+        std::cerr << "Error! --heap-snapshot cannot be used with --tiered!\n";
+        return 1;
+    } else if (tiered and (not out_file.empty() or not build_file.empty()
+                           or minify_code or convert_code)) {
+        std::cerr << "Error! --tiered can only be used when running a"
+                  << " program!\n";
+        return 1;
+    } else if (tiered and not TieredCompiler::is_supported()) {
+        std::cerr << "Error! --tiered isn't supported on this machine!\n";
+        return 1;
+    } else if ((convert_code or minify_code)
+               and (not out_file.empty() or not build_file.empty()))
+    {
         std::cerr << "Error! Cannot " << (convert_code ? "convert" : "minify")
                   << " and compile code at the same time!\n";
         return 1;
@@ -107,9 +369,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     if (not minify_code or convert_code) {
-        for (auto &class_info: classes) {
-            class_info.second.handle_inheritance(classes);
-        }
+        resolve_inheritance(classes);
     }
     if (minify_code or convert_code) {
         std::cout << get_minified_source(classes, width, minify_code, convert_code);
@@ -123,30 +383,147 @@ int main(int argc, char *argv[]) {
     }
 
     if (optimize) {
-        optimize_classes(classes);
+        OptStats stats;
+        PassReports reports;
+        optimize_classes(classes, opt_options, &stats,
+                         time_passes ? &reports : nullptr);
+        if (opt_stats) {
+            for (const auto &[pattern, count]: stats) {
+                std::cerr << pattern << ": " << count << "\n";
+            }
+        }
+        if (time_passes) {
+            std::cerr << std::left << std::setw(12) << "pass"
+                      << std::right << std::setw(6) << "runs"
+                      << std::setw(12) << "time (ms)"
+                      << std::setw(10) << "changes"
+                      << std::setw(10) << "removed" << "\n";
+            for (const auto &[pass_name, report]: reports) {
+                std::cerr << std::left << std::setw(12) << pass_name
+                          << std::right << std::setw(6) << report.runs
+                          << std::setw(12) << std::fixed << std::setprecision(3)
+                          << report.seconds * 1000
+                          << std::setw(10) << report.changes
+                          << std::setw(10) << report.removed << "\n";
+            }
+        }
     }
 
-    if (not out_file.empty()) {
+    if (not out_file.empty() and build_options.split) {
+        return compile_classes_split(classes, out_file);
+    } else if (not out_file.empty()) {
         return compile_classes(classes, out_file);
+    } else if (not build_file.empty()) {
+        return build_executable(classes, build_file, build_options);
     } else {
+        // A program that's already been built is run natively, and otherwise
+        // it's built while it's interpreted. The build finishes before the
+        // interpreter exits
+        std::optional<TieredCompiler> tiered_compiler;
+        if (tiered) {
+            tiered_compiler.emplace(classes);
+            auto status = tiered_compiler->run_native();
+            if (status) {
+                return *status;
+            }
+            tiered_compiler->start_build();
+        }
+
         std::vector<Variable> stack;
         VarMap globals;
         InstanceManager manager{stack, globals};
+        Jit jit;
+        if (use_jit) {
+            manager.set_jit(&jit);
+        }
+        Tracer tracer;
+        if (use_tracer) {
+            manager.set_tracer(&tracer);
+        }
+        RegisterVM register_vm;
+        if (engine == "reg") {
+            manager.set_register_vm(&register_vm);
+        }
+
+        Profiler profiler;
+        if (not profile_file.empty()) {
+            manager.set_profiler(&profiler);
+            profiler.start();
+        }
+
+        OpCounter op_counter;
+        if (not count_file.empty()) {
+            manager.set_op_counter(&op_counter);
+        }
+
+        // Collections are logged as they happen if the environment names a
+        // log, whether or not there's a summary at the end
+        GcStats collection_stats;
+        auto gc_log = std::getenv(GC_LOG_VARIABLE.c_str());
+        if (gc_log and collection_stats.open_log(gc_log)) {
+            std::cerr << "Error! Could not open garbage collection log \""
+                      << gc_log << "\"!\n";
+            return 1;
+        }
+        if (gc_stats or gc_log or not snapshot_file.empty()) {
+            manager.set_gc_stats(&collection_stats);
+        }
+
+        HeapSnapshotter snapshotter{snapshot_file, snapshot_interval};
+        if (not snapshot_file.empty()) {
+            manager.set_heap_snapshotter(&snapshotter);
+            snapshotter.start();
+        }
 
         globals.emplace("_Main", manager.new_instance(classes.at("M")));
         auto main_obj = *globals.at("_Main").get_instance();
 
-        if (classes.at("M").has_function("c__")) {
-            auto ctor = main_obj->get_func("c__");
-            if (ctor->execute(manager, classes, stack, globals)) {
+        bool error = run_constructors(main_obj, manager, classes, stack,
+                                      globals);
+        if (not error) {
+            auto main_func = main_obj->get_func("m");
+            error = main_func->execute(manager, classes, stack, globals);
+        }
+
+        // A program is profiled, its commands counted, and its garbage
+        // collections reported, up to where it stopped, even after an error
+        if (not profile_file.empty()) {
+            profiler.stop();
+            std::cout.flush();
+            if (profiler.write_folded(profile_file)) {
+                std::cerr << "Error! Could not write profile to \""
+                          << profile_file << "\"!\n";
                 return 1;
             }
+            profiler.output_report(std::cerr);
         }
-        auto main_func = main_obj->get_func("m");
-        if (main_func->execute(manager, classes, stack, globals)) {
-            return 1;
-        } else {
-            return 0;
+        if (not count_file.empty()) {
+            std::cout.flush();
+            if (op_counter.write_json(count_file)) {
+                std::cerr << "Error! Could not write command counts to \""
+                          << count_file << "\"!\n";
+                return 1;
+            }
+            op_counter.output_report(std::cerr);
+        }
+        if (gc_stats) {
+            std::cout.flush();
+            collection_stats.output_summary(std::cerr);
+        }
+        if (not snapshot_file.empty()) {
+            snapshotter.stop();
+            std::cout.flush();
+            if (error) {
+                manager.clear_scopes();
+            }
+            auto snapshot = manager.take_heap_snapshot();
+            if (snapshot.write(snapshot_file)) {
+                std::cerr << "Error! Could not write heap snapshot to \""
+                          << snapshot_file << "\"!\n";
+                return 1;
+            }
+            snapshot.output_report(std::cerr);
         }
+        return error ? 1 : 0;
     }
 }
@@ -29,7 +29,7 @@ std::vector<std::string> order_names(const ClassMap &classes) {
 
         for (const auto &[func_name, func_info]: class_info.get_functions()) {
             name_freqs[func_name] += 1;
-            for (const auto &command: func_info) {
+            for (const auto &command: *func_info) {
                 if (command.get_type() == CommandType::LoopBegin) {
                     name_freqs[command.get_loop_var()] += 1;
                 } else if (command.get_type() == CommandType::PushName)
@@ -142,6 +142,18 @@ std::string get_minified_source(ClassMap &classes, std::size_t line_width,
         }
     };
 
+    // Converted code has no inheritance, so each constructor has to call the
+    // constructors that its class inherits itself
+    if (convert_code) {
+        for (auto &class_info: classes) {
+            if (not class_info.second.get_parent_ctors().empty()) {
+                auto ctor = class_info.second.get_chained_constructor();
+                class_info.second.remove_function("c__");
+                class_info.second.add_function("c__", ctor);
+            }
+        }
+    }
+
     std::unordered_map<std::string, std::string> reassigned_names;
     if (minify_code) {
         reassigned_names = reassign_names(classes);
@@ -192,7 +204,7 @@ std::string get_minified_source(ClassMap &classes, std::size_t line_width,
             add_to_source(get_name(func_name));
 
             std::optional<Command> last_command;
-            for (const auto &command: func_info) {
+            for (const auto &command: *func_info) {
                 switch (command.get_type()) {
                     case CommandType::AssignClass:
                         add_to_source("!");
@@ -271,6 +283,12 @@ std::string get_minified_source(ClassMap &classes, std::size_t line_width,
                     case CommandType::AssignTo:
                     case CommandType::FuncCall:
                     case CommandType::NewInst:
+                    case CommandType::LoadVar:
+                    case CommandType::StoreNumber:
+                    case CommandType::StoreString:
+                    case CommandType::CopyVar:
+                    case CommandType::StoreSelf:
+                    case CommandType::LoadField:
                     case CommandType::Nop:
                         assert(false);
                         break;
@@ -0,0 +1,212 @@
+#include "opcount.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <tuple>
+
+// Where a command is in the source, along with its type, as commands copied
+// into classes that inherit them are counted together
+using OpLocation = std::tuple<std::string, int, int, CommandType>;
+
+OpCounter::OpCounter():
+types(NUM_COMMAND_TYPES), pairs(NUM_COMMAND_TYPES * NUM_COMMAND_TYPES),
+triples(NUM_COMMAND_TYPES * NUM_COMMAND_TYPES * NUM_COMMAND_TYPES) {
+}
+
+// Counts a command that's about to run, given the types of the two commands
+// run before it in the same sequence. Nop stands for there not being one, as
+// a Nop is never run
+void OpCounter::record(const Command &command, CommandType before_previous,
+                       CommandType previous)
+{
+    auto type = static_cast<std::size_t>(command.get_type());
+    total++;
+    types[type]++;
+    commands[&command]++;
+    if (previous == CommandType::Nop) {
+        return;
+    }
+    auto pair = static_cast<std::size_t>(previous) * NUM_COMMAND_TYPES + type;
+    pairs[pair]++;
+    if (before_previous != CommandType::Nop) {
+        triples[static_cast<std::size_t>(before_previous) * NUM_COMMAND_TYPES
+                * NUM_COMMAND_TYPES + pair]++;
+    }
+}
+
+// Returns the positions of the counts that aren't zero, from the largest
+// count to the smallest
+std::vector<std::size_t> get_count_order(const std::vector<std::size_t> &counts) {
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] != 0) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return counts[a] > counts[b];
+    });
+    return order;
+}
+
+// Returns the names of the types in a sequence of commands, from its index in
+// a table of pairs or triples of them
+std::vector<std::string> get_sequence_names(std::size_t index,
+                                            std::size_t length)
+{
+    std::vector<std::string> names(length);
+    for (std::size_t i = length; i-- > 0;) {
+        names[i] = get_command_type_name(
+            static_cast<CommandType>(index % NUM_COMMAND_TYPES)
+        );
+        index /= NUM_COMMAND_TYPES;
+    }
+    return names;
+}
+
+// Returns the number of times the commands at each position in the source
+// ran, from the commonest to the rarest
+std::vector<std::pair<OpLocation, std::size_t>> get_location_counts(
+    const std::unordered_map<const Command *, std::size_t> &commands)
+{
+    std::map<OpLocation, std::size_t> counts;
+    for (const auto &[command, count]: commands) {
+        counts[{command->get_file_name(), command->get_line(),
+                command->get_col(), command->get_type()}] += count;
+    }
+    std::vector<std::pair<OpLocation, std::size_t>> sorted{counts.begin(),
+                                                           counts.end()};
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+        return a.second > b.second;
+    });
+    return sorted;
+}
+
+std::string get_location_name(const OpLocation &location) {
+    const auto &[file_name, line, col, type] = location;
+    if (file_name.empty()) {
+        return "(builtin)";
+    }
+    return file_name + ":" + std::to_string(line) + ":" + std::to_string(col);
+}
+
+// Outputs the counts of the commands run, by type, by position in the source,
+// and the commonest pairs and triples of types
+void OpCounter::output_report(std::ostream &out) const {
+    auto percent = [&](std::size_t count) {
+        return total ? 100.0 * count / total : 0.0;
+    };
+
+    out << total << " commands run\n"
+        << std::left << std::setw(32) << "type" << std::right
+        << std::setw(14) << "count" << std::setw(8) << "%" << "\n"
+        << std::fixed << std::setprecision(1);
+    for (auto type: get_count_order(types)) {
+        out << std::left << std::setw(32)
+            << get_command_type_name(static_cast<CommandType>(type))
+            << std::right << std::setw(14) << types[type]
+            << std::setw(8) << percent(types[type]) << "\n";
+    }
+
+    out << "\n" << std::left << std::setw(32) << "location" << std::setw(16)
+        << "type" << std::right << std::setw(14) << "count" << "\n";
+    auto locations = get_location_counts(commands);
+    locations.resize(std::min(locations.size(), OP_COUNT_TOP));
+    for (const auto &[location, count]: locations) {
+        out << std::left << std::setw(32) << get_location_name(location)
+            << std::setw(16) << get_command_type_name(std::get<3>(location))
+            << std::right << std::setw(14) << count << "\n";
+    }
+
+    auto output_sequences = [&](const std::vector<std::size_t> &counts,
+                                std::size_t length, const std::string &title)
+    {
+        out << "\n" << std::left << std::setw(48) << title << std::right
+            << std::setw(14) << "count" << "\n";
+        auto order = get_count_order(counts);
+        order.resize(std::min(order.size(), OP_COUNT_TOP));
+        for (auto index: order) {
+            std::string names;
+            for (const auto &name: get_sequence_names(index, length)) {
+                names += (names.empty() ? "" : " ") + name;
+            }
+            out << std::left << std::setw(48) << names << std::right
+                << std::setw(14) << counts[index] << "\n";
+        }
+    };
+    output_sequences(pairs, 2, "pair");
+    output_sequences(triples, 3, "triple");
+}
+
+// Returns a string as a JSON string literal
+std::string get_json_string(const std::string &str) {
+    std::string json = "\"";
+    for (auto c: str) {
+        if (c == '"' or c == '\\') {
+            json += '\\';
+            json += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[7];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            json += escape;
+        } else {
+            json += c;
+        }
+    }
+    return json + "\"";
+}
+
+// Writes every count to a JSON file, sorted the same way as the report but
+// with nothing left out. Returns whether there was an error
+bool OpCounter::write_json(const std::string &file_name) const {
+    std::ofstream file{file_name};
+    if (not file.is_open()) {
+        return true;
+    }
+
+    file << "{\n  \"total\": " << total << ",\n  \"types\": {";
+    bool first = true;
+    for (auto type: get_count_order(types)) {
+        file << (first ? "\n" : ",\n") << "    "
+             << get_json_string(
+                    get_command_type_name(static_cast<CommandType>(type)))
+             << ": " << types[type];
+        first = false;
+    }
+
+    file << "\n  },\n  \"locations\": [";
+    first = true;
+    for (const auto &[location, count]: get_location_counts(commands)) {
+        const auto &[location_file, line, col, type] = location;
+        file << (first ? "\n" : ",\n") << "    {\"file\": "
+             << get_json_string(location_file) << ", \"line\": " << line
+             << ", \"col\": " << col << ", \"type\": "
+             << get_json_string(get_command_type_name(type))
+             << ", \"count\": " << count << "}";
+        first = false;
+    }
+
+    auto write_sequences = [&](const std::vector<std::size_t> &counts,
+                               std::size_t length)
+    {
+        bool first = true;
+        for (auto index: get_count_order(counts)) {
+            file << (first ? "\n" : ",\n") << "    {\"types\": [";
+            auto names = get_sequence_names(index, length);
+            for (std::size_t i = 0; i < names.size(); i++) {
+                file << (i ? ", " : "") << get_json_string(names[i]);
+            }
+            file << "], \"count\": " << counts[index] << "}";
+            first = false;
+        }
+    };
+    file << "\n  ],\n  \"pairs\": [";
+    write_sequences(pairs, 2);
+    file << "\n  ],\n  \"triples\": [";
+    write_sequences(triples, 3);
+    file << "\n  ]\n}\n";
+    return not file.good();
+}
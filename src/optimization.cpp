@@ -1,147 +1,701 @@
+#include "analysis.hpp"
+#include "cfg.hpp"
+#include "escape.hpp"
+#include "folding.hpp"
 #include "optimization.hpp"
+#include "reachability.hpp"
+#include "types.hpp"
 
-#include <stack>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <unordered_set>
 
-void optimize_instantiations(CommandList &commands, size_t i) {
-    if (i < 2) {
-        return;
+// A sequence of commands that the peephole optimizer replaces with a shorter
+// sequence of commands
+struct PeepholePattern {
+    // The name of the pattern, used when reporting how often it was applied
+    std::string name;
+
+    // The types of the commands in a matching sequence
+    std::vector<CommandType> types;
+
+    // Returns whether a sequence of commands with the right types can be
+    // replaced. If empty, every sequence with the right types is replaced
+    std::function<bool(const Command *)> condition;
+
+    // Returns the commands that replace a matching sequence of commands,
+    // which can't be longer than the sequence
+    std::function<CommandList(const Command *)> replace;
+};
+
+// Returns a command that doesn't use any extra data, positioned at the given
+// command
+Command command_at(CommandType type, const Command &pos) {
+    return {type, pos.get_file_name(), pos.get_line(), pos.get_col()};
+}
+
+// Returns a command with a number, positioned at the given command
+Command command_at(CommandType type, double dval, const Command &pos) {
+    return {type, dval, pos.get_file_name(), pos.get_line(), pos.get_col()};
+}
+
+// Returns a command with a name, positioned at the given command
+Command command_at(CommandType type, const std::string &name,
+                   const Command &pos)
+{
+    return {type, name, pos.get_file_name(), pos.get_line(), pos.get_col()};
+}
+
+// Returns a command with two strings, positioned at the given command
+Command command_at(CommandType type, const std::string &name1,
+                   const std::string &name2, const Command &pos)
+{
+    return {type, name1, name2, pos.get_file_name(), pos.get_line(),
+            pos.get_col()};
+}
+
+// Returns a command with a name and a number, positioned at the given command
+Command command_at(CommandType type, const std::string &name, double dval,
+                   const Command &pos)
+{
+    return {type, name, dval, pos.get_file_name(), pos.get_line(), pos.get_col()};
+}
+
+// The patterns that the peephole optimizer looks for. When several patterns
+// match at the same place, the first one in this list is used. Since the
+// patterns are applied until none of them match, patterns can match commands
+// generated by other patterns
+const std::vector<PeepholePattern> PEEPHOLE_PATTERNS {{
+    {"new-inst", {CommandType::PushName, CommandType::PushName,
+                  CommandType::AssignClass}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::NewInst, cmds[0].get_string(),
+                            cmds[1].get_string(), cmds[2])};
+     }},
+
+    {"func-call", {CommandType::PushName, CommandType::PushName,
+                   CommandType::GetFunction, CommandType::ExecuteFunc}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {{CommandType::FuncCall, cmds[0].get_string(),
+                  cmds[1].get_string(), cmds[2].get_file_name(),
+                  cmds[2].get_line(), cmds[2].get_col(), cmds[3].get_line(),
+                  cmds[3].get_col()}};
+     }},
+
+    {"assign-to", {CommandType::PushName, CommandType::DupElement,
+                   CommandType::AssignValue, CommandType::PopStack},
+     [] (const Command *cmds) {
+         return cmds[1].get_number() == 1;
+     },
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::AssignTo, cmds[0].get_string(),
+                            cmds[1])};
+     }},
+
+    // Assigns the top of the stack to a name, while keeping it on the stack
+    {"assign-keep", {CommandType::PushName, CommandType::DupElement,
+                     CommandType::AssignValue},
+     [] (const Command *cmds) {
+         return cmds[1].get_number() == 1;
+     },
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::DupElement, 0.0, cmds[1]),
+                 command_at(CommandType::AssignTo, cmds[0].get_string(),
+                            cmds[1])};
+     }},
+
+    {"load-var", {CommandType::PushName, CommandType::GetValue}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::LoadVar, cmds[0].get_string(),
+                            cmds[1])};
+     }},
+
+    {"store-number", {CommandType::PushName, CommandType::PushNumber,
+                      CommandType::AssignValue}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::StoreNumber, cmds[0].get_string(),
+                            cmds[1].get_number(), cmds[2])};
+     }},
+
+    {"store-string", {CommandType::PushName, CommandType::PushString,
+                      CommandType::AssignValue}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::StoreString, cmds[0].get_string(),
+                            cmds[1].get_string(), cmds[2])};
+     }},
+
+    {"copy-var", {CommandType::PushName, CommandType::LoadVar,
+                  CommandType::AssignValue}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::CopyVar, cmds[0].get_string(),
+                            cmds[1].get_string(), cmds[1])};
+     }},
+
+    {"store-number-to", {CommandType::PushNumber, CommandType::AssignTo}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::StoreNumber, cmds[1].get_string(),
+                            cmds[0].get_number(), cmds[1])};
+     }},
+
+    {"store-string-to", {CommandType::PushString, CommandType::AssignTo}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::StoreString, cmds[1].get_string(),
+                            cmds[0].get_string(), cmds[1])};
+     }},
+
+    {"copy-var-to", {CommandType::LoadVar, CommandType::AssignTo}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::CopyVar, cmds[1].get_string(),
+                            cmds[0].get_string(), cmds[0])};
+     }},
+
+    {"store-self", {CommandType::PushName, CommandType::AssignSelf}, {},
+     [] (const Command *cmds) -> CommandList {
+         return {command_at(CommandType::StoreSelf, cmds[0].get_string(),
+                            cmds[1])};
+     }},
+
+    // Values that are pushed and immediately popped don't need to be pushed
+    {"drop-name", {CommandType::PushName, CommandType::PopStack}, {},
+     [] (const Command *) -> CommandList {
+         return {};
+     }},
+
+    {"drop-number", {CommandType::PushNumber, CommandType::PopStack}, {},
+     [] (const Command *) -> CommandList {
+         return {};
+     }},
+
+    {"drop-string", {CommandType::PushString, CommandType::PopStack}, {},
+     [] (const Command *) -> CommandList {
+         return {};
+     }},
+}};
+
+// Returns whether the commands starting at the given index match the pattern
+bool matches_pattern(const CommandList &commands, std::size_t i,
+                     const PeepholePattern &pattern)
+{
+    if (i + pattern.types.size() > commands.size()) {
+        return false;
     }
+    for (std::size_t j = 0; j < pattern.types.size(); j++) {
+        if (commands[i + j].get_type() != pattern.types[j]) {
+            return false;
+        }
+    }
+    return not pattern.condition or pattern.condition(&commands[i]);
+}
 
-    if (commands[i - 1].get_type() == CommandType::PushName and
-        commands[i - 2].get_type() == CommandType::PushName)
-    {
-        commands[i] = {CommandType::NewInst,
-                       commands[i - 2].get_string(),
-                       commands[i - 1].get_string(),
-                       commands[i].get_file_name(),
-                       commands[i].get_line(),
-                       commands[i].get_col()};
-        commands[i - 1] = {CommandType::Nop, "", 0, 0};
-        commands[i - 2] = {CommandType::Nop, "", 0, 0};
+// Looks through the list of commands, looking for sequences of commands that
+// we can collapse into fewer commands. The commands that are removed are
+// replaced with NOPs. Returns whether any sequence was collapsed
+bool collapse_commands(CommandList &commands, OptStats *stats) {
+    bool collapsed = false;
+    for (std::size_t i = 0; i < commands.size(); i++) {
+        for (const auto &pattern: PEEPHOLE_PATTERNS) {
+            if (not matches_pattern(commands, i, pattern)) {
+                continue;
+            }
+            auto replacement = pattern.replace(&commands[i]);
+            assert(replacement.size() <= pattern.types.size());
+            for (std::size_t j = 0; j < pattern.types.size(); j++) {
+                if (j < replacement.size()) {
+                    commands[i + j] = replacement[j];
+                } else {
+                    commands[i + j] = {CommandType::Nop, "", 0, 0};
+                }
+            }
+            if (stats) {
+                (*stats)[pattern.name]++;
+            }
+            collapsed = true;
+            i += pattern.types.size() - 1;
+            break;
+        }
     }
+    return collapsed;
 }
 
-void optimize_func_executions(CommandList &commands, size_t i) {
-    if (i < 3) {
-        return;
+// Removes assignments to local variables that are never read. A local is
+// read if its name is used anywhere other than as the target of a store, so
+// names that are pushed, even just to be assigned to, are left alone. Stores
+// of values on the stack become pops, which the peephole optimizer can then
+// remove along with the push. Returns whether any store was removed
+bool remove_dead_stores(CommandList &commands, OptStats *stats) {
+    std::unordered_set<std::string> read;
+    for (const auto &command: commands) {
+        switch (command.get_type()) {
+            case CommandType::PushName:
+            case CommandType::LoadVar:
+                read.insert(command.get_string());
+                break;
+
+            case CommandType::LoopBegin:
+                read.insert(command.get_loop_var());
+                break;
+
+            case CommandType::FuncCall:
+            case CommandType::LoadField:
+                read.insert(command.get_first_name());
+                break;
+
+            case CommandType::CopyVar:
+                read.insert(command.get_second_name());
+                break;
+
+            default:
+                break;
+        }
     }
 
-    if (commands[i - 1].get_type() == CommandType::GetFunction and
-        commands[i - 2].get_type() == CommandType::PushName and
-        commands[i - 3].get_type() == CommandType::PushName)
-    {
-        commands[i] = {CommandType::FuncCall,
-                       commands[i - 3].get_string(),
-                       commands[i - 2].get_string(),
-                       commands[i - 1].get_file_name(),
-                       commands[i - 1].get_line(),
-                       commands[i - 1].get_col(),
-                       commands[i].get_line(),
-                       commands[i].get_col()};
-        commands[i - 1] = {CommandType::Nop, "", 0, 0};
-        commands[i - 2] = {CommandType::Nop, "", 0, 0};
-        commands[i - 3] = {CommandType::Nop, "", 0, 0};
-    }
-}
-
-void optimize_assignments(CommandList &commands, size_t i) {
-    if (i < 2) {
-        return;
-    }
-    if (commands[i - 1].get_type() == CommandType::DupElement and
-        commands[i - 1].get_number() == 1 and
-        commands[i - 2].get_type() == CommandType::PushName)
-    {
-        if (i + 1 < commands.size() and
-            commands[i + 1].get_type() == CommandType::PopStack)
+    auto is_dead = [&] (const std::string &name) {
+        return name[0] == '_' and not read.count(name);
+    };
+
+    bool removed = false;
+    for (auto &command: commands) {
+        auto type = command.get_type();
+        if (type == CommandType::AssignTo and is_dead(command.get_string())) {
+            command = command_at(CommandType::PopStack, command);
+        } else if ((type == CommandType::StoreSelf and
+                    is_dead(command.get_string())) or
+                   ((type == CommandType::StoreNumber or
+                     type == CommandType::StoreString) and
+                    is_dead(command.get_first_name())))
         {
-            commands[i - 2] = {CommandType::AssignTo,
-                               commands[i - 2].get_string(),
-                               commands[i - 1].get_file_name(),
-                               commands[i - 1].get_line(),
-                               commands[i - 1].get_col()};
-            commands[i - 1] = {CommandType::Nop, "", 0, 0};
-            commands[i]     = {CommandType::Nop, "", 0, 0};
-            commands[i + 1] = {CommandType::Nop, "", 0, 0};
+            command = {CommandType::Nop, "", 0, 0};
         } else {
-            commands[i - 1] = {CommandType::AssignTo,
-                               commands[i - 2].get_string(),
-                               commands[i - 1].get_file_name(),
-                               commands[i - 1].get_line(),
-                               commands[i - 1].get_col()};
-            commands[i - 2] = {CommandType::DupElement, 0.0,
-                               commands[i - 1].get_file_name(),
-                               commands[i - 1].get_line(),
-                               commands[i - 1].get_col()};
-            commands[i] = {CommandType::Nop, "", 0, 0};
+            continue;
+        }
+        removed = true;
+        if (stats) {
+            (*stats)["remove-dead-store"]++;
         }
     }
+    return removed;
 }
 
-// Looks through the list of commands, looking for sequences of commands that
-// we can collapse into one command
-void collapse_commands(CommandList &commands) {
-    for (size_t i = 0; i < commands.size(); i++) {
-        switch (commands[i].get_type()) {
-            case CommandType::AssignClass:
-                optimize_instantiations(commands, i);
+// Removes NOP commands from a sequence of commands, moving the jumps of the
+// loops to where their matching commands end up
+void remove_nops(CommandList &commands) {
+    ControlFlowGraph cfg{commands};
+    for (auto &block: cfg.get_blocks()) {
+        auto &block_commands = block.commands;
+        block_commands.erase(
+            std::remove_if(block_commands.begin(), block_commands.end(),
+                [] (const Command &command) {
+                    return command.get_type() == CommandType::Nop;
+                }),
+            block_commands.end());
+    }
+    commands = cfg.linearize();
+}
+
+// The most commands a method can have for calls of it to be inlined
+constexpr std::size_t MAX_INLINE_SIZE = 8;
+
+// Returns the commands of a method rewritten so they can replace a call of the
+// method on the given receiver, or std::nullopt if the method can't be
+// inlined. Local variables are renamed so they can't collide with the
+// caller's, and reads of fields become reads of the receiver's fields.
+// Methods that use their instance in any other way, that call themselves, or
+// that return anywhere other than at their end aren't inlined
+std::optional<CommandList> get_inlined_body(const CommandList &method,
+                                            const std::string &class_name,
+                                            const std::string &method_name,
+                                            const std::string &receiver)
+{
+    if (method.size() > MAX_INLINE_SIZE) {
+        return std::nullopt;
+    }
+
+    // Unless the receiver is a local variable of the caller, the inlined code
+    // could change it by assigning to it or by calling other methods
+    bool stable_receiver = receiver[0] == '_';
+
+    // Returns the name to use for a name in the inlined code, unless the name
+    // belongs to the instance the method was called on
+    auto rename = [&] (const std::string &name,
+                       bool assigned) -> std::optional<std::string>
+    {
+        if (name[0] == '_') {
+            return "_" + class_name + "_" + method_name + name;
+        } else if (std::islower(name[0]) or (assigned and name == receiver)) {
+            return std::nullopt;
+        }
+        return name;
+    };
+
+    CommandList body;
+    for (std::size_t i = 0; i < method.size(); i++) {
+        const auto &command = method[i];
+        const auto &file = command.get_file_name();
+        auto line = command.get_line();
+        auto col = command.get_col();
+        switch (command.get_type()) {
+            case CommandType::DupElement:
+            case CommandType::PopStack:
+            case CommandType::PushNumber:
+            case CommandType::PushString:
+                body.push_back(command);
                 break;
 
-            case CommandType::AssignValue:
-                optimize_assignments(commands, i);
+            // Names pushed to the stack could be used anywhere, so only
+            // global names can be pushed without changing their meaning
+            case CommandType::PushName:
+                if (command.get_string()[0] == '_' or
+                    std::islower(command.get_string()[0]))
+                {
+                    return std::nullopt;
+                }
+                body.push_back(command);
                 break;
 
-            case CommandType::ExecuteFunc:
-                optimize_func_executions(commands, i);
+            case CommandType::LoopBegin:
+            case CommandType::LoopEnd: {
+                auto name = rename(command.get_loop_var(), false);
+                if (not name) {
+                    return std::nullopt;
+                }
+                body.emplace_back(command.get_type(), *name, command.get_jump(),
+                                  file, line, col);
                 break;
+            }
 
-            default:
+            case CommandType::Return:
+                if (i + 1 != method.size()) {
+                    return std::nullopt;
+                }
                 break;
+
+            case CommandType::AssignTo:
+            case CommandType::StoreSelf: {
+                auto name = rename(command.get_string(), true);
+                if (not name or command.get_type() == CommandType::StoreSelf) {
+                    return std::nullopt;
+                }
+                body.emplace_back(CommandType::AssignTo, *name, file, line, col);
+                break;
+            }
+
+            case CommandType::LoadVar: {
+                auto name = command.get_string();
+                if (std::islower(name[0])) {
+                    body.emplace_back(CommandType::LoadField, receiver, name,
+                                      file, line, col);
+                    break;
+                }
+                body.emplace_back(CommandType::LoadVar, *rename(name, false),
+                                  file, line, col);
+                break;
+            }
+
+            case CommandType::StoreNumber: {
+                auto name = rename(command.get_first_name(), true);
+                if (not name) {
+                    return std::nullopt;
+                }
+                body.emplace_back(CommandType::StoreNumber, *name,
+                                  command.get_number(), file, line, col);
+                break;
+            }
+
+            case CommandType::StoreString: {
+                auto name = rename(command.get_first_name(), true);
+                if (not name) {
+                    return std::nullopt;
+                }
+                body.emplace_back(CommandType::StoreString, *name,
+                                  command.get_second_name(), file, line, col);
+                break;
+            }
+
+            case CommandType::CopyVar:
+            case CommandType::LoadField: {
+                bool is_copy = command.get_type() == CommandType::CopyVar;
+                auto name1 = rename(command.get_first_name(), is_copy);
+                auto name2 = is_copy ? rename(command.get_second_name(), false)
+                                     : command.get_second_name();
+                if (not name1 or not name2) {
+                    return std::nullopt;
+                }
+                body.emplace_back(command.get_type(), *name1, *name2, file,
+                                  line, col);
+                break;
+            }
+
+            case CommandType::FuncCall:
+            case CommandType::NewInst: {
+                bool is_call = command.get_type() == CommandType::FuncCall;
+                auto name = rename(command.get_first_name(), not is_call);
+                if (not name or not stable_receiver or
+                    (is_call and command.get_second_name() == method_name) or
+                    (not is_call and std::islower(command.get_second_name()[0])))
+                {
+                    return std::nullopt;
+                }
+                body.emplace_back(command.get_type(), *name,
+                                  command.get_second_name(), file, line, col,
+                                  command.get_2nd_line(), command.get_2nd_col());
+                break;
+            }
+
+            // These use names that aren't known statically, or the instance
+            // the method was called on
+            case CommandType::AssignClass:
+            case CommandType::AssignSelf:
+            case CommandType::AssignValue:
+            case CommandType::ExecuteFunc:
+            case CommandType::GetFunction:
+            case CommandType::GetValue:
+            case CommandType::BuiltinFunction:
+            case CommandType::Nop:
+                return std::nullopt;
         }
     }
+    return body;
 }
 
-// Removes NOP commands from a sequence of commands
-void remove_nops(CommandList &commands) {
-    // Number of NOP commands that we have removed so far
-    size_t to_replace = 0;
-
-    // Since we may have moved the beginnings and endings of loops in the
-    // code, we need to update the jump_vals with updated locations, which
-    // we keep in a stack
-    std::stack<std::size_t> loop_stack;
-
-    for (size_t i = 0; i < commands.size() - to_replace;) {
-        commands[i] = commands[i + to_replace];
-        if (commands[i].get_type() == CommandType::Nop) {
-            to_replace++;
+// Replaces calls of small methods on receivers with known classes with the
+// commands of the methods. Returns whether any call was inlined
+bool inline_calls(CommandList &commands, const ClassMap &classes,
+                  const NameClassMap &receivers, OptStats *stats)
+{
+    CommandList inlined;
+    bool changed = false;
+    for (const auto &command: commands) {
+        if (command.get_type() != CommandType::FuncCall) {
+            inlined.push_back(command);
+            continue;
+        }
+        auto receiver = receivers.find(command.get_first_name());
+        if (receiver == receivers.end() or not classes.count(receiver->second)) {
+            inlined.push_back(command);
+            continue;
+        }
+        const auto &callee_class = classes.at(receiver->second);
+        if (not callee_class.has_function(command.get_second_name())) {
+            inlined.push_back(command);
+            continue;
+        }
+        auto body = get_inlined_body(
+            callee_class.get_function(command.get_second_name()),
+            receiver->second, command.get_second_name(), receiver->first);
+        if (not body) {
+            inlined.push_back(command);
             continue;
-        } else if (commands[i].get_type() == CommandType::LoopBegin) {
-            loop_stack.push(i);
-        } else if (commands[i].get_type() == CommandType::LoopEnd) {
-            auto loop_start = loop_stack.top();
-            commands[loop_start].set_jump(i);
-            commands[i].set_jump(loop_start);
-            loop_stack.pop();
         }
-        i++;
+        inlined.insert(inlined.end(), body->begin(), body->end());
+        changed = true;
+        if (stats) {
+            (*stats)["inline-call"]++;
+        }
     }
 
-    // Get rid of additional commands at the end of the command list
-    commands.erase(commands.end() - to_replace, commands.end());
+    if (changed) {
+        commands = std::move(inlined);
+        // Fixes the jumps of the loops that were moved
+        remove_nops(commands);
+    }
+    return changed;
 }
 
-// Optimizes the functions in a class
-void optimize_class(Class &to_optimize) {
-    for (auto &func_info: to_optimize.get_functions()) {
-        auto &commands = to_optimize.get_function(func_info.first);
-        collapse_commands(commands);
-        remove_nops(commands);
+// Inlines small methods in every method of the program, returning whether any
+// call was inlined
+bool inline_methods(ClassMap &classes, OptStats *stats) {
+    ClassInference inference{classes};
+    bool changed = false;
+    for (auto &[class_name, class_info]: classes) {
+        for (auto &func_info: class_info.get_functions()) {
+            auto &commands = class_info.get_function(func_info.first);
+            auto receivers = inference.get_scope(class_name, commands);
+            changed |= inline_calls(commands, classes, receivers, stats);
+        }
     }
+    return changed;
 }
 
-void optimize_classes(ClassMap &classes) {
+// Runs the peephole optimizer over every method until none of its patterns
+// apply, returning whether anything was replaced
+bool collapse_methods(ClassMap &classes, OptStats *stats) {
+    bool changed = false;
     for (auto &class_info: classes) {
-        optimize_class(class_info.second);
+        auto &to_optimize = class_info.second;
+        for (auto &func_info: to_optimize.get_functions()) {
+            auto &commands = to_optimize.get_function(func_info.first);
+            while (collapse_commands(commands, stats)) {
+                remove_nops(commands);
+                changed = true;
+            }
+        }
     }
+    return changed;
+}
+
+// Removes the code that can never run from every method, returning whether
+// any was removed
+bool remove_method_dead_code(ClassMap &classes, OptStats *stats) {
+    bool changed = false;
+    for (auto &class_info: classes) {
+        auto &to_optimize = class_info.second;
+        for (auto &func_info: to_optimize.get_functions()) {
+            auto &commands = to_optimize.get_function(func_info.first);
+            changed |= remove_unreachable_code(commands, stats);
+        }
+    }
+    return changed;
+}
+
+// Removes the dead stores from every method, returning whether any were removed
+bool remove_method_dead_stores(ClassMap &classes, OptStats *stats) {
+    bool changed = false;
+    for (auto &class_info: classes) {
+        auto &to_optimize = class_info.second;
+        for (auto &func_info: to_optimize.get_functions()) {
+            auto &commands = to_optimize.get_function(func_info.first);
+            if (remove_dead_stores(commands, stats)) {
+                remove_nops(commands);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Returns the number of commands in every method of the program
+std::size_t count_commands(const ClassMap &classes) {
+    std::size_t num_commands = 0;
+    for (const auto &class_info: classes) {
+        for (const auto &func_info: class_info.second.get_functions()) {
+            num_commands += func_info.second->size();
+        }
+    }
+    return num_commands;
+}
+
+// Returns the options that run the passes of the given optimization level,
+// or std::nullopt if there's no such level. -O0 runs nothing, -O1 only runs
+// the passes that look at one method at a time, -O2 adds the passes that look
+// at how classes and methods use each other, and -O3 adds the passes that
+// follow types and instances through the whole program
+std::optional<OptOptions> get_opt_level(int level) {
+    static const std::vector<std::vector<std::string>> level_passes = {
+        {},
+        {"peephole", "dead-stores", "dead-code"},
+        {"unreachable", "inline", "fold"},
+        {"types", "escape"}
+    };
+    if (level < 0 or level > MAX_OPT_LEVEL) {
+        return std::nullopt;
+    }
+
+    OptOptions options;
+    options.passes.clear();
+    for (int i = 1; i <= level; i++) {
+        options.passes.insert(level_passes[i].begin(), level_passes[i].end());
+    }
+    return options;
+}
+
+// Optimizes every class with the enabled passes, after removing the classes
+// and methods that can't be used. Inlining and folding constants can leave
+// behind new sequences for the peephole optimizer, which can in turn expose
+// more calls and constants, so they're repeated until none of them finds
+// anything to do. If given, what each pass did is added to the reports
+void optimize_classes(ClassMap &classes, const OptOptions &options,
+                      OptStats *stats, PassReports *reports)
+{
+    // The changes made by each pass are counted from the stats, so they have
+    // to be kept even if the caller doesn't want them
+    OptStats local_stats;
+    if (not stats) {
+        stats = &local_stats;
+    }
+    auto total_changes = [&] () {
+        std::size_t changes = 0;
+        for (const auto &stat: *stats) {
+            changes += stat.second;
+        }
+        return changes;
+    };
+
+    if (reports) {
+        for (const auto &pass_name: OPT_PASSES) {
+            if (options.passes.count(pass_name)) {
+                reports->emplace_back(pass_name, PassReport{});
+            }
+        }
+    }
+
+    // Runs the pass with the given name if it's enabled, returning whether it
+    // changed anything
+    auto run_pass = [&] (const std::string &pass_name,
+                         const std::function<bool()> &pass) {
+        if (not options.passes.count(pass_name)) {
+            return false;
+        } else if (not reports) {
+            return pass();
+        }
+
+        auto changes_before = total_changes();
+        auto commands_before = count_commands(classes);
+        auto start = std::chrono::steady_clock::now();
+        bool changed = pass();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        for (auto &[report_name, report]: *reports) {
+            if (report_name == pass_name) {
+                report.runs++;
+                report.seconds += elapsed.count();
+                report.changes += total_changes() - changes_before;
+                report.removed += static_cast<long long>(commands_before)
+                                  - static_cast<long long>(count_commands(classes));
+            }
+        }
+        return changed;
+    };
+
+    run_pass("unreachable", [&] () {
+        remove_unreachable(classes, stats);
+        return false;
+    });
+
+    bool changed;
+    do {
+        bool collapsed;
+        do {
+            collapsed = run_pass("peephole", [&] () {
+                return collapse_methods(classes, stats);
+            });
+            collapsed |= run_pass("dead-stores", [&] () {
+                return remove_method_dead_stores(classes, stats);
+            });
+            collapsed |= run_pass("dead-code", [&] () {
+                return remove_method_dead_code(classes, stats);
+            });
+        } while (collapsed);
+        changed = run_pass("inline", [&] () {
+            return inline_methods(classes, stats);
+        });
+        changed |= run_pass("fold", [&] () {
+            return fold_constants(classes, stats);
+        });
+    } while (changed);
+
+    // The types are proven once the code is in its final form, which can
+    // leave instances that are only used to call builtins unused
+    run_pass("types", [&] () {
+        annotate_types(classes, stats);
+        return false;
+    });
+    run_pass("escape", [&] () {
+        remove_unused_instances(classes, stats);
+        return false;
+    });
 }
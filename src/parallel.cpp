@@ -0,0 +1,34 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Calls the given function for every index from 0 to count - 1, spreading the
+// calls across as many threads as the machine has cores. The function must be
+// safe to call from several threads at once
+void parallel_for(std::size_t count, const std::function<void(std::size_t)> &func) {
+    std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, count);
+
+    std::atomic<std::size_t> next_index{0};
+    auto worker = [&] () {
+        for (auto i = next_index++; i < count; i = next_index++) {
+            func(i);
+        }
+    };
+
+    if (num_threads <= 1) {
+        worker();
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
@@ -187,7 +187,7 @@ std::optional<std::string> get_string(File &file) {
 // Returns a list of commands from the file, ended by a given character, or
 // returns nullopt if there's some sort of parsing error
 std::optional<CommandList> get_commands(File &file) {
-    std::stack<int> loop_stack;
+    std::stack<std::size_t> loop_stack;
     std::stack<std::pair<int, int>> loop_locs;
     CommandList commands;
     char c;
@@ -256,7 +256,7 @@ std::optional<CommandList> get_commands(File &file) {
                     return std::nullopt;
                 }
                 loop_stack.push(commands.size());
-                add_command(CommandType::LoopBegin, *name, 0);
+                add_command(CommandType::LoopBegin, *name, std::size_t{0});
                 break;
             }
 
@@ -0,0 +1,199 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#if defined(__unix__)
+#include <sys/time.h>
+#define PROFILE_SUPPORTED 1
+#else
+#define PROFILE_SUPPORTED 0
+#endif
+
+// Where the timer's signal notes that a sample is due. A signal handler can't
+// be given anything, so this is the one place the profiler that's running can
+// be found from it
+volatile std::sig_atomic_t *due_flag = nullptr;
+
+void note_sample_due(int) {
+    if (due_flag) {
+        *due_flag = 1;
+    }
+}
+
+Profiler::~Profiler() {
+    stop();
+}
+
+// Returns whether programs can be profiled on this machine
+bool Profiler::is_supported() {
+    return PROFILE_SUPPORTED;
+}
+
+// Starts the timer that samples the program
+void Profiler::start() {
+#if PROFILE_SUPPORTED
+    start_time = std::clock();
+    due_flag = &sample_due;
+    struct sigaction action = {};
+    action.sa_handler = note_sample_due;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, nullptr);
+
+    itimerval timer = {};
+    timer.it_interval.tv_usec = PROFILE_INTERVAL_US;
+    timer.it_value.tv_usec = PROFILE_INTERVAL_US;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
+
+// Stops sampling the program
+void Profiler::stop() {
+#if PROFILE_SUPPORTED
+    if (due_flag != &sample_due) {
+        return;
+    }
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    due_flag = nullptr;
+    stop_time = std::clock();
+#endif
+}
+
+// Takes a sample that's due before a function starts, as it belongs to the
+// call that started it
+void Profiler::enter_function(const CommandList &commands, const Class &type,
+                              const std::string &method_name)
+{
+    if (sample_due) {
+        take_sample();
+    }
+    auto [found, added] = method_indexes.emplace(std::pair{&commands, &type},
+                                                 method_names.size());
+    if (added) {
+        method_names.push_back(type.get_name() + "." + method_name);
+    }
+    frames.emplace_back(found->second, nullptr);
+}
+
+// Takes a sample that's due before a function returns, as it still belongs to
+// the function
+void Profiler::leave_function() {
+    if (sample_due) {
+        take_sample();
+    }
+    frames.pop_back();
+}
+
+// Takes a sample that's due, which belongs to the command that was running
+// before this one, if there was one, and then notes the command as running
+void Profiler::at(const Command &command) {
+    auto &frame = frames.back();
+    if (not frame.second) {
+        frame.second = &command;
+    }
+    if (sample_due) {
+        take_sample();
+    }
+    frame.second = &command;
+}
+
+void Profiler::take_sample() {
+    sample_due = 0;
+    samples[frames]++;
+    num_samples++;
+}
+
+// Returns the name of a frame as Class.method, followed by the position of the
+// command it was running, which a builtin doesn't have
+std::string Profiler::get_frame_name(const ProfileFrame &frame) const {
+    auto name = method_names[frame.first];
+    if (frame.second and not frame.second->get_file_name().empty()) {
+        name += " (" + frame.second->get_file_name() + ":"
+                + std::to_string(frame.second->get_line()) + ":"
+                + std::to_string(frame.second->get_col()) + ")";
+    }
+    return name;
+}
+
+// Writes each stack sampled, with its frames from the outermost in, separated
+// by semicolons, followed by the number of times it was sampled, which is the
+// folded form flame graph tools take. Returns whether there was an error
+bool Profiler::write_folded(const std::string &file_name) const {
+    std::ofstream file{file_name};
+    if (not file.is_open()) {
+        return true;
+    }
+
+    // Stacks that only differ in commands that aren't shown are merged
+    std::map<std::string, std::size_t> folded;
+    for (const auto &[stack, count]: samples) {
+        std::string line;
+        for (const auto &frame: stack) {
+            if (not line.empty()) {
+                line += ';';
+            }
+            line += get_frame_name(frame);
+        }
+        folded[line] += count;
+    }
+    for (const auto &[line, count]: folded) {
+        file << line << " " << count << "\n";
+    }
+    return not file.good();
+}
+
+// Outputs a table of the methods that most of the time was spent in, by the
+// time spent running their own commands, and the time spent with them
+// anywhere on the stack, counting recursive calls once
+void Profiler::output_report(std::ostream &out) const {
+    std::vector<std::size_t> self(method_names.size());
+    std::vector<std::size_t> total(method_names.size());
+    std::vector<bool> on_stack(method_names.size());
+    for (const auto &[stack, count]: samples) {
+        self[stack.back().first] += count;
+        for (const auto &frame: stack) {
+            if (not on_stack[frame.first]) {
+                on_stack[frame.first] = true;
+                total[frame.first] += count;
+            }
+        }
+        for (const auto &frame: stack) {
+            on_stack[frame.first] = false;
+        }
+    }
+
+    std::vector<std::size_t> order(method_names.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+        return self[a] != self[b] ? self[a] > self[b] : total[a] > total[b];
+    });
+    order.resize(std::min(order.size(), PROFILE_TOP_METHODS));
+
+    auto percent = [&](std::size_t count) {
+        return num_samples ? 100.0 * count / num_samples : 0.0;
+    };
+    double total_ms = 1000.0 * (stop_time - start_time) / CLOCKS_PER_SEC;
+    auto ms = [&](std::size_t count) {
+        return total_ms * percent(count) / 100.0;
+    };
+    out << num_samples << " samples over " << std::fixed
+        << std::setprecision(1) << total_ms << " ms of CPU time\n"
+        << std::left << std::setw(24) << "method"
+        << std::right << std::setw(12) << "self (ms)" << std::setw(8) << "self%"
+        << std::setw(12) << "total (ms)" << std::setw(8) << "total%" << "\n";
+    for (auto i: order) {
+        if (total[i] == 0) {
+            break;
+        }
+        out << std::left << std::setw(24) << method_names[i]
+            << std::right << std::setw(12) << ms(self[i])
+            << std::setw(8) << percent(self[i])
+            << std::setw(12) << ms(total[i])
+            << std::setw(8) << percent(total[i]) << "\n";
+    }
+}
@@ -0,0 +1,82 @@
+#include "reachability.hpp"
+
+#include <cctype>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Removes the classes and methods that can never be used by the program.
+// Classes can only be instantiated, and methods can only be called, using
+// names that appear in the code that runs, so starting from the main class's
+// main method and constructor, every class and method whose name appears in
+// a method that can run is marked as used, along with the code of the methods
+// that this makes able to run, until nothing new is found
+void remove_unreachable(ClassMap &classes, OptStats *stats) {
+    std::unordered_set<std::string> used_classes{"M"};
+    std::unordered_set<std::string> used_methods{"m", "c__"};
+
+    // The methods that are known to be able to run, by class and name
+    std::set<std::pair<std::string, std::string>> scanned;
+
+    auto use_name = [&] (const std::string &name) {
+        if (std::isupper(name[0]) and classes.count(name)) {
+            used_classes.insert(name);
+        } else if (std::islower(name[0])) {
+            used_methods.insert(name);
+        }
+    };
+
+    bool changed;
+    do {
+        changed = false;
+        std::vector<std::string> to_scan(used_classes.begin(), used_classes.end());
+        for (const auto &class_name: to_scan) {
+            // Creating an instance runs the constructors the class inherits
+            for (const auto &ctor_name: classes.at(class_name).get_parent_ctors()) {
+                used_methods.insert(ctor_name);
+            }
+            const auto &functions = classes.at(class_name).get_functions();
+            for (const auto &[func_name, body]: functions) {
+                if (not used_methods.count(func_name) or
+                    not scanned.emplace(class_name, func_name).second)
+                {
+                    continue;
+                }
+                changed = true;
+                for (const auto &command: *body) {
+                    if (command.get_type() == CommandType::PushName) {
+                        use_name(command.get_string());
+                    } else if (command.get_type() == CommandType::FuncCall
+                               or command.get_type() == CommandType::NewInst) {
+                        use_name(command.get_second_name());
+                    }
+                }
+            }
+        }
+    } while (changed);
+
+    for (auto class_info = classes.begin(); class_info != classes.end();) {
+        if (not used_classes.count(class_info->first)) {
+            if (stats) {
+                (*stats)["remove-class"]++;
+            }
+            class_info = classes.erase(class_info);
+            continue;
+        }
+        std::vector<std::string> unused;
+        for (const auto &func_info: class_info->second.get_functions()) {
+            if (not used_methods.count(func_info.first)) {
+                unused.push_back(func_info.first);
+            }
+        }
+        for (const auto &func_name: unused) {
+            class_info->second.remove_function(func_name);
+            if (stats) {
+                (*stats)["remove-method"]++;
+            }
+        }
+        class_info++;
+    }
+}
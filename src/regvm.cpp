@@ -0,0 +1,646 @@
+#include "regvm.hpp"
+#include "instance.hpp"
+#include "instanceManager.hpp"
+#include "profile.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+
+// A value pushed by a method's commands that the lowered method keeps track
+// of instead of pushing, which is either one of its constants, or in one of
+// its registers. A name constant keeps its name, so that commands that take a
+// name from the stack can be lowered to use the variable directly
+struct Operand {
+    bool constant;
+    std::size_t index;
+    const std::string *name;
+};
+
+// Returns whether a builtin is one of the math builtins taking two numbers and
+// returning one, which the engine runs directly on registers
+bool is_register_math(Builtin builtin) {
+    switch (builtin) {
+        case Builtin::MathAdd:
+        case Builtin::MathSub:
+        case Builtin::MathMult:
+        case Builtin::MathDiv:
+        case Builtin::MathMod:
+        case Builtin::MathEqual:
+        case Builtin::MathNotEqual:
+        case Builtin::MathLessThan:
+        case Builtin::MathLessOrEqual:
+        case Builtin::MathGreaterThan:
+        case Builtin::MathGreaterOrEqual:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Returns the names a command uses directly, which may be local variables
+std::vector<const std::string *> get_command_names(const Command &command) {
+    switch (command.get_type()) {
+        case CommandType::PushName:
+        case CommandType::AssignTo:
+        case CommandType::LoadVar:
+        case CommandType::StoreSelf:
+            return {&command.get_string()};
+
+        case CommandType::FuncCall:
+        case CommandType::NewInst:
+        case CommandType::StoreString:
+        case CommandType::StoreNumber:
+        case CommandType::LoadField:
+            return {&command.get_first_name()};
+
+        case CommandType::CopyVar:
+            return {&command.get_first_name(), &command.get_second_name()};
+
+        case CommandType::LoopBegin:
+        case CommandType::LoopEnd:
+            return {&command.get_loop_var()};
+
+        default:
+            return {};
+    }
+}
+
+// Lowers a method's commands to register code. Values pushed by its commands
+// are followed at compile time, and only pushed for real before a command that
+// has to find them on the stack, or at the boundaries of loops, so that every
+// pass through a loop starts and ends with them on the stack
+std::unique_ptr<RegMethod> lower_method(const CommandList &commands) {
+    auto method = std::make_unique<RegMethod>();
+    auto &ops = method->ops;
+    std::vector<Operand> operands;
+    std::unordered_map<std::string, std::size_t> field_slots;
+
+    // Every local variable the commands name gets a register up front, so that
+    // commands run by the interpreter's code find the same variables as the
+    // lowered ones. Local variables named only at run time are left in the
+    // frame's locals
+    for (const auto &command: commands) {
+        for (auto name: get_command_names(command)) {
+            if ((*name)[0] == '_' and not method->locals.count(*name)) {
+                method->locals.emplace(*name, method->num_registers++);
+            }
+        }
+    }
+
+    auto add_op = [&](RegOpType type, const Command &command) -> RegOp & {
+        ops.emplace_back();
+        ops.back().type = type;
+        ops.back().command = &command;
+        return ops.back();
+    };
+    auto add_constant = [&](Variable var) {
+        method->constants.push_back(var);
+        return method->constants.size() - 1;
+    };
+    auto set_place = [&](RegOp &op, const std::string &name) {
+        op.name = &name;
+        if (name[0] == '_') {
+            op.place = RegPlace::Local;
+            op.index = method->locals.at(name);
+        } else if (std::islower(name[0])) {
+            op.place = RegPlace::Field;
+            auto [slot, added] = field_slots.emplace(name,
+                                                     method->fields.size());
+            if (added) {
+                method->fields.push_back(name);
+            }
+            op.index = slot->second;
+        } else {
+            op.place = RegPlace::Global;
+        }
+    };
+
+    // Puts an operand in a register, if it isn't in one already
+    auto get_register = [&](const Operand &operand, const Command &command) {
+        if (not operand.constant) {
+            return operand.index;
+        }
+        auto &op = add_op(RegOpType::Const, command);
+        op.dst = method->num_registers++;
+        op.src1 = operand.index;
+        return op.dst;
+    };
+
+    // Pushes every operand that hasn't been pushed yet
+    auto flush = [&](const Command &command) {
+        for (const auto &operand: operands) {
+            auto &op = add_op(operand.constant ? RegOpType::PushConst
+                                               : RegOpType::Push, command);
+            op.src1 = operand.index;
+        }
+        operands.clear();
+    };
+
+    auto load = [&](const std::string &name, const Command &command) {
+        auto &op = add_op(RegOpType::Load, command);
+        op.dst = method->num_registers++;
+        set_place(op, name);
+        operands.push_back({false, op.dst, nullptr});
+    };
+    auto store = [&](const std::string &name, const Operand &operand,
+                     const Command &command) {
+        auto &op = add_op(operand.constant ? RegOpType::StoreConst
+                                           : RegOpType::Store, command);
+        op.src1 = operand.index;
+        set_place(op, name);
+    };
+    auto load_self = [&](const Command &command) {
+        auto &op = add_op(RegOpType::LoadSelf, command);
+        op.dst = method->num_registers++;
+        return Operand{false, op.dst, nullptr};
+    };
+    auto run = [&](const Command &command) {
+        flush(command);
+        add_op(RegOpType::Run, command);
+    };
+
+    // The LoopBegin instruction of each LoopBegin command
+    std::unordered_map<std::size_t, std::size_t> loop_begins;
+
+    for (std::size_t i = 0; i < commands.size(); i++) {
+        const auto &command = commands[i];
+        switch (command.get_type()) {
+            case CommandType::PushName:
+                operands.push_back({true, add_constant({VarType::Name,
+                                                        command.get_string()}),
+                                    &command.get_string()});
+                break;
+
+            case CommandType::PushNumber:
+                operands.push_back({true, add_constant(command.get_number()),
+                                    nullptr});
+                break;
+
+            case CommandType::PushString:
+                operands.push_back({true, add_constant({VarType::String,
+                                                        command.get_string()}),
+                                    nullptr});
+                break;
+
+            // Registers are never changed once they're given a value pushed
+            // by a command, so a duplicate can share the register
+            case CommandType::DupElement: {
+                auto dup = static_cast<std::size_t>(command.get_number());
+                if (dup < operands.size()) {
+                    operands.push_back(operands[operands.size() - dup - 1]);
+                } else {
+                    run(command);
+                }
+                break;
+            }
+
+            case CommandType::PopStack:
+                if (operands.empty()) {
+                    run(command);
+                } else {
+                    operands.pop_back();
+                }
+                break;
+
+            case CommandType::LoadVar:
+                load(command.get_string(), command);
+                break;
+
+            case CommandType::AssignTo:
+                if (operands.empty()) {
+                    run(command);
+                } else {
+                    store(command.get_string(), operands.back(), command);
+                    operands.pop_back();
+                }
+                break;
+
+            case CommandType::StoreNumber:
+                store(command.get_first_name(),
+                      {true, add_constant(command.get_number()), nullptr},
+                      command);
+                break;
+
+            case CommandType::StoreString:
+                store(command.get_first_name(),
+                      {true, add_constant({VarType::String,
+                                           command.get_second_name()}),
+                       nullptr},
+                      command);
+                break;
+
+            case CommandType::CopyVar:
+                load(command.get_second_name(), command);
+                store(command.get_first_name(), operands.back(), command);
+                operands.pop_back();
+                break;
+
+            case CommandType::StoreSelf:
+                store(command.get_string(), load_self(command), command);
+                break;
+
+            case CommandType::AssignValue:
+                if (operands.size() >= 2 and operands[operands.size() - 2].name) {
+                    store(*operands[operands.size() - 2].name,
+                          operands.back(), command);
+                    operands.resize(operands.size() - 2);
+                } else {
+                    run(command);
+                }
+                break;
+
+            case CommandType::GetValue:
+                if (not operands.empty() and operands.back().name) {
+                    auto name = operands.back().name;
+                    operands.pop_back();
+                    load(*name, command);
+                } else {
+                    run(command);
+                }
+                break;
+
+            case CommandType::AssignSelf:
+                if (not operands.empty() and operands.back().name) {
+                    auto name = operands.back().name;
+                    operands.pop_back();
+                    store(*name, load_self(command), command);
+                } else {
+                    run(command);
+                }
+                break;
+
+            case CommandType::LoadField: {
+                auto &op = add_op(RegOpType::LoadObjectField, command);
+                op.dst = method->num_registers++;
+                op.field_name = &command.get_second_name();
+                set_place(op, command.get_first_name());
+                operands.push_back({false, op.dst, nullptr});
+                break;
+            }
+
+            // A resolved builtin whose arguments were all pushed by the
+            // method runs on registers. Its results are registers too
+            case CommandType::FuncCall: {
+                auto builtin = command.get_resolved_builtin();
+                if (not builtin) {
+                    run(command);
+                    break;
+                }
+                auto [pops, pushes] = builtin_stack_effect(*builtin);
+                auto num_args = static_cast<std::size_t>(pops);
+                if (operands.size() < num_args) {
+                    run(command);
+                    break;
+                }
+                std::vector<std::size_t> args;
+                for (auto j = operands.size() - num_args; j < operands.size();
+                     j++)
+                {
+                    args.push_back(get_register(operands[j], command));
+                }
+                operands.resize(operands.size() - num_args);
+
+                auto &op = add_op(is_register_math(*builtin) ? RegOpType::Math
+                                                             : RegOpType::Builtin,
+                                  command);
+                op.builtin = *builtin;
+                op.check_types = not command.is_unchecked();
+                if (op.type == RegOpType::Math) {
+                    op.src1 = args[0];
+                    op.src2 = args[1];
+                    op.dst = method->num_registers++;
+                    operands.push_back({false, op.dst, nullptr});
+                } else {
+                    op.args = args;
+                    for (int j = 0; j < pushes; j++) {
+                        op.results.push_back(method->num_registers);
+                        operands.push_back({false, method->num_registers++,
+                                            nullptr});
+                    }
+                }
+                break;
+            }
+
+            case CommandType::LoopBegin: {
+                flush(command);
+                loop_begins[i] = ops.size();
+                set_place(add_op(RegOpType::LoopBegin, command),
+                          command.get_loop_var());
+                break;
+            }
+
+            case CommandType::LoopEnd: {
+                flush(command);
+                auto begin = loop_begins.at(command.get_jump());
+                auto &op = add_op(RegOpType::LoopEnd, command);
+                set_place(op, command.get_loop_var());
+                op.target = begin + 1;
+                ops[begin].target = ops.size();
+                break;
+            }
+
+            case CommandType::AssignClass:
+            case CommandType::ExecuteFunc:
+            case CommandType::GetFunction:
+            case CommandType::NewInst:
+            case CommandType::Return:
+            case CommandType::BuiltinFunction:
+                run(command);
+                break;
+
+            case CommandType::Nop:
+                break;
+        }
+    }
+
+    if (not commands.empty()) {
+        flush(commands.back());
+    }
+    return method;
+}
+
+// Runs a builtin on registers, returning whether there was an error. The
+// builtin's arguments are put on a stack of its own for it, so its errors are
+// the same as when it's run on the program's stack
+bool RegisterVM::run_builtin(const RegOp &op, Function *func, Frame &frame,
+                             std::vector<std::optional<Variable>> &registers)
+{
+    scratch.clear();
+    if (op.type == RegOpType::Math) {
+        scratch.push_back(*registers[op.src1]);
+        scratch.push_back(*registers[op.src2]);
+    } else {
+        for (auto arg: op.args) {
+            scratch.push_back(*registers[arg]);
+        }
+    }
+
+    if (handle_builtin(op.builtin, scratch, frame.globals, op.check_types)) {
+        std::cerr << "Stack trace:\n";
+        func->output_stack_trace_line(op.command->get_file_name(),
+                                      op.command->get_2nd_line(),
+                                      op.command->get_2nd_col());
+        return true;
+    }
+
+    if (op.type == RegOpType::Math) {
+        registers[op.dst] = scratch.back();
+    } else {
+        assert(scratch.size() == op.results.size());
+        for (std::size_t i = 0; i < op.results.size(); i++) {
+            registers[op.results[i]] = scratch[i];
+        }
+    }
+    return false;
+}
+
+// Runs a function with the register engine, lowering it first if it's the
+// first time it's run. Returns whether there was an error of some sort
+bool RegisterVM::run(const CommandList &commands, Function *func, Frame &frame)
+{
+    auto &lowered = methods[&commands];
+    if (not lowered) {
+        lowered = lower_method(commands);
+    }
+    const auto &method = *lowered;
+    const auto &ops = method.ops;
+
+    std::vector<std::optional<Variable>> registers(method.num_registers);
+    frame.local_registers = &method.locals;
+    frame.registers = &registers;
+    frame.manager.new_scope(func, &frame.locals, &registers);
+
+    // Where each field of the running instance is kept, found the first time
+    // it's used. Fields are never removed, and don't move when the instance
+    // does, so they're only looked for once
+    std::vector<Variable *> fields(method.fields.size());
+    auto get_field = [&](std::size_t slot) {
+        if (not fields[slot]) {
+            fields[slot] = func->cur_obj->find_var(method.fields[slot]);
+        }
+        return fields[slot];
+    };
+
+    // Returns the variable in an instruction's place, or nullptr if it isn't
+    // defined
+    auto get_place = [&](const RegOp &op) -> Variable * {
+        switch (op.place) {
+            case RegPlace::Local: {
+                auto &reg = registers[op.index];
+                return reg ? &*reg : nullptr;
+            }
+
+            case RegPlace::Field:
+                return get_field(op.index);
+
+            case RegPlace::Global: {
+                auto found = frame.globals.find(*op.name);
+                return found == frame.globals.end() ? nullptr : &found->second;
+            }
+        }
+        return nullptr;
+    };
+    auto set_place = [&](const RegOp &op, const Variable &var) {
+        switch (op.place) {
+            case RegPlace::Local:
+                registers[op.index] = var;
+                break;
+
+            case RegPlace::Field: {
+                auto field = get_field(op.index);
+                if (field) {
+                    *field = var;
+                } else {
+                    auto new_var = var;
+                    func->cur_obj->set_var(*op.name, new_var);
+                }
+                break;
+            }
+
+            case RegPlace::Global:
+                frame.globals.insert_or_assign(*op.name, var);
+                break;
+        }
+    };
+
+    auto profiler = frame.manager.get_profiler();
+    std::size_t pc = 0;
+    while (pc < ops.size()) {
+        const auto &op = ops[pc];
+        if (profiler) {
+            profiler->at(*op.command);
+        }
+        switch (op.type) {
+            case RegOpType::Const:
+                registers[op.dst] = method.constants[op.src1];
+                break;
+
+            case RegOpType::Load: {
+                auto var = get_place(op);
+                if (not var) {
+                    func->runtime_error(*op.command, "\"" + *op.name
+                                                     + "\" is not defined.");
+                    return true;
+                }
+                registers[op.dst] = *var;
+                break;
+            }
+
+            case RegOpType::Store:
+                set_place(op, *registers[op.src1]);
+                break;
+
+            case RegOpType::StoreConst:
+                set_place(op, method.constants[op.src1]);
+                break;
+
+            case RegOpType::LoadSelf:
+                registers[op.dst] = Variable{func->cur_obj};
+                break;
+
+            case RegOpType::LoadObjectField: {
+                auto obj_var = get_place(op);
+                if (not obj_var) {
+                    func->runtime_error(*op.command, "\"" + *op.name
+                                                     + "\" is not defined.");
+                    return true;
+                }
+                auto object = obj_var->get_instance();
+                if (not object) {
+                    func->runtime_error(*op.command,
+                                        "Cannot retrieve field from"
+                                        " non-instance.");
+                    return true;
+                }
+                auto field = (*object)->find_var(*op.field_name);
+                if (not field) {
+                    func->runtime_error(*op.command, "\"" + *op.field_name
+                                                     + "\" is not defined.");
+                    return true;
+                }
+                registers[op.dst] = *field;
+                break;
+            }
+
+            case RegOpType::Push:
+                frame.stack.push_back(*registers[op.src1]);
+                break;
+
+            case RegOpType::PushConst:
+                frame.stack.push_back(method.constants[op.src1]);
+                break;
+
+            // The numbers are taken in the same order as the builtins take
+            // them from the stack, where src2 is on top
+            case RegOpType::Math: {
+                const auto &lhs = *registers[op.src1];
+                const auto &rhs = *registers[op.src2];
+                if (lhs.get_type() != VarType::Number
+                    or rhs.get_type() != VarType::Number)
+                {
+                    if (run_builtin(op, func, frame, registers)) {
+                        return true;
+                    }
+                    break;
+                }
+                auto num1 = *lhs.get_number();
+                auto num2 = *rhs.get_number();
+                double result = 0.0;
+                switch (op.builtin) {
+                    case Builtin::MathAdd:
+                        result = num2 + num1;
+                        break;
+                    case Builtin::MathSub:
+                        result = num1 - num2;
+                        break;
+                    case Builtin::MathMult:
+                        result = num2 * num1;
+                        break;
+                    case Builtin::MathDiv:
+                        result = num1 / num2;
+                        break;
+                    case Builtin::MathMod:
+                        result = std::fmod(num1, num2);
+                        break;
+                    case Builtin::MathEqual:
+                        result = num2 == num1 ? 1.0: 0.0;
+                        break;
+                    case Builtin::MathNotEqual:
+                        result = num2 != num1 ? 1.0: 0.0;
+                        break;
+                    case Builtin::MathLessThan:
+                        result = num1 < num2 ? 1.0: 0.0;
+                        break;
+                    case Builtin::MathLessOrEqual:
+                        result = num1 <= num2 ? 1.0: 0.0;
+                        break;
+                    case Builtin::MathGreaterThan:
+                        result = num1 > num2 ? 1.0: 0.0;
+                        break;
+                    case Builtin::MathGreaterOrEqual:
+                        result = num1 >= num2 ? 1.0: 0.0;
+                        break;
+                    default:
+                        assert(false);
+                        break;
+                }
+                registers[op.dst] = result;
+                break;
+            }
+
+            case RegOpType::Builtin:
+                if (run_builtin(op, func, frame, registers)) {
+                    return true;
+                }
+                break;
+
+            case RegOpType::Run: {
+                std::size_t i = 0;
+                switch (func->run_command(*op.command, i, frame)) {
+                    case CommandResult::Next:
+                    case CommandResult::Jump:
+                        break;
+
+                    case CommandResult::Return:
+                        frame.manager.unwind_scope();
+                        return false;
+
+                    case CommandResult::Error:
+                        return true;
+                }
+                break;
+            }
+
+            case RegOpType::LoopBegin: {
+                auto var = get_place(op);
+                if (not var) {
+                    func->runtime_error(*op.command, "\"" + *op.name
+                                                     + "\" is not defined.");
+                    return true;
+                } else if (not *var) {
+                    pc = op.target;
+                    continue;
+                }
+                break;
+            }
+
+            // The matching LoopBegin would've failed if the loop variable
+            // wasn't defined
+            case RegOpType::LoopEnd: {
+                auto var = get_place(op);
+                if (var and *var) {
+                    pc = op.target;
+                    continue;
+                }
+                break;
+            }
+        }
+        pc++;
+    }
+
+    frame.manager.unwind_scope();
+    return false;
+}
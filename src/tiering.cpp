@@ -0,0 +1,121 @@
+#include "tiering.hpp"
+#include "build.hpp"
+#include "compiler.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined(__unix__)
+#include <dlfcn.h>
+#include <unistd.h>
+#define TIERING_SUPPORTED 1
+#else
+#define TIERING_SUPPORTED 0
+#endif
+
+// Returns the directory that built programs are cached in, which follows the
+// XDG base directory specification
+std::filesystem::path get_cache_dir() {
+    auto cache_home = std::getenv("XDG_CACHE_HOME");
+    if (cache_home and *cache_home != '\0') {
+        return std::filesystem::path{cache_home} / "glass";
+    }
+    auto home = std::getenv("HOME");
+    if (home and *home != '\0') {
+        return std::filesystem::path{home} / ".cache" / "glass";
+    }
+    std::error_code err;
+    return std::filesystem::temp_directory_path(err) / "glass-cache";
+}
+
+// Compiles the classes to C, and works out where the shared object built from
+// the C is cached. The C compiler is part of what identifies a build, so
+// changing it gives a new one
+TieredCompiler::TieredCompiler(const ClassMap &classes) {
+    std::ostringstream source;
+    output_program(source, classes);
+    c_source = source.str();
+
+    auto hash = std::hash<std::string>{}(get_c_compiler() + "\n" + c_source);
+    std::ostringstream file_name;
+    file_name << std::hex << std::setw(16) << std::setfill('0') << hash
+              << ".so";
+    object_path = get_cache_dir() / file_name.str();
+}
+
+// Waits for the build to finish, so that it isn't left half done
+TieredCompiler::~TieredCompiler() {
+    if (build_thread.joinable()) {
+        build_thread.join();
+    }
+}
+
+// Returns whether programs can be built and loaded on this machine
+bool TieredCompiler::is_supported() {
+    return TIERING_SUPPORTED;
+}
+
+// If the program has already been built, runs the built program, returning
+// its exit status. The shared object is never unloaded, as the program cleans
+// up after itself when the interpreter exits
+std::optional<int> TieredCompiler::run_native() {
+#if TIERING_SUPPORTED
+    std::error_code err;
+    if (not std::filesystem::exists(object_path, err)) {
+        return std::nullopt;
+    }
+    auto handle = dlopen(object_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (not handle) {
+        return std::nullopt;
+    }
+    auto symbol = dlsym(handle, GLASS_MAIN.c_str());
+    if (not symbol) {
+        dlclose(handle);
+        return std::nullopt;
+    }
+
+    int (*glass_main)();
+    std::memcpy(&glass_main, &symbol, sizeof(glass_main));
+    std::cout.flush();
+    auto status = glass_main();
+    std::fflush(stdout);
+    return status;
+#else
+    return std::nullopt;
+#endif
+}
+
+// Starts building the program in the background. The build is written to a
+// file of its own and then renamed into place, so other runs of the program
+// never see a partial build
+void TieredCompiler::start_build() {
+#if TIERING_SUPPORTED
+    build_thread = std::thread{[this] {
+        std::error_code err;
+        std::filesystem::create_directories(object_path.parent_path(), err);
+        if (err) {
+            return;
+        }
+
+        auto temp_path = object_path.string() + "." + std::to_string(getpid());
+        auto c_path = temp_path + ".c";
+        {
+            std::ofstream file{c_path};
+            if (not file.is_open()) {
+                return;
+            }
+            file << c_source;
+        }
+        if (not build_shared_object(c_path, temp_path)) {
+            std::filesystem::rename(temp_path, object_path, err);
+        }
+        std::filesystem::remove(c_path, err);
+        std::filesystem::remove(temp_path, err);
+    }};
+#endif
+}
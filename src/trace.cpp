@@ -0,0 +1,662 @@
+#include "trace.hpp"
+#include "instance.hpp"
+#include "instanceManager.hpp"
+#include "variable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <iterator>
+
+bool Tracer::is_recording() const {
+    return recording.has_value();
+}
+
+// Keeps track of how deep in calls the interpreter is while recording, and
+// starts recording the commands of a method that was just entered
+void Tracer::enter_function() {
+    if (not recording) {
+        return;
+    }
+    recording->depth++;
+    if (recording->entering) {
+        recording->traced_depth++;
+        recording->slots.emplace_back();
+        recording->entering = false;
+    }
+}
+
+// Records a return from a method being recorded. If the function with the loop
+// returns, or there's an error, the recording is given up on
+void Tracer::leave_function(bool error) {
+    if (not recording) {
+        return;
+    }
+    if (error or recording->depth == 0) {
+        abort_recording();
+        return;
+    }
+    if (recording->depth == recording->traced_depth) {
+        TraceOp op;
+        op.type = TraceOpType::Leave;
+        recording->ops.push_back(op);
+        recording->traced_depth--;
+        recording->slots.pop_back();
+    }
+    recording->depth--;
+}
+
+// Returns the slot for a local variable of the method being recorded, or
+// JIT_MAX_SLOTS if it isn't a local variable or there are no slots left
+std::size_t Tracer::get_slot(const std::string &name) {
+    if (name[0] != '_') {
+        return JIT_MAX_SLOTS;
+    }
+    auto &slots = recording->slots.back();
+    auto found = slots.find(name);
+    if (found != slots.end()) {
+        return found->second;
+    } else if (slots.size() == JIT_MAX_SLOTS) {
+        return JIT_MAX_SLOTS;
+    }
+    return slots.emplace(name, slots.size()).first->second;
+}
+
+// Makes an operation work on a local variable directly, if it has a slot
+void Tracer::set_local(TraceOp &op, TraceOpType type, const std::string &name)
+{
+    auto slot = get_slot(name);
+    if (slot != JIT_MAX_SLOTS) {
+        op.type = type;
+        op.name = &name;
+        op.slot = slot;
+    }
+}
+
+// Records a command that's about to be run, unless it's in a method that isn't
+// being recorded
+void Tracer::record(Function *func, std::size_t i, Frame &frame) {
+    auto &rec = *recording;
+    if (rec.depth != rec.traced_depth) {
+        return;
+    } else if (rec.ops.size() == TRACE_MAX_LENGTH) {
+        abort_recording();
+        return;
+    }
+
+    const auto &command = (*func->commands)[i];
+    TraceOp op;
+    op.command = &command;
+    op.index = i;
+    switch (command.get_type()) {
+        case CommandType::LoopBegin:
+        case CommandType::LoopEnd: {
+            const auto &name = command.get_loop_var();
+            auto val = func->get_val(frame, name);
+            if (not val) {
+                abort_recording();
+                return;
+            }
+            op.type = TraceOpType::Guard;
+            op.name = &name;
+            op.slot = get_slot(name);
+            op.jumps = command.get_type() == CommandType::LoopBegin
+                       ? not *val : static_cast<bool>(*val);
+
+            // The trace is finished when the loop goes around again
+            if (&command == rec.loop_end and rec.traced_depth == 0) {
+                if (not op.jumps) {
+                    abort_recording();
+                    return;
+                }
+                rec.ops.push_back(op);
+                finish_recording();
+                return;
+            }
+            break;
+        }
+
+        // Returns from methods are recorded once they've returned
+        case CommandType::Return:
+            if (rec.traced_depth == 0) {
+                abort_recording();
+            }
+            return;
+
+        case CommandType::PushName:
+            op.type = TraceOpType::PushName;
+            break;
+
+        case CommandType::PushNumber:
+            op.type = TraceOpType::PushNumber;
+            op.number = command.get_number();
+            break;
+
+        case CommandType::PushString:
+            op.type = TraceOpType::PushString;
+            break;
+
+        case CommandType::LoadVar:
+            set_local(op, TraceOpType::LoadLocal, command.get_string());
+            break;
+
+        case CommandType::AssignTo:
+            set_local(op, TraceOpType::StoreLocal, command.get_string());
+            break;
+
+        case CommandType::StoreNumber:
+            set_local(op, TraceOpType::StoreLocalNumber,
+                      command.get_first_name());
+            op.number = command.get_number();
+            break;
+
+        // Calls are followed into the methods they call, apart from builtins,
+        // which are run directly
+        case CommandType::FuncCall: {
+            auto resolved = command.get_resolved_builtin();
+            if (resolved) {
+                op.type = TraceOpType::Builtin;
+                op.builtin = *resolved;
+                if (not command.is_unchecked()) {
+                    op.arg_types = builtin_arg_types(*resolved);
+                }
+                break;
+            }
+
+            auto obj_var = func->get_val(frame, command.get_first_name());
+            if (not obj_var or obj_var->get_type() != VarType::Instance) {
+                break;
+            }
+            const auto &type = (*obj_var->get_instance())->get_class();
+            const auto &fname = command.get_second_name();
+            if (not type.has_function(fname)) {
+                break;
+            }
+            const auto &callee = type.get_function(fname);
+            op.receiver = &command.get_first_name();
+            op.receiver_slot = get_slot(*op.receiver);
+            op.receiver_class = &type;
+            if (callee.size() == 1 and
+                callee.front().get_type() == CommandType::BuiltinFunction)
+            {
+                op.type = TraceOpType::Builtin;
+                op.builtin = callee.front().get_builtin();
+                if (not command.is_unchecked()) {
+                    op.arg_types = builtin_arg_types(op.builtin);
+                }
+            } else if (rec.traced_depth < TRACE_MAX_DEPTH) {
+                op.type = TraceOpType::Enter;
+                op.callee = &callee;
+                rec.entering = true;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+    rec.ops.push_back(op);
+}
+
+// Gives up on the recording, leaving it to be recorded again once the loop
+// has gone around often enough, or the trace has left from the same place
+// often enough, unless it's been given up on too often
+void Tracer::abort_recording() {
+    if (recording->exit) {
+        recording->exit->exits = 0;
+        recording->exit->aborts++;
+    } else {
+        auto &loop = loops[recording->loop_end];
+        loop.count = 0;
+        loop.aborts++;
+    }
+    recording.reset();
+}
+
+// Optimizes the recorded trace, and keeps it to be run in place of its loop,
+// or for a side trace, in place of leaving the trace it starts from
+void Tracer::finish_recording() {
+    auto trace = std::make_unique<Trace>();
+    trace->ops = std::move(recording->ops);
+    trace->start_depth = recording->start_depth;
+    optimize_trace(trace->ops, trace->start_depth);
+
+    auto &loop = loops[recording->loop_end];
+    if (recording->exit) {
+        recording->exit->side = trace.get();
+        loop.side_traces.push_back(std::move(trace));
+    } else {
+        loop.trace = std::move(trace);
+    }
+    recording.reset();
+}
+
+// Called after a LoopEnd command jumps back to the start of its loop, with i
+// set to the position of the loop's LoopBegin command. Runs the loop's trace
+// if it has one, or starts recording one once the loop has gone around often
+// enough. After running a trace, i is set to the position before the command
+// the interpreter carries on from. Returns whether there was an error of some
+// sort
+bool Tracer::loop_back(Function *func, const Command &command, std::size_t &i,
+                       Frame &frame)
+{
+    // Loops aren't run or recorded while another loop is being recorded, as
+    // the recording has to see every command that's run
+    if (recording) {
+        return false;
+    }
+
+    auto &loop = loops[&command];
+    if (loop.trace) {
+        if (loop.disabled) {
+            return false;
+        }
+        return run_trace(loop, command, func, frame, i);
+    } else if (loop.aborts < TRACE_MAX_ABORTS
+               and ++loop.count == TRACE_THRESHOLD)
+    {
+        recording.emplace();
+        recording->loop_end = &command;
+        recording->slots.emplace_back();
+    }
+    return false;
+}
+
+// A method entered by a trace
+struct TracedCall {
+    Function func;
+    VarMap locals;
+    Frame frame;
+
+    // The operation that entered the method
+    const TraceOp &call;
+
+    TracedCall(const TraceOp &call, Instance *receiver, Frame &caller):
+    func(*call.callee, call.command->get_second_name(), receiver),
+    frame{caller.manager, caller.classes, caller.stack, caller.globals, locals},
+    call(call) {
+    }
+};
+
+// Returns whether the values on the top of the stack have the given types
+bool stack_has_types(const std::vector<Variable> &stack,
+                     const std::vector<VarType> &types)
+{
+    if (stack.size() < types.size()) {
+        return false;
+    }
+    return std::equal(types.begin(), types.end(),
+                      stack.end() - types.size(),
+                      [] (VarType type, const Variable &var) {
+                          return var.get_type() == type;
+                      });
+}
+
+// Runs a loop's trace over and over until one of its guards fails, carrying
+// on with a side trace if there is one for that guard, and otherwise leaving,
+// after which the interpreter finishes running each of the methods the trace
+// is in. Sets i to the position before the command the function with the loop
+// carries on from. Returns whether there was an error of some sort
+bool Tracer::run_trace(LoopInfo &loop, const Command &loop_end, Function *func,
+                       Frame &frame, std::size_t &i)
+{
+    // The methods the trace is in, with the function with the loop at the
+    // bottom
+    std::array<std::optional<TracedCall>, TRACE_MAX_DEPTH> calls;
+    std::array<Function *, TRACE_MAX_DEPTH + 1> funcs;
+    std::array<Frame *, TRACE_MAX_DEPTH + 1> frames;
+    funcs[0] = func;
+    frames[0] = &frame;
+    std::size_t depth = 0;
+
+    // Each trace gives out the slots of the methods it's in as it likes, so
+    // they're cleared whenever a different trace starts running
+    auto clear_slots = [&] () {
+        for (std::size_t j = 0; j <= depth; j++) {
+            std::fill(std::begin(frames[j]->slots), std::end(frames[j]->slots),
+                      nullptr);
+        }
+    };
+
+    // Returns the receiver of an operation, as long as it's an instance of the
+    // class it was when the operation was recorded
+    auto get_receiver = [] (const TraceOp &op, Function *func, Frame &frame) {
+        std::optional<Variable> var;
+        if (op.receiver_slot != JIT_MAX_SLOTS) {
+            auto slot = frame.get_slot(*op.receiver, op.receiver_slot, false);
+            if (slot) {
+                var = *slot;
+            }
+        } else {
+            var = func->get_val(frame, *op.receiver);
+        }
+        auto object = var ? var->get_instance() : std::nullopt;
+        if (not object or &(*object)->get_class() != op.receiver_class) {
+            return static_cast<Instance *>(nullptr);
+        }
+        return *object;
+    };
+
+    // Outputs the calls the trace is in to the stack trace of an error
+    auto output_calls = [&] () {
+        for (; depth > 0; depth--) {
+            const auto &command = *calls[depth - 1]->call.command;
+            funcs[depth - 1]->output_stack_trace_line(command.get_file_name(),
+                                                      command.get_2nd_line(),
+                                                      command.get_2nd_col());
+        }
+        return true;
+    };
+
+    auto &stack = frame.stack;
+    auto trace = loop.trace.get();
+    bool finished_pass = false;
+    std::size_t pc = 0;
+    clear_slots();
+    while (true) {
+        auto &op = trace->ops[pc];
+        auto cur_func = funcs[depth];
+        auto &cur_frame = *frames[depth];
+
+        bool exit = false;
+        switch (op.type) {
+            case TraceOpType::Run: {
+                auto index = op.index;
+                if (cur_func->run_command(*op.command, index, cur_frame)
+                    == CommandResult::Error)
+                {
+                    return output_calls();
+                }
+                break;
+            }
+
+            case TraceOpType::Guard: {
+                std::optional<bool> jumps;
+                if (op.slot != JIT_MAX_SLOTS) {
+                    auto var = cur_frame.get_slot(*op.name, op.slot, false);
+                    if (var) {
+                        jumps = static_cast<bool>(*var);
+                    }
+                } else {
+                    auto var = cur_func->get_val(cur_frame, *op.name);
+                    if (var) {
+                        jumps = static_cast<bool>(*var);
+                    }
+                }
+                if (jumps and op.command->get_type() == CommandType::LoopBegin) {
+                    jumps = not *jumps;
+                }
+                exit = jumps != op.jumps;
+                break;
+            }
+
+            case TraceOpType::Enter: {
+                auto receiver = get_receiver(op, cur_func, cur_frame);
+                if (not receiver) {
+                    exit = true;
+                    break;
+                }
+                auto &call = calls[depth].emplace(op, receiver, cur_frame);
+                depth++;
+                funcs[depth] = &call.func;
+                frames[depth] = &call.frame;
+                frame.manager.new_scope(&call.func, &call.locals);
+                break;
+            }
+
+            case TraceOpType::Leave:
+                frame.manager.unwind_scope();
+                calls[depth - 1].reset();
+                depth--;
+                break;
+
+            case TraceOpType::Builtin:
+                if ((op.receiver and not get_receiver(op, cur_func, cur_frame))
+                    or not stack_has_types(stack, op.arg_types))
+                {
+                    exit = true;
+                    break;
+                }
+                if (handle_builtin(op.builtin, stack, frame.globals, false)) {
+                    std::cerr << "Stack trace:\n";
+                    cur_func->output_stack_trace_line(
+                        op.command->get_file_name(),
+                        op.command->get_2nd_line(), op.command->get_2nd_col());
+                    return output_calls();
+                }
+                break;
+
+            case TraceOpType::PushName:
+                stack.emplace_back(VarType::Name, op.command->get_string());
+                break;
+
+            case TraceOpType::PushNumber:
+                stack.emplace_back(op.number);
+                break;
+
+            case TraceOpType::PushString:
+                stack.emplace_back(VarType::String, op.command->get_string());
+                break;
+
+            case TraceOpType::LoadLocal: {
+                auto var = cur_frame.get_slot(*op.name, op.slot, false);
+                if (not var) {
+                    exit = true;
+                    break;
+                }
+                stack.push_back(*var);
+                break;
+            }
+
+            case TraceOpType::StoreLocal:
+                if (stack.empty()) {
+                    exit = true;
+                    break;
+                }
+                *cur_frame.get_slot(*op.name, op.slot, true)
+                    = std::move(stack.back());
+                stack.pop_back();
+                break;
+
+            case TraceOpType::StoreLocalNumber:
+                *cur_frame.get_slot(*op.name, op.slot, true) = op.number;
+                break;
+        }
+
+        if (not exit) {
+            // Every trace ends by going back around the loop
+            if (++pc == trace->ops.size()) {
+                if (trace != loop.trace.get()) {
+                    trace = loop.trace.get();
+                    clear_slots();
+                }
+                pc = 0;
+                finished_pass = true;
+            }
+            continue;
+        }
+
+        // Nothing has been done by the operation that failed, so a side trace
+        // can start by doing it over again
+        if (op.side) {
+            trace = op.side;
+            pc = 0;
+            clear_slots();
+            continue;
+        }
+
+        // Traces that rarely get through the loop aren't worth running
+        if (not finished_pass and ++loop.early_exits == TRACE_MAX_EARLY_EXITS) {
+            loop.disabled = true;
+        }
+
+        // Once the trace has left from the same place often enough, the
+        // interpreter records a side trace from there
+        if (not recording and not loop.disabled
+            and op.aborts < TRACE_MAX_ABORTS
+            and loop.side_traces.size() < TRACE_MAX_SIDE_TRACES
+            and ++op.exits == TRACE_SIDE_THRESHOLD)
+        {
+            recording.emplace();
+            recording->loop_end = &loop_end;
+            recording->exit = &op;
+            recording->start_depth = depth;
+            recording->traced_depth = depth;
+            recording->slots.resize(depth + 1);
+        }
+
+        // The method the trace left from carries on from the command that
+        // failed, and each method it's in carries on after it returns. While
+        // recording, each of them is treated as being called from the one
+        // before it
+        auto resume = op.index;
+        for (; depth > 0; depth--) {
+            auto &call = *calls[depth - 1];
+            if (recording) {
+                recording->depth = depth - 1;
+            }
+            if (call.func.interpret<false>(call.frame, resume)) {
+                depth--;
+                const auto &command = *call.call.command;
+                funcs[depth]->output_stack_trace_line(command.get_file_name(),
+                                                      command.get_2nd_line(),
+                                                      command.get_2nd_col());
+                return output_calls();
+            }
+            resume = call.call.index + 1;
+            calls[depth - 1].reset();
+        }
+        i = resume - 1;
+        return false;
+    }
+}
+
+// Whether a builtin always gives the same number when given numbers, and never
+// fails, so that it can be worked out while optimizing a trace
+bool is_foldable(Builtin builtin) {
+    switch (builtin) {
+        case Builtin::MathAdd:
+        case Builtin::MathSub:
+        case Builtin::MathMult:
+        case Builtin::MathFloor:
+        case Builtin::MathEqual:
+        case Builtin::MathNotEqual:
+        case Builtin::MathLessThan:
+        case Builtin::MathLessOrEqual:
+        case Builtin::MathGreaterThan:
+        case Builtin::MathGreaterOrEqual:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Optimizes a trace by keeping track of the local variables known to hold a
+// number. Loading such a variable pushes the number instead, its guards are
+// removed, and builtins that are given numbers that are known are worked out.
+// Numbers that are pushed and then assigned are stored directly. Nothing is
+// known at the start of the trace, as it can be run after any pass
+void optimize_trace(std::vector<TraceOp> &ops, std::size_t start_depth) {
+    // The numbers known to be in each slot, for each method the trace is in
+    using KnownSlots = std::array<std::optional<double>, JIT_MAX_SLOTS>;
+    std::vector<KnownSlots> known(start_depth + 1);
+
+    std::vector<TraceOp> optimized;
+    optimized.reserve(ops.size());
+    for (std::size_t i = 0; i < ops.size(); i++) {
+        auto op = ops[i];
+        auto &slots = known.back();
+
+        // The numbers pushed by the previous operations, which are always in
+        // the same method as this one
+        auto pushed = [&] (std::size_t count) {
+            return optimized.size() >= count and
+                   std::all_of(optimized.end() - count, optimized.end(),
+                               [] (const TraceOp &prev) {
+                                   return prev.type == TraceOpType::PushNumber;
+                               });
+        };
+
+        switch (op.type) {
+            // A command run by the interpreter can assign any of the method's
+            // local variables
+            case TraceOpType::Run:
+                slots.fill(std::nullopt);
+                break;
+
+            case TraceOpType::Guard:
+                if (op.slot != JIT_MAX_SLOTS and slots[op.slot]
+                    and i + 1 != ops.size())
+                {
+                    bool jumps = *slots[op.slot] != 0.0;
+                    if (op.command->get_type() == CommandType::LoopBegin) {
+                        jumps = not jumps;
+                    }
+                    if (jumps == op.jumps) {
+                        continue;
+                    }
+                }
+                break;
+
+            case TraceOpType::Enter:
+                optimized.push_back(op);
+                known.emplace_back();
+                continue;
+
+            case TraceOpType::Leave:
+                known.pop_back();
+                break;
+
+            case TraceOpType::Builtin: {
+                auto arg_count = builtin_stack_effect(op.builtin).first;
+                if (op.receiver or not is_foldable(op.builtin)
+                    or not pushed(arg_count))
+                {
+                    break;
+                }
+                std::vector<Variable> args;
+                for (auto j = optimized.size() - arg_count;
+                     j < optimized.size(); j++)
+                {
+                    args.emplace_back(optimized[j].number);
+                }
+                VarMap globals;
+                handle_builtin(op.builtin, args, globals, false);
+                optimized.resize(optimized.size() - arg_count);
+                op.type = TraceOpType::PushNumber;
+                op.number = *args.back().get_number();
+                break;
+            }
+
+            case TraceOpType::LoadLocal:
+                if (slots[op.slot]) {
+                    op.type = TraceOpType::PushNumber;
+                    op.number = *slots[op.slot];
+                }
+                break;
+
+            case TraceOpType::StoreLocal:
+                if (not pushed(1)) {
+                    slots[op.slot] = std::nullopt;
+                    break;
+                }
+                op.type = TraceOpType::StoreLocalNumber;
+                op.number = optimized.back().number;
+                optimized.pop_back();
+                slots[op.slot] = op.number;
+                break;
+
+            case TraceOpType::StoreLocalNumber:
+                slots[op.slot] = op.number;
+                break;
+
+            case TraceOpType::PushName:
+            case TraceOpType::PushNumber:
+            case TraceOpType::PushString:
+                break;
+        }
+        optimized.push_back(op);
+    }
+    ops = std::move(optimized);
+}
@@ -0,0 +1,571 @@
+#include "builtins.hpp"
+#include "types.hpp"
+
+#include <cctype>
+#include <functional>
+#include <vector>
+
+// The number of times the inferred types are refined before stopping
+constexpr int MAX_TYPE_PASSES = 16;
+
+// A value on the stack while following the types through a method
+struct StackType {
+    // The type of the value
+    ValueType type;
+
+    // The value, if it's a name that's known statically
+    std::optional<std::string> name;
+};
+
+// What is known about the types at some point in a method
+struct TypeState {
+    // The values on the top of the stack. Anything below them is unknown
+    std::vector<StackType> stack;
+
+    // The types of the local variables that are known to be defined
+    std::unordered_map<std::string, VarType> locals;
+};
+
+// Called for each assignment found with the name being assigned to, or
+// std::nullopt if it can't be determined statically, and the type assigned
+using TypeAssignmentCallback = std::function<void(const std::optional<std::string> &,
+                                                  ValueType)>;
+
+// Returns the type of a name that isn't a local variable, given the class of
+// the instance it belongs to
+using NonLocalTypeFunc = std::function<ValueType(const std::string &,
+                                                 const std::string &)>;
+
+// Follows the types of values through the commands of a method
+class MethodTypes {
+    private:
+        const CommandList &commands;
+        const std::string &class_name;
+        const ClassMap &classes;
+        const NameClassMap &receivers;
+        const NonLocalTypeFunc &nonlocal_type;
+        const TypeAssignmentCallback &callback;
+
+        // The fields of the current instance that are known to be defined
+        const std::unordered_set<std::string> &defined_fields;
+
+        // If given, the commands whose operands are proven to have the right
+        // types are marked as unchecked in this list
+        CommandList *to_annotate;
+
+        // The number of commands that were marked as unchecked, and the
+        // number of calls that were resolved to builtins
+        std::size_t num_unchecked = 0;
+        std::size_t num_resolved = 0;
+
+        // Marks whether the command at the given index is unchecked
+        void annotate(std::size_t index, bool unchecked) {
+            if (to_annotate) {
+                (*to_annotate)[index].set_unchecked(unchecked);
+                num_unchecked += unchecked;
+            }
+        }
+
+        // Sets the builtin that the call at the given index is resolved to
+        void resolve(std::size_t index, std::optional<Builtin> builtin) {
+            if (to_annotate) {
+                (*to_annotate)[index].set_resolved_builtin(builtin);
+                num_resolved += builtin.has_value();
+            }
+        }
+
+        // Returns the type of a name when in the given state
+        ValueType type_of(const TypeState &state, const std::string &name) const {
+            if (name[0] != '_') {
+                return nonlocal_type(class_name, name);
+            }
+            auto local = state.locals.find(name);
+            if (local == state.locals.end()) {
+                return std::nullopt;
+            }
+            return local->second;
+        }
+
+        // Goes through the commands in the given range, starting in the given
+        // state and leaving the state as it is at the end of the range. If
+        // record is true, the assignments and proven commands are reported
+        void run(std::size_t begin, std::size_t end, TypeState &state,
+                 bool record);
+
+    public:
+        MethodTypes(const CommandList &commands, const std::string &class_name,
+                    const ClassMap &classes, const NameClassMap &receivers,
+                    const NonLocalTypeFunc &nonlocal_type,
+                    const TypeAssignmentCallback &callback,
+                    const std::unordered_set<std::string> &defined_fields,
+                    CommandList *to_annotate = nullptr):
+        commands(commands), class_name(class_name), classes(classes),
+        receivers(receivers), nonlocal_type(nonlocal_type), callback(callback),
+        defined_fields(defined_fields), to_annotate(to_annotate) {
+        }
+
+        void run() {
+            TypeState state;
+            run(0, commands.size(), state, true);
+        }
+
+        std::size_t get_num_unchecked() const {
+            return num_unchecked;
+        }
+
+        std::size_t get_num_resolved() const {
+            return num_resolved;
+        }
+};
+
+void MethodTypes::run(std::size_t begin, std::size_t end, TypeState &state,
+                      bool record)
+{
+    auto &stack = state.stack;
+
+    auto pop = [&] () -> StackType {
+        if (stack.empty()) {
+            return {};
+        }
+        auto value = std::move(stack.back());
+        stack.pop_back();
+        return value;
+    };
+
+    // Records an assignment to a name. If the name isn't known statically,
+    // any local variable could have been assigned to
+    auto assign = [&] (const std::optional<std::string> &name, ValueType type) {
+        if (record) {
+            callback(name, type);
+        }
+        if (not name) {
+            state.locals.clear();
+        } else if ((*name)[0] != '_') {
+            return;
+        } else if (type) {
+            state.locals.insert_or_assign(*name, *type);
+        } else {
+            state.locals.erase(*name);
+        }
+    };
+
+    for (auto i = begin; i < end; i++) {
+        const auto &command = commands[i];
+        switch (command.get_type()) {
+            case CommandType::AssignClass:
+                pop();
+                assign(pop().name, VarType::Instance);
+                stack.clear();
+                break;
+
+            case CommandType::AssignSelf:
+            case CommandType::StoreSelf: {
+                auto name = command.get_type() == CommandType::StoreSelf
+                          ? command.get_string() : pop().name;
+                assign(name, VarType::Instance);
+                break;
+            }
+
+            case CommandType::AssignValue: {
+                auto val = pop();
+                assign(pop().name, val.type);
+                break;
+            }
+
+            case CommandType::DupElement: {
+                auto index = static_cast<std::size_t>(command.get_number());
+                if (index >= stack.size()) {
+                    stack.emplace_back();
+                } else {
+                    stack.push_back(stack[stack.size() - index - 1]);
+                }
+                break;
+            }
+
+            case CommandType::GetFunction:
+                pop();
+                pop();
+                stack.push_back({VarType::Function, std::nullopt});
+                break;
+
+            case CommandType::GetValue: {
+                auto name = pop().name;
+                stack.push_back({name ? type_of(state, *name) : std::nullopt,
+                                 std::nullopt});
+                break;
+            }
+
+            // The types at the start of a loop are the ones that hold both
+            // when the loop is entered and after each time through the loop,
+            // found by going through the loop until they stop changing. If
+            // the loop's variable is always a number there, the loop's checks
+            // of it can skip checking its type
+            case CommandType::LoopBegin: {
+                auto loop_end = command.get_jump();
+                TypeState head{{}, state.locals};
+                while (true) {
+                    TypeState body = head;
+                    run(i + 1, loop_end, body, false);
+                    std::unordered_map<std::string, VarType> joined;
+                    for (const auto &[name, type]: head.locals) {
+                        auto found = body.locals.find(name);
+                        if (found != body.locals.end() and found->second == type) {
+                            joined.emplace(name, type);
+                        }
+                    }
+                    if (joined == head.locals) {
+                        break;
+                    }
+                    head.locals = std::move(joined);
+                }
+                TypeState body = head;
+                run(i + 1, loop_end, body, record);
+                if (record) {
+                    auto var = head.locals.find(command.get_loop_var());
+                    bool numeric = var != head.locals.end() and
+                                   var->second == VarType::Number;
+                    annotate(i, numeric);
+                    annotate(loop_end, numeric);
+                }
+                state = std::move(head);
+                i = loop_end;
+                break;
+            }
+
+            case CommandType::PopStack:
+                pop();
+                break;
+
+            case CommandType::PushName:
+                stack.push_back({VarType::Name, command.get_string()});
+                break;
+
+            case CommandType::PushNumber:
+                stack.push_back({VarType::Number, std::nullopt});
+                break;
+
+            case CommandType::PushString:
+                stack.push_back({VarType::String, std::nullopt});
+                break;
+
+            case CommandType::AssignTo:
+                assign(command.get_string(), pop().type);
+                break;
+
+            // A call of a builtin with arguments that are known to have the
+            // right types doesn't need to check them, and a call on a
+            // receiver that's known to be an instance of the builtin's class
+            // doesn't need to look up the receiver
+            case CommandType::FuncCall: {
+                auto builtin = get_called_builtin(command, classes, receivers);
+                if (not builtin) {
+                    stack.clear();
+                    break;
+                }
+                if (record) {
+                    const auto &receiver = command.get_first_name();
+                    bool is_instance = receiver[0] == '_'
+                        ? type_of(state, receiver) == VarType::Instance
+                        : defined_fields.count(receiver) > 0;
+                    resolve(i, is_instance ? std::optional{builtin->second}
+                                           : std::nullopt);
+                }
+                auto arg_types = builtin_arg_types(builtin->second);
+                bool proven = true;
+                for (auto arg = arg_types.size(); arg-- > 0;) {
+                    if (pop().type != arg_types[arg]) {
+                        proven = false;
+                    }
+                }
+                if (record) {
+                    annotate(i, proven);
+                }
+                for (auto type: builtin_result_types(builtin->second)) {
+                    stack.push_back({type, std::nullopt});
+                }
+                break;
+            }
+
+            case CommandType::NewInst:
+                assign(command.get_first_name(), VarType::Instance);
+                stack.clear();
+                break;
+
+            // Local variables with a known type are known to be defined
+            case CommandType::LoadVar: {
+                auto type = type_of(state, command.get_string());
+                if (record) {
+                    annotate(i, type and command.get_string()[0] == '_');
+                }
+                stack.push_back({type, std::nullopt});
+                break;
+            }
+
+            case CommandType::StoreNumber:
+                assign(command.get_first_name(), VarType::Number);
+                break;
+
+            case CommandType::StoreString:
+                assign(command.get_first_name(), VarType::String);
+                break;
+
+            case CommandType::CopyVar: {
+                auto type = type_of(state, command.get_second_name());
+                if (record) {
+                    annotate(i, type and command.get_second_name()[0] == '_');
+                }
+                assign(command.get_first_name(), type);
+                break;
+            }
+
+            case CommandType::LoadField: {
+                auto receiver = receivers.find(command.get_first_name());
+                if (receiver == receivers.end()) {
+                    stack.emplace_back();
+                    break;
+                }
+                stack.push_back({nonlocal_type(receiver->second,
+                                               command.get_second_name()),
+                                 std::nullopt});
+                break;
+            }
+
+            // Calls can do anything to the stack
+            case CommandType::ExecuteFunc:
+            case CommandType::Return:
+            case CommandType::BuiltinFunction:
+                stack.clear();
+                break;
+
+            // Loops are gone through as a whole when they begin
+            case CommandType::LoopEnd:
+            case CommandType::Nop:
+                break;
+        }
+    }
+}
+
+// Records that a name is assigned a value of the given type
+void add_type(NameTypeMap &names, const std::string &name, ValueType type) {
+    auto found = names.find(name);
+    if (found == names.end()) {
+        names.emplace(name, type);
+    } else if (found->second != type) {
+        found->second = std::nullopt;
+    }
+}
+
+// Returns the type of a field of the given class or of a global variable,
+// according to the types found so far
+ValueType TypeInference::get_type(const std::string &class_name,
+                                  const std::string &name) const
+{
+    if (std::islower(name[0])) {
+        if (dynamic_classes.count(class_name) or not fields.count(class_name)) {
+            return std::nullopt;
+        }
+        auto found = fields.at(class_name).find(name);
+        return found == fields.at(class_name).end() ? std::nullopt : found->second;
+    } else if (dynamic_globals) {
+        return std::nullopt;
+    }
+    auto found = globals.find(name);
+    return found == globals.end() ? std::nullopt : found->second;
+}
+
+// Goes through every method, recording the types assigned to fields and
+// global variables, using the types given by the hypothesis for the values
+// read from them
+void TypeInference::add_assignments(const TypeInference &hypothesis) {
+    globals.clear();
+    fields.clear();
+    dynamic_classes.clear();
+    dynamic_globals = false;
+
+    NonLocalTypeFunc nonlocal_type = [&] (const auto &class_name,
+                                          const auto &name)
+    {
+        return hypothesis.get_type(class_name, name);
+    };
+
+    const std::unordered_set<std::string> no_fields;
+    for (const auto &[class_name, class_info]: *classes) {
+        auto &class_fields = fields[class_name];
+        TypeAssignmentCallback callback = [&] (const auto &name, auto type) {
+            if (not name) {
+                dynamic_classes.insert(class_name);
+                dynamic_globals = true;
+            } else if (std::islower((*name)[0])) {
+                add_type(class_fields, *name, type);
+            } else if ((*name)[0] != '_') {
+                add_type(globals, *name, type);
+            }
+        };
+        for (const auto &[func_name, body]: class_info.get_functions()) {
+            const auto &commands = *body;
+            auto receivers = class_inference->get_scope(class_name, commands);
+            MethodTypes(commands, class_name, *classes, receivers,
+                        nonlocal_type, callback, no_fields).run();
+        }
+    }
+}
+
+// Returns the fields that a constructor assigns to before anything else can
+// run, which are defined whenever any other method of its class runs, since
+// fields can't be deleted
+std::unordered_set<std::string> get_constructed_fields(const CommandList &ctor,
+                                                       const ClassMap &classes,
+                                                       const NameClassMap &receivers)
+{
+    std::unordered_set<std::string> constructed;
+    auto add_field = [&] (const std::string &name) {
+        if (std::islower(name[0])) {
+            constructed.insert(name);
+        }
+    };
+
+    for (const auto &command: ctor) {
+        switch (command.get_type()) {
+            case CommandType::AssignTo:
+            case CommandType::StoreSelf:
+                add_field(command.get_string());
+                break;
+
+            case CommandType::StoreNumber:
+            case CommandType::StoreString:
+            case CommandType::CopyVar:
+                add_field(command.get_first_name());
+                break;
+
+            // Anything could run in the new instance's constructor
+            case CommandType::NewInst: {
+                auto new_class = classes.find(command.get_second_name());
+                if (new_class == classes.end() or
+                    new_class->second.has_constructor())
+                {
+                    return constructed;
+                }
+                add_field(command.get_first_name());
+                break;
+            }
+
+            case CommandType::FuncCall:
+                if (not get_called_builtin(command, classes, receivers)) {
+                    return constructed;
+                }
+                break;
+
+            // Anything could run after these, or they might not run at all
+            case CommandType::AssignClass:
+            case CommandType::ExecuteFunc:
+            case CommandType::LoopBegin:
+            case CommandType::LoopEnd:
+            case CommandType::Return:
+            case CommandType::BuiltinFunction:
+                return constructed;
+
+            case CommandType::AssignSelf:
+            case CommandType::AssignValue:
+            case CommandType::DupElement:
+            case CommandType::GetFunction:
+            case CommandType::GetValue:
+            case CommandType::PopStack:
+            case CommandType::PushName:
+            case CommandType::PushNumber:
+            case CommandType::PushString:
+            case CommandType::LoadVar:
+            case CommandType::LoadField:
+            case CommandType::Nop:
+                break;
+        }
+    }
+    return constructed;
+}
+
+// Starting from knowing nothing about the types of fields and global
+// variables, finds the types assigned to them, which tells us the types of
+// more values read from them, until nothing more is learned. Since each step
+// only relies on what was already proven, the types found can be trusted even
+// if this stops early
+TypeInference::TypeInference(const ClassMap &classes,
+                             const ClassInference &class_inference):
+classes(&classes), class_inference(&class_inference) {
+    dynamic_globals = true;
+    for (const auto &class_info: classes) {
+        dynamic_classes.insert(class_info.first);
+    }
+
+    for (const auto &[class_name, class_info]: classes) {
+        const auto &functions = class_info.get_functions();
+        auto ctor = functions.find("c__");
+        // Inherited constructors run first, so nothing is known to be
+        // assigned before they do
+        if (ctor != functions.end() and class_info.get_parent_ctors().empty()) {
+            auto receivers = class_inference.get_scope(class_name, *ctor->second);
+            constructed_fields.emplace(class_name,
+                get_constructed_fields(*ctor->second, classes, receivers));
+        }
+    }
+
+    for (int i = 0; i < MAX_TYPE_PASSES; i++) {
+        auto refined = *this;
+        refined.add_assignments(*this);
+        if (refined.globals == globals and refined.fields == fields and
+            refined.dynamic_classes == dynamic_classes and
+            refined.dynamic_globals == dynamic_globals)
+        {
+            return;
+        }
+        *this = std::move(refined);
+    }
+}
+
+// Marks the commands of a method whose operands are proven to have the types
+// they need as unchecked, and resolves the calls of builtins on receivers
+// proven to be instances of the builtin's class
+void TypeInference::annotate(CommandList &commands,
+                             const std::string &class_name,
+                             const std::string &method_name,
+                             OptStats *stats) const
+{
+    NonLocalTypeFunc nonlocal_type = [&] (const auto &class_name,
+                                          const auto &name)
+    {
+        return get_type(class_name, name);
+    };
+    TypeAssignmentCallback callback = [] (const auto &, auto) {};
+    auto receivers = class_inference->get_scope(class_name, commands);
+
+    // Within the constructor itself, the fields might not be assigned yet
+    const std::unordered_set<std::string> no_fields;
+    auto constructed = constructed_fields.find(class_name);
+    const auto &defined_fields =
+        method_name == "c__" or constructed == constructed_fields.end()
+        ? no_fields : constructed->second;
+
+    MethodTypes method_types(commands, class_name, *classes, receivers,
+                             nonlocal_type, callback, defined_fields, &commands);
+    method_types.run();
+    if (stats) {
+        if (method_types.get_num_unchecked()) {
+            (*stats)["prove-types"] += method_types.get_num_unchecked();
+        }
+        if (method_types.get_num_resolved()) {
+            (*stats)["resolve-call"] += method_types.get_num_resolved();
+        }
+    }
+}
+
+// Marks the commands throughout the program whose operands are proven to
+// have the types they need as unchecked, and resolves the calls of builtins
+// whose receivers are proven to be instances of the builtin's class
+void annotate_types(ClassMap &classes, OptStats *stats) {
+    ClassInference class_inference{classes};
+    TypeInference type_inference{classes, class_inference};
+    for (auto &[class_name, class_info]: classes) {
+        for (const auto &func_info: class_info.get_functions()) {
+            auto &commands = class_info.get_function(func_info.first);
+            type_inference.annotate(commands, class_name, func_info.first, stats);
+        }
+    }
+}